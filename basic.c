@@ -162,6 +162,8 @@ setgoal (void)
  * vertical motion goal column (set by the "setgoal"
  * routine above) and returns the best offset to use
  * when a vertical motion is made into the line.
+ * On a long line, start from the checkpoint nearest
+ * to the goal column.
  */
 static int
 getgoal (LINE *dlp)
@@ -171,12 +173,12 @@ getgoal (LINE *dlp)
   int newcol;
   int dbo;
   int ulen;
+  int off;
   const uchar *s, *end;
 
-  col = 0;
-  dbo = 0;
-  s = lgets (dlp);
-  end = s + llength (dlp);
+  dbo = lfindcol (dlp, curgoal, &off, &col);
+  s = lgets (dlp) + off;
+  end = lgets (dlp) + llength (dlp);
   while (s < end)
     {
       c = ugetc (s, 0, &ulen);
@@ -428,7 +430,8 @@ swapmark (int f, int n, int k)
  * looking up errors in C programs, which give the
  * error a line number. If an argument is present, then
  * it is the line number, else prompt for a line number
- * to use.
+ * to use.  If the file is still being read in the background,
+ * read it up to that line first.
  */
 int
 gotoline (int f, int n, int k)
@@ -448,12 +451,8 @@ gotoline (int f, int n, int k)
       eprintf ("Bad line");
       return (FALSE);
     }
-  clp = firstline (curbp);	/* "clp" is first line  */
-  while (n != 1 && clp != curbp->b_linep)
-    {
-      clp = lforw (clp);
-      --n;
-    }
+  loadto (curbp, n - 1);
+  clp = blinep (curbp, n - 1);
   if (clp == curbp->b_linep)
     {
       eprintf ("Line number too large");
@@ -0,0 +1,534 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Name:	MicroEMACS
+ *		Benchmarks
+ * By:		Mark Alexander
+ *		marka@pobox.com
+ *
+ * The command in this file times the two ways of storing
+ * a file in a buffer: copying each line separately into
+ * the buffer's line arena, or reading the whole file into
+ * an image and pointing the lines at it (see readlines).
+ * For each method, it reads a file into a scratch buffer,
+ * makes some edits scattered through the buffer, scans every
+ * line for a string, and writes the buffer back out.
+ *
+ * The second command times the search and replace functions
+ * on some generated files, and writes the results in a form
+ * that scripts can read; "make bench-search" runs it.
+ */
+#include	"def.h"
+
+#include	<time.h>
+
+#define	NEDITS	1000		/* Number of edits per run	*/
+#define	BENCHSIZE (8L * 1024 * 1024)	/* Size of generated files */
+
+#if USE_PCRE2
+#define	ENGINE	"pcre2"
+#else
+#define	ENGINE	"spencer"
+#endif
+
+/*
+ * A kind of generated file for bench-search.  The file is
+ * made of words from "words", separated by spaces, with lines
+ * broken after linelen bytes.  Every "every" words, the word is
+ * replaced by "mark" followed by a number, which is what
+ * the patterns look for.
+ */
+typedef struct
+{
+  const char *name;		/* Name in the results		*/
+  const char *const *words;	/* Words to fill lines with	*/
+  int nwords;			/* Number of words		*/
+  int linelen;			/* Bytes per line, roughly	*/
+  int every;			/* Words between marks		*/
+  const char *mark;		/* Word the patterns find	*/
+  const char *regex;		/* Regular expression to find	*/
+  const char *repl;		/* Replacement for literal	*/
+  const char *regrepl;		/* Replacement for regex	*/
+} BENCHCASE;
+
+static const char *const asciiwords[] = {
+  "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+  "lorem", "ipsum", "dolor", "sit", "amet", "needy", "eel"
+};
+
+static const char *const utf8words[] = {
+  "κόσμε", "naïve", "日本語", "Привет", "ζώνη", "café", "ζήλος",
+  "straße", "😀", "αβγ"
+};
+
+static const char *const shortwords[] = {
+  "a", "ab", "fox", "", "}", "end;", "x = 1;"
+};
+
+#define	NELEM(a) ((int) (sizeof (a) / sizeof ((a)[0])))
+
+static const BENCHCASE benchcases[] = {
+  {"ascii", asciiwords, NELEM (asciiwords), 72, 97,
+   "needle", "ne+dle ([0-9]+)", "pin", "pin \\1"},
+  {"utf8", utf8words, NELEM (utf8words), 72, 97,
+   "ζήτα", "ζήτα ([0-9]+)", "ήτα", "ήτα \\1"},
+  {"long", asciiwords, NELEM (asciiwords), 65536, 97,
+   "needle", "ne+dle ([0-9]+)", "pin", "pin \\1"},
+  {"short", shortwords, NELEM (shortwords), 1, 997,
+   "needle", "ne+dle ([0-9]+)", "pin", "pin \\1"}
+};
+
+/*
+ * Return the CPU time in seconds since "start".
+ */
+static double
+elapsed (clock_t start)
+{
+  return (double) (clock () - start) / CLOCKS_PER_SEC;
+}
+
+/*
+ * Make NEDITS edits at lines spread through the current
+ * buffer: insert a word in the middle of the line, delete
+ * part of it again, and sometimes split the line.
+ * Return FALSE if an edit fails.
+ */
+static int
+benchedit (void)
+{
+  int nlines, i;
+
+  nlines = blineno (curbp, curbp->b_linep) + 1;
+  for (i = 0; i < NEDITS; i++)
+    {
+      curwp->w_dot.p = blinep (curbp, (int) ((long) i * 7919 % nlines));
+      curwp->w_dot.o = wllength (curwp->w_dot.p) / 2;
+      if (linsert (5, 0, "bench") == FALSE
+	  || ldelete (3, FALSE) == FALSE
+	  || ((i & 3) == 0 && lnewline () == FALSE))
+	return (FALSE);
+    }
+  return (TRUE);
+}
+
+/*
+ * Scan every line in the current buffer for
+ * the string "s", and return the number of lines
+ * that contain it.
+ */
+static int
+benchscan (const char *s)
+{
+  LINE *lp;
+  const uchar *p, *end;
+  int len, n;
+
+  len = strlen (s);
+  n = 0;
+  for (lp = firstline (curbp); lp != curbp->b_linep; lp = lforw (lp))
+    {
+      p = lgets (lp);
+      end = p + llength (lp) - len;
+      for (; p <= end; p++)
+	if ((p = (const uchar *) memchr (p, s[0], end - p + 1)) == NULL)
+	  break;
+	else if (memcmp (p, s, len) == 0)
+	  {
+	    ++n;
+	    break;
+	  }
+    }
+  return (n);
+}
+
+/*
+ * Prompt for a file name, and time reading,
+ * editing, searching, and writing the file with
+ * each of the two methods of storing lines.  The string
+ * searched for is the last search pattern, or "the" if
+ * there isn't one.  The file is written to a temporary
+ * file whose name is the file name with ".bench" appended,
+ * which is then removed.  The times are shown in a pop-up
+ * window.  The current buffer and window are not changed.
+ */
+int
+benchbackends (int f, int n, int k)
+{
+  BUFFER *bp, *oldbp;
+  EWINDOW oldwin;
+  clock_t start;
+  int s, i, oldpiece, oldbg, oldjou, nfound;
+  double tread, tedit, tscan, twrite;
+  char fname[NFILEN];
+  char tname[NFILEN + 8];
+  char line[64];
+
+  if ((s = egetfname ("Benchmark file: ", fname, NFILEN)) != TRUE)
+    return (s);
+  snprintf (tname, sizeof (tname), "%s.bench", fname);
+  if (bfind ("*bench*", FALSE) != NULL)
+    {
+      eprintf ("Buffer *bench* already exists");
+      return (FALSE);
+    }
+  if ((bp = bfind ("*bench*", TRUE)) == NULL)
+    return (FALSE);
+
+  /* Point the current window at the scratch buffer, without
+   * undo records; everything is put back at the end.
+   */
+  oldbp = curbp;
+  oldwin = *curwp;
+  oldpiece = piecetable;
+  oldbg = bgread;
+  bgread = FALSE;
+  oldjou = journal;
+  journal = FALSE;
+  curbp = bp;
+  curwp->w_bufp = bp;
+  disablesaveundo ();
+
+  blistp->b_flag &= ~BFCHG;
+  if ((s = bclear (blistp)) != TRUE)
+    goto out;
+  strcpy (blistp->b_fname, "");
+  addline ("Method     Read    Edit  Search   Write    Lines    Found");
+  addline ("------     ----    ----  ------   -----    -----    -----");
+  for (i = 0; i < 2; i++)
+    {
+      piecetable = i;
+      start = clock ();
+      if ((s = readin (fname)) != TRUE)
+	break;
+      tread = elapsed (start);
+      start = clock ();
+      if ((s = benchedit ()) != TRUE)
+	break;
+      tedit = elapsed (start);
+      start = clock ();
+      nfound = benchscan (pat[0] != 0 ? (const char *) pat : "the");
+      tscan = elapsed (start);
+      start = clock ();
+      if ((s = writeout (tname)) != TRUE)
+	break;
+      twrite = elapsed (start);
+      remove (tname);
+      snprintf (line, sizeof (line), "%-6s %8.3f%8.3f%8.3f%8.3f %8d %8d",
+		i ? "image" : "lines", tread, tedit, tscan, twrite,
+		blineno (bp, bp->b_linep) + 1, nfound);
+      addline (line);
+      bp->b_flag &= ~BFCHG;
+    }
+
+out:
+  enablesaveundo ();
+  piecetable = oldpiece;
+  bgread = oldbg;
+  journal = oldjou;
+  bp->b_flag &= ~BFCHG;
+  bclear (bp);
+  curbp = oldbp;
+  *curwp = oldwin;
+  curwp->w_flag |= WFMODE | WFHARD;
+  bfree (bp);
+  if (s != TRUE)
+    return (s);
+  return (popblist ());
+}
+
+/*
+ * Write about BENCHSIZE bytes of the kind of text
+ * described by "bc" to the file "fname".  The words are
+ * chosen by a simple random number generator with a fixed
+ * seed, so that every run searches the same text.
+ * Return FALSE if the file can't be written.
+ */
+static int
+benchgen (const char *fname, const BENCHCASE *bc)
+{
+  FILE *fp;
+  unsigned long seed;
+  long size, nword;
+  int len;
+
+  if ((fp = fopen (fname, "w")) == NULL)
+    {
+      eprintf ("Cannot create %s", fname);
+      return (FALSE);
+    }
+  seed = 1;
+  size = nword = 0;
+  len = 0;
+  while (size < BENCHSIZE)
+    {
+      if (len > 0)
+	{
+	  putc (' ', fp);
+	  ++len;
+	}
+      if (++nword % bc->every == 0)
+	len += fprintf (fp, "%s %ld", bc->mark, nword);
+      else
+	{
+	  seed = seed * 1103515245 + 12345;
+	  len += fprintf (fp, "%s", bc->words[(seed >> 16) % bc->nwords]);
+	}
+      if (len >= bc->linelen)
+	{
+	  putc ('\n', fp);
+	  size += len + 1;
+	  len = 0;
+	}
+    }
+  if (fclose (fp) != 0)
+    {
+      eprintf ("Error writing %s", fname);
+      return (FALSE);
+    }
+  return (TRUE);
+}
+
+/*
+ * Put the dot at the start of the current buffer if "dir" is
+ * a forward search, or at the end if it's a backward search.
+ */
+static void
+benchdot (int dir)
+{
+  if (dir == SRCH_FORW || dir == SRCH_REGFORW)
+    {
+      curwp->w_dot.p = firstline (curbp);
+      curwp->w_dot.o = 0;
+    }
+  else
+    {
+      curwp->w_dot.p = lback (curbp->b_linep);
+      curwp->w_dot.o = wllength (curwp->w_dot.p);
+    }
+}
+
+/*
+ * Search the whole current buffer in the direction "dir"
+ * for the current pattern, and return the number of matches.
+ */
+static int
+benchcount (int dir)
+{
+  int n;
+
+  benchdot (dir);
+  n = 0;
+  while (dosearch (dir) == TRUE)
+    ++n;
+  return (n);
+}
+
+/*
+ * Add a line of results to the list buffer, and
+ * write it to the results file "fp".
+ */
+static void
+benchresult (FILE *fp, const char *name, const char *op,
+	     int matches, double t)
+{
+  char line[128];
+
+  snprintf (line, sizeof (line), "%s\t%s\t%s\t%d\t%d\t%.4f",
+	    ENGINE, name, op, blineno (curbp, curbp->b_linep) + 1, matches, t);
+  addline (line);
+  fprintf (fp, "%s\n", line);
+}
+
+/*
+ * Run the search benchmarks on one kind of generated text.
+ * The text is written to the file "tname" and read into
+ * the current buffer.  Then the buffer is searched
+ * forwards and backwards for the literal pattern and
+ * the regular expression, and every match is replaced by
+ * each, reading the file again before each replacement.
+ * Return FALSE if something fails, or if a backward search
+ * doesn't find as many matches as the forward search.
+ */
+static int
+benchcase (FILE *fp, const char *tname, const BENCHCASE *bc)
+{
+  static const struct
+  {
+    const char *op;		/* Name in the results		*/
+    int dir;			/* Kind of search		*/
+    int replace;		/* TRUE if replacing		*/
+  } ops[] = {
+    {"forwsrch", SRCH_FORW, FALSE},
+    {"backsrch", SRCH_BACK, FALSE},
+    {"regforw", SRCH_REGFORW, FALSE},
+    {"regback", SRCH_REGBACK, FALSE},
+    {"replace", SRCH_FORW, TRUE},
+    {"regreplace", SRCH_REGFORW, TRUE}
+  };
+  clock_t start;
+  int i, s, n, literal;
+  int nforw = 0;
+  char repl[NPAT];
+
+  if ((s = benchgen (tname, bc)) != TRUE)
+    return (s);
+  start = clock ();
+  if ((s = readin (tname)) != TRUE)
+    goto out;
+  benchresult (fp, bc->name, "read", 0, elapsed (start));
+  for (i = 0; i < NELEM (ops); i++)
+    {
+      literal = ops[i].dir == SRCH_FORW || ops[i].dir == SRCH_BACK;
+      if ((s = setsearch (literal ? bc->mark : bc->regex,
+			  ops[i].dir)) != TRUE)
+	break;
+      if (!ops[i].replace)
+	{
+	  start = clock ();
+	  n = benchcount (ops[i].dir);
+	  benchresult (fp, bc->name, ops[i].op, n, elapsed (start));
+
+	  /* Each backward search follows the forward search
+	   * for the same pattern, and must find the same matches.
+	   */
+	  if (ops[i].dir == SRCH_FORW || ops[i].dir == SRCH_REGFORW)
+	    nforw = n;
+	  else if (n != nforw)
+	    {
+	      eprintf ("%s found %d matches in %s text, not %d",
+		       ops[i].op, n, bc->name, nforw);
+	      s = FALSE;
+	      break;
+	    }
+	  continue;
+	}
+
+      /* Count the matches first, then time the replacement
+       * of every one of them, and read the unchanged text
+       * back in for the next replacement.
+       */
+      n = benchcount (ops[i].dir);
+      strcpy (repl, literal ? bc->repl : bc->regrepl);
+      benchdot (ops[i].dir);
+      start = clock ();
+      if ((s = doreplace (FALSE, FALSE, ops[i].dir, repl)) != TRUE)
+	break;
+      benchresult (fp, bc->name, ops[i].op, n, elapsed (start));
+      curbp->b_flag &= ~BFCHG;
+      if ((s = readin (tname)) != TRUE)
+	break;
+    }
+
+out:
+  remove (tname);
+  return (s);
+}
+
+/*
+ * Prompt for the name of a results file, and time
+ * the search and replace functions on several kinds of
+ * generated text: plain ASCII, text with many UTF-8
+ * characters, very long lines, and many short lines.
+ * Each file is read into a temporary buffer through readlines,
+ * with a temporary file whose name is the results file name
+ * with ".data" appended.  Each result is a line with these
+ * fields, separated by tabs: the regular expression engine,
+ * the kind of text, the operation, the number of lines
+ * in the buffer, the number of matches, and the CPU time
+ * in seconds.  The results are written to the file and
+ * shown in a pop-up window.  The current buffer and window
+ * are not changed.
+ */
+int
+benchsearch (int f, int n, int k)
+{
+  BUFFER *bp, *oldbp;
+  EWINDOW oldwin;
+  FILE *fp;
+  int s, i, oldbg, oldjou, oldfold;
+  char fname[NFILEN];
+  char tname[NFILEN + 8];
+
+  if ((s = egetfname ("Results file: ", fname, NFILEN)) != TRUE)
+    return (s);
+  snprintf (tname, sizeof (tname), "%s.data", fname);
+  if (bfind ("*bench*", FALSE) != NULL)
+    {
+      eprintf ("Buffer *bench* already exists");
+      return (FALSE);
+    }
+  if ((fp = fopen (fname, "w")) == NULL)
+    {
+      eprintf ("Cannot create %s", fname);
+      return (FALSE);
+    }
+  if ((bp = bfind ("*bench*", TRUE)) == NULL)
+    {
+      fclose (fp);
+      return (FALSE);
+    }
+
+  /* Point the current window at the scratch buffer, as
+   * bench-backends does, and search with exact case.
+   */
+  oldbp = curbp;
+  oldwin = *curwp;
+  oldbg = bgread;
+  bgread = FALSE;
+  oldjou = journal;
+  journal = FALSE;
+  oldfold = casefold;
+  casefold = FALSE;
+  upmapinit ();
+  curbp = bp;
+  curwp->w_bufp = bp;
+  disablesaveundo ();
+
+  blistp->b_flag &= ~BFCHG;
+  if ((s = bclear (blistp)) != TRUE)
+    goto out;
+  strcpy (blistp->b_fname, "");
+  addline ("engine\tcase\top\tlines\tmatches\tseconds");
+  fprintf (fp, "engine\tcase\top\tlines\tmatches\tseconds\n");
+  for (i = 0; i < NELEM (benchcases); i++)
+    if ((s = benchcase (fp, tname, &benchcases[i])) != TRUE)
+      break;
+
+out:
+  if (fclose (fp) != 0 && s == TRUE)
+    {
+      eprintf ("Error writing %s", fname);
+      s = FALSE;
+    }
+  enablesaveundo ();
+  bgread = oldbg;
+  journal = oldjou;
+  casefold = oldfold;
+  upmapinit ();
+  bp->b_flag &= ~BFCHG;
+  bclear (bp);
+  curbp = oldbp;
+  *curwp = oldwin;
+  curwp->w_flag |= WFMODE | WFHARD;
+  bfree (bp);
+  if (s != TRUE)
+    return (s);
+  return (popblist ());
+}
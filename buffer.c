@@ -87,7 +87,6 @@ char oldbufn[NBUFN];		/* name of old buffer   */
 
 static int getbufn (char bufn[NBUFN]);
 static void intoa (char buf[], int width, long num);
-static int usebuf (BUFFER *bp);
 static int makelist (void);
 
 /*
@@ -158,7 +157,7 @@ prevbuffer (int f, int n, int k)
  * but expects a buffer pointer, instead of prompting the
  * user for a buffer name.
  */
-static int
+int
 usebuf (BUFFER *bp)
 {
   EWINDOW *wp;
@@ -215,8 +214,6 @@ int
 killbuffer (int f, int n, int k)
 {
   BUFFER *bp;
-  BUFFER *bp1;
-  BUFFER *bp2;
   int s;
   char bufn[NBUFN];
 
@@ -235,7 +232,26 @@ killbuffer (int f, int n, int k)
     }
   if ((s = bclear (bp)) != TRUE)	/* Blow text away.      */
     return (s);
-  free ((char *) bp->b_linep);	/* Release header line. */
+  bfree (bp);
+  return (TRUE);
+}
+
+/*
+ * Unlink the buffer "bp", which must not be
+ * on the screen, from the buffer list and
+ * release all of its memory.  Used by killbuffer,
+ * and by commands that use a scratch buffer.
+ */
+void
+bfree (BUFFER *bp)
+{
+  BUFFER *bp1;
+  BUFFER *bp2;
+
+  loadfree (bp);		/* Stop reading file	*/
+  joufree (bp);			/* Remove journal	*/
+  lfreeall (bp);		/* Release line storage */
+  lrelease (NULL, bp->b_linep);	/* Release header line. */
   bp1 = NULL;			/* Find buffer header.  */
   bp2 = bheadp;
   while (bp2 != bp)
@@ -253,7 +269,6 @@ killbuffer (int f, int n, int k)
   killundo (bp);		/* Free undo records	*/
   removemode (bp);		/* Free mode record	*/
   free ((char *) bp);		/* Release buffer block */
-  return (TRUE);
 }
 
 /*
@@ -412,7 +427,7 @@ addline (const char *text)
   int ntext;
 
   ntext = strlen (text);
-  if ((lp = lalloc (ntext)) == NULL)
+  if ((lp = lalloc (blistp, ntext)) == NULL)
     return (FALSE);
   lputs (lp, text, ntext);
   endp = lastline (blistp);
@@ -420,6 +435,7 @@ addline (const char *text)
   lp->l_bp = endp->l_bp;
   endp->l_bp = lp;
   lp->l_fp = endp;
+  lidxinsert (blistp, lp);
   if (blistp->b_dot.p == endp)	/* If "." is at the end */
     blistp->b_dot.p = lp;	/* move it to new line  */
   return (TRUE);
@@ -502,16 +518,14 @@ addemptyline (BUFFER *bp)
 {
   LINE *lp, *last;
 
-  if ((lp = lallocx (0)) == NULL)
-    {
-      free ((char *) bp);
-      return;
-    }
+  if ((lp = lallocx (bp, 0)) == NULL)
+    return;
   last = lastline(bp);
   lp->l_bp = last;
   lp->l_fp = last->l_fp;
   lp->l_fp->l_bp = lp;
   last->l_fp = lp;
+  lidxinsert (bp, lp);
 }
 
 /*
@@ -531,7 +545,7 @@ bcreate (const char *bname)
 
   if ((bp = (BUFFER *) malloc (sizeof (BUFFER))) == NULL)
     return (NULL);
-  if ((lp = lallocx (0)) == NULL)
+  if ((lp = lallocx (NULL, 0)) == NULL)
     {				/* header line          */
       free ((char *) bp);
       return (NULL);
@@ -541,6 +555,10 @@ bcreate (const char *bname)
   bp->b_flag = rflag ? BFRO : 0;
   bp->b_nwnd = 0;
   bp->b_linep = lp;
+  bp->b_arena = NULL;
+  bp->b_index = NULL;
+  bp->b_load = NULL;
+  bp->b_jou = NULL;
   lp->l_fp = lp->l_bp = lp;	/* Header line  */
   addemptyline (bp);
   bp->b_dot.p = lforw (lp);
@@ -566,7 +584,7 @@ bcreate (const char *bname)
 int
 bclear (BUFFER *bp)
 {
-  LINE *lp, *nextlp;
+  LINE *lp;
   EWINDOW *wp;
   int s;
 
@@ -574,13 +592,9 @@ bclear (BUFFER *bp)
       && (s = eyesno ("Discard changes")) != TRUE)
     return (s);
   bp->b_flag &= ~BFCHG;		/* Not changed          */
-  lp = firstline (bp);
-  while (lp != bp->b_linep)
-    {
-      nextlp = lforw (lp);
-      free ((char *) lp);
-      lp = nextlp;
-    }
+  loadfree (bp);		/* Stop reading file	*/
+  joufree (bp);			/* Remove journal	*/
+  lfreeall (bp);		/* Free all lines       */
   lp = bp->b_linep;		/* Header line          */
   lp->l_fp = lp->l_bp = lp;	/* Point it to itself   */
   addemptyline (bp);		/* Add an empty line	*/
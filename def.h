@@ -46,6 +46,7 @@ typedef unsigned char uchar;
 #define HUGE	1000		/* A rather large number.       */
 #define NSRCH	128		/* Undoable search commands.    */
 #define NXNAME	64		/* Length, extended command.    */
+#define NWALK	8		/* Threads, directory walk.     */
 
 /*
  * Universal.
@@ -275,6 +276,10 @@ typedef struct BUFFER
   char b_fname[NFILEN];		/* File name                    */
   char b_bname[NBUFN];		/* Buffer name                  */
   struct MODE *b_mode;		/* Emacs-like major mode	*/
+  struct ARENA *b_arena;	/* Storage for lines		*/
+  struct LINDEX *b_index;	/* Line number index, or NULL	*/
+  struct LOAD *b_load;		/* Background read, or NULL	*/
+  struct JOURNAL *b_jou;	/* Crash journal, or NULL	*/
 }
 BUFFER;
 
@@ -364,14 +369,33 @@ typedef struct LINE
   struct LINE *l_bp;		/* Link to the previous line    */
   int l_size;			/* Allocated size               */
   int l_used;			/* Used size                    */
-  uchar l_text[];		/* A bunch of characters.       */
+  int l_flag;			/* Flags, see below		*/
+  struct LBLOCK *l_blk;		/* Line number index block	*/
+  uchar *l_text;		/* A bunch of characters.       */
 }
 LINE;
 
+/* Bits in LINE.l_flag.
+ */
+#define	LFASCII	0x0001		/* Text is known to be pure ASCII */
+#define	LFSLAB	0x0002		/* Allocated from arena slab	*/
+#define	LFBUMP	0x0004		/* Allocated from arena bump chunk */
+#define	LFBIG	0x0008		/* Allocated separately by arena */
+#define	LFPIECE	0x0010		/* Text is in a file image	*/
+#define	LFOCCUR	0x0020		/* Line is in the occur list	*/
+#define	LFCACHE	0x0040		/* Line has offset checkpoints	*/
+
 /*
- * Size of the line header with the l_text.
+ * Size of the line header.  Normally the text
+ * follows the header directly, and l_text points
+ * to it.  In a line with the LFPIECE flag, l_text
+ * points into the image of the file that the line was
+ * read from.  The line is edited in place inside its part
+ * of the image (a private copy, so the file isn't changed)
+ * as long as the text fits in l_size bytes; otherwise it
+ * is copied to normal storage like any other line.
  */
-#define LINEHDR_SIZE (offsetof(LINE, l_text))
+#define LINEHDR_SIZE (sizeof (LINE))
 
 /*
  * The rationale behind these macros is that you
@@ -385,7 +409,7 @@ LINE;
 #define lback(lp)	((lp)->l_bp)
 #define lgetc(lp, n)	((lp)->l_text[(n)]&0xFF)
 #define lgets(lp)	((lp)->l_text)
-#define lputs(lp, s, n) memcpy((lp)->l_text,(s),(n))
+#define lputs(lp, s, n) (memcpy((lp)->l_text,(s),(n)), lscan(lp))
 #define llength(lp)	((lp)->l_used)
 #define lend(lp)	(&(lp)->l_text[(lp)->l_used])
 
@@ -396,11 +420,16 @@ LINE;
  *  - wllength:  get the number of Unicode characters in the line
  *  - wlgetcptr: get the address of nth UTF-8 character in the line
  *  - wloffset:  get byte offset of nth UTF-8 character in the line
+ *
+ * Lines that are known to be pure ASCII take a shortcut, because
+ * character indexes and byte offsets are then the same thing.
+ * Other lines go through loffset and lnchars, which use the
+ * offset checkpoints of long lines (LFCACHE).
  */
-#define wlgetc(lp, n)	 (ugetc((lp)->l_text,(n),NULL))
-#define wllength(lp)	 (unslen((lp)->l_text,(lp)->l_used))
-#define wlgetcptr(lp, n) (ugetcptr((lp)->l_text,(n)))
-#define wloffset(lp, n)  (uoffset((lp)->l_text,(n)))
+#define wlgetc(lp, n)	 (ugetc(wlgetcptr((lp),(n)),0,NULL))
+#define wllength(lp)	 ((lp)->l_flag & LFASCII ? (lp)->l_used : lnchars(lp))
+#define wlgetcptr(lp, n) ((const uchar *) &(lp)->l_text[wloffset((lp),(n))])
+#define wloffset(lp, n)  ((lp)->l_flag & LFASCII ? (n) : loffset((lp),(n)))
 
 /*
  * A video line structure always holds an array of characters representing
@@ -456,6 +485,7 @@ typedef struct FRAME
    * huge structures, and the video array is huge).
    */
   VIDEO *f_video;		/* Array of NROW VIDEOs.	*/
+  VIDEO *f_pvideo;		/* What the terminal shows.	*/
   wchar_t *f_vttext;		/* &(video[f_vtrow].v_text[0])	*/
 
   /* Use the extra field for implementation-specified data. */
@@ -497,6 +527,8 @@ extern int mouse_column;
 extern int tceeol;
 extern int tcinsl[];
 extern int tcdell[];
+extern long ttbytes;
+extern long ttwrites;
 extern char cinfo[];
 extern char upmap[];
 extern const char *keystrings[];
@@ -509,6 +541,10 @@ extern int casefold;
 extern int fillcol;
 extern int tabsize;
 extern int savetabs;
+extern int piecetable;
+extern int bgread;
+extern int atomicsave;
+extern int journal;
 #if USE_RUBY
 extern unsigned long *ruby_stack_ptr;
 #endif
@@ -571,6 +607,12 @@ int backchar (int f, int n, int k);	/* Move backward by characters  */
 int forwchar (int f, int n, int k);	/* Move forward by characters   */
 int gotoline (int f, int n, int k);	/* Go to a specified line.      */
 
+/*
+ * Defined by "bench.c".
+ */
+int benchbackends (int f, int n, int k);/* Time file read methods.	*/
+int benchsearch (int f, int n, int k);	/* Time search and replace.	*/
+
 /*
  * Defined by "buffer.c".
  */
@@ -580,12 +622,14 @@ int usebuffer (int f, int n, int k);	/* Switch a window to a buffer  */
 int nextbuffer (int f, int n, int k);	/* Switch to next buffer.       */
 int prevbuffer (int f, int n, int k);	/* Switch to previous buffer.   */
 int killbuffer (int f, int n, int k);	/* Make a buffer go away.       */
+int usebuf (BUFFER *bp);		/* Switch window to a buffer.	*/
 
 BUFFER * bfind (const char *bname, int cflag);
 					/* Search for buffer by name	*/
 BUFFER * bcreate (const char *bname);	/* Create buffer by name	*/
 int popblist (void);			/* Display special buffer.	*/
 int bclear (BUFFER *bp);		/* Blow away all text in buffer	*/
+void bfree (BUFFER *bp);		/* Free buffer and its text.	*/
 int anycb (void);			/* Look for changed buffers.	*/
 int addline (const char *text);		/* Append text to list buffer.	*/
 void addwind (EWINDOW *wp, int n);	/* Bump ref. count for window.	*/
@@ -627,6 +671,7 @@ int createframe (int f, int n, int k);	/* Create a new frame.		*/
 int nextframe (int f, int n, int k);	/* Move to next frame.		*/
 int prevframe (int f, int n, int k);	/* Move to previous frame.	*/
 int listframes (int f, int n, int k);	/* Pop up a list of frames.	*/
+int updatestats (int f, int n, int k);	/* Display update counts.	*/
 
 /*
  * Defined by "echo.c".
@@ -676,6 +721,9 @@ int filewrite (int f, int n, int k);	/* Write a file                 */
 int filesave (int f, int n, int k);	/* Save current file            */
 int filename (int f, int n, int k);	/* Adjust file name             */
 int setsavetabs (int f, int n, int k);	/* Set tab save flag            */
+int setpiecetable (int f, int n, int k);/* Set file image read flag	*/
+int setbgread (int f, int n, int k);	/* Set background read flag	*/
+int setatomicsave (int f, int n, int k);/* Set atomic save flag		*/
 
 void makename (char *bname, const char *fname);
 					/* Make buffer name from fname	*/
@@ -684,6 +732,14 @@ int visit_file (char *fname);
 int checkreadonly (void);		/* Is current buffer readonly?	*/
 int readlines (LINE *lp2, int *statptr);
 					/* Read lines from file.	*/
+int writeout (const char *fn);		/* Write buffer to file.	*/
+int loadstep (void);			/* Read more of big files.	*/
+int loadpending (void);			/* Any background reads?	*/
+int loadpercent (BUFFER *bp);		/* How much has been read.	*/
+int loadcancel (void);			/* Stop background reads.	*/
+void loadall (BUFFER *bp);		/* Finish background read.	*/
+void loadto (BUFFER *bp, int n);	/* Read up to line.		*/
+void loadfree (BUFFER *bp);		/* Forget background read.	*/
 void updatemode (void);			/* Update mode lines.		*/
 
 /*
@@ -693,12 +749,29 @@ int ffropen (const char *fn);		/* Open file for reading.	*/
 int ffwopen (const char *fn);		/* Open file for writing.	*/
 int ffgetline (char **bufp, int *nbytes);
 					/* Read a line from the file.	*/
+int ffgetimage (uchar **bufp, long *nbytes);
+					/* Read rest of file at once.	*/
+void fffreeimage (uchar *buf, long nbytes);
+					/* Free file image.		*/
+void ffdetach (void);			/* Detach images from files.	*/
+long ffgetsplit (long **endsp);		/* Get newlines of image.	*/
+void ffpreload (const char **names, int n);
+					/* Start preloading files.	*/
+void ffpreloaddone (void);		/* Stop preloading files.	*/
+int ffwalk (const char *dir,		/* Scan files in a tree.	*/
+	    int (*want) (const char *path, int isdir),
+	    int (*scan) (const char *path, const uchar *buf, long n, int w));
 int ffputline (const char *buf, int nbuf, int nl);
 					/* Write line to the file.	*/
 int ffclose (void);			/* Close a file.		*/
 int ffpopen (const char *fn);		/* Open profile			*/
 int ffpread (char *cp);			/* Read byte from profile	*/
 int ffpclose (void);			/* Close profile		*/
+int ffjopen (const char *fn, int append, int *fdp);
+					/* Open journal.		*/
+int ffjwrite (int fd, const char *buf, int n);
+					/* Write to journal.		*/
+int ffjclose (int fd);			/* Close journal.		*/
 void adjustcase (char *fn);		/* Adjust case of filename.	*/
 const char * fftilde (const char *arg);	/* Expand ~ in filename.	*/
 int fbackupfile (const char *fname);	/* Rename file to backup.	*/
@@ -708,6 +781,31 @@ char *ffsearch (const char *name,	/* Find matching filename.	*/
 int ffisdir (const char *name, int cpos); /* name[0..cpos-1] is dir?	*/
 const char * ffexedir (void);		/* Get dir of pe executable.	*/
 
+/*
+ * Defined by "grep.c".
+ */
+int projgrep (int f, int n, int k);	/* Grep files in project	*/
+int setgrepinclude (int f, int n, int k); /* Set files to grep		*/
+int setgrepexclude (int f, int n, int k); /* Set names to skip		*/
+int setgreplimit (int f, int n, int k);	/* Set maximum grep matches	*/
+int makegrepindex (int f, int n, int k); /* Build trigram index	*/
+
+/*
+ * Defined by "journal.c".
+ */
+int setjournal (int f, int n, int k);	/* Set crash journal flag	*/
+void jouread (BUFFER *bp);		/* Start journal, recover.	*/
+void jousaved (BUFFER *bp);		/* Restart journal after save.	*/
+void joufree (BUFFER *bp);		/* Remove journal.		*/
+void jouflush (void);			/* Write out all journals.	*/
+void jouexit (void);			/* Remove all journals.		*/
+void jouinsert (int n, int c, const char *s);
+					/* Journal linsert.		*/
+void jounewline (void);			/* Journal lnewline.		*/
+void joudelete (int n);			/* Journal ldelete.		*/
+void jouaddlines (LINE *lp, LINE *lp2);
+					/* Journal lines read in.	*/
+
 /*
  * Defined by "kbd.c".
  */
@@ -721,8 +819,22 @@ void ekeyname (char *cp, int k);		/* Convert key code to name	*/
 /*
  * Defined by "line.c".
  */
-LINE * lalloc (int used);		/* Allocate line.		*/
-LINE * lallocx (int used);		/* Allocate line w/o round-up.	*/
+LINE * lalloc (BUFFER *bp, int used);	/* Allocate line.		*/
+LINE * lallocx (BUFFER *bp, int used);	/* Allocate line w/o round-up.	*/
+void lrelease (BUFFER *bp, LINE *lp);	/* Free line and its cache.	*/
+LINE * lallocp (BUFFER *bp, uchar *text, int used);
+					/* Allocate line in file image.	*/
+int limage (BUFFER *bp, uchar *image, long size);
+					/* Attach file image to buffer.	*/
+void lfreeall (BUFFER *bp);		/* Free all lines in buffer.	*/
+int listarenas (int f, int n, int k);	/* Display line storage stats.	*/
+void lscan (LINE *lp);			/* Recompute LFASCII flag.	*/
+int loffset (LINE *lp, int n);		/* Byte offset of nth char.	*/
+int lnchars (LINE *lp);			/* # of UTF-8 chars in line.	*/
+int lcolumn (LINE *lp, int n);		/* Column of nth char.		*/
+int lwidth (LINE *lp, int n);		/* Screen column of nth char.	*/
+int lfindcol (LINE *lp, int col, int *off, int *colp);
+					/* Checkpoint before column.	*/
 int linsert (int n, int c, char *s);	/* Insert char(s) at dot	*/
 int insertwithnl (const char *s, int len);
 					/* Insert string with newlines.	*/
@@ -732,9 +844,38 @@ void lchange (int flag);		/* Change buffer flag.		*/
 int ldelete (int n, int kflag);		/* Delete n bytes at dot.	*/
 int lreplace (int plen, const char *st, int f);
 					/* Replace chars at dot		*/
+int lrepltext (uchar *buf, const char *st, LINE *lp, int o, int f);
+					/* Case-matched replacement	*/
 int kinsert (const char *s, int n);	/* Insert text in kill buffer	*/
 void kdelete (void);			/* Delete text in kill buffer	*/
 
+/*
+ * Defined by "lineno.c".
+ */
+int blineno (BUFFER *bp, const LINE *lp);/* Get zero-based line number.	*/
+int lineno (const LINE *lp);		/* Get zero-based line number	*/
+					/*  for current buffer.		*/
+LINE *blinep (BUFFER *bp, int n);	/* Get line from line number.	*/
+void lidxinsert (BUFFER *bp, LINE *lp);	/* Add line to index.		*/
+void lidxdelete (BUFFER *bp, LINE *lp);	/* Remove line from index.	*/
+void lidxreplace (BUFFER *bp, LINE *oldlp, LINE *newlp);
+					/* Replace line in index.	*/
+void lidxfree (BUFFER *bp);		/* Free line number index.	*/
+
+/*
+ * Defined by "literal.c".
+ */
+void litcomp (const uchar *pat);	/* Set up literal search.	*/
+int litforw (BUFFER *bp, POS *pos);	/* Literal search forward.	*/
+int litback (BUFFER *bp, POS *pos);	/* Literal search backward.	*/
+void litcompexact (const uchar *pat);	/* Set up exact byte search.	*/
+const uchar *litscan (const uchar *p,	/* Search bytes for pattern.	*/
+		      const uchar *end);
+int litat (BUFFER *bp, LINE *lp,	/* Literal match at offset?	*/
+	   int off);
+int litfind (BUFFER *bp, LINE *lp,	/* Literal search in a line.	*/
+	     int from);
+
 /*
  * Defined by "main.c".
  */
@@ -809,6 +950,16 @@ void clearmarks (MARKRING *ring);
 /*
  * Defined by "search.c".
  */
+#define SRCH_BEGIN	(0)	/* Search sub-codes.    */
+#define	SRCH_FORW	(-1)
+#define SRCH_BACK	(-2)
+#define SRCH_PREV	(-3)
+#define SRCH_NEXT	(-4)
+#define SRCH_NOPR	(-5)
+#define SRCH_ACCM	(-6)
+#define SRCH_REGFORW	(-7)
+#define SRCH_REGBACK	(-8)
+
 int forwsearch (int f, int n, int k);	/* Search forward               */
 int backsearch (int f, int n, int k);	/* Search backwards             */
 int forwregsearch (int f, int n, int k);/* Search forward reg. exp.     */
@@ -822,6 +973,15 @@ int regqueryrepl (int f, int n, int k);	/* Regexp query replace         */
 int regrepl (int f, int n, int k);	/* Regexp replace with no query */
 int searchparen (int f, int n, int k);	/* Search for matching paren    */
 int foldcase (int f, int n, int k);	/* Set casefold flag            */
+int occur (int f, int n, int k);	/* List lines that match	*/
+int occurgoto (int f, int n, int k);	/* Visit line in occur list	*/
+void occurmove (LINE *oldlp,		/* Line in occur list replaced.	*/
+		LINE *newlp);
+void occurclear (BUFFER *bp);		/* Buffer's lines being freed.	*/
+int setsearch (const char *s, int dir);	/* Set pattern without prompt	*/
+int dosearch (int dir);			/* Search for current pattern	*/
+int doreplace (int f, int query,	/* Replace current pattern	*/
+	       int dir, char *news);
 
 /*
  * Defined by "ruby.c".
@@ -915,6 +1075,21 @@ void getcursorword (char *buffer,	/* Get word under cursor.	*/
 int inwordpos (struct LINE *linep,	/* Word char at pos?		*/
 	       int doto, int alpha);
 
+/*
+ * Defined by "trigram.c".
+ */
+int tgload (void);			/* Read trigram index.		*/
+void tgfree (void);			/* Free trigram index.		*/
+int tgquery (const char *pat,		/* Find files that may match.	*/
+	     int literal);
+int tgskip (const char *path);		/* Can file be skipped?		*/
+int tgkeep (const char *path);		/* Is file unchanged?		*/
+int tgstart (void);			/* Start building index.	*/
+int tgscan (const char *path,		/* Find trigrams in file.	*/
+	    const uchar *buf, long n, int w);
+int tgsave (void);			/* Write trigram index.		*/
+int tgisindex (const char *name);	/* Is name the index file?	*/
+
 /*
  * Defined by "tty.c".
  */
@@ -930,7 +1105,7 @@ void ttinsl (int row, int bot, int nchunk);
 void ttdell (int row, int bot, int nchunk);
 void ttresize (void);
 void ttbeep (void);
-void ttputline (int row, int col, const wchar_t *buf);
+void ttputline (int row, int col, const wchar_t *buf, int n);
 
 /*
  * Defined by "ttyio.c".
@@ -942,6 +1117,7 @@ int ttshell (void);
 void ttgetsize (void);
 void ttclose (void);
 int ttstat (void);
+int ttwait (int ms);
 int ttputc (int c);
 int ttinsertc (int c);
 void ttdelc (void);
@@ -998,10 +1174,6 @@ void endsaveundo (void);		/* End of undo sequence.	*/
 void disablesaveundo (void);		/* Disable subsequent saveundos	*/
 void enablesaveundo (void);		/* Enable subsequent saveundos	*/
 void killundo (BUFFER *bp);		/* Kill undo records for buffer	*/
-int blineno (const BUFFER *bp, const LINE *lp);
-					/* Get zero-based line number.	*/
-int lineno (const LINE *lp);		/* Get zero-based line number	*/
-					/*  for current buffer.		*/
 void setundochanged (void);		/* Set buffer changed flags.	*/
 
 /*
@@ -1016,6 +1188,7 @@ int unslen (const uchar *s, int n);	/* # of UTF-8 chars in string s	*/
 					/*  of length n			*/
 int unblen (const uchar *s, int n);	/* # of bytes in next n UTF-8	*/
 					/*  chars in s			*/
+int uisascii (const uchar *s, int n);	/* s[0..n-1] is pure ASCII?	*/
 wchar_t ugetc (const uchar *s, int n, int *len);
 					/* Get nth UTF-8 character in s	*/
 					/*  as 32-bit Unicode		*/
@@ -1024,6 +1197,9 @@ wchar_t ugetprevc (const uchar *s, int *len);
 					/*  to s as 32-bit Unicode	*/
 int ucombining (wchar_t c);		/* c is a combining char?	*/
 int uputc (wchar_t c, unsigned char *s);/* Convert Unicode to UTF-8	*/
+int uputs (const wchar_t *s, int n, unsigned char *buf);
+					/* Convert n Unicode chars	*/
+					/*  to UTF-8			*/
 int uwidth (wchar_t c);			/* Display length of c		*/
 int unicode (int f, int n, int k);	/* Command to insert Unicode.	*/
 
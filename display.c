@@ -19,12 +19,40 @@
 
 #include	"def.h"
 
+#include	<sys/time.h>
+
 FRAME *fheadp;			/* Head of FRAME list.		*/
 FRAME *curfp;			/* Current FRAME pointer.	*/
 int leftcol = 0;		/* Left column of window        */
 
 static uchar spaces[NCOL];	/* ASCII spaces.		*/
 
+/*
+ * When updating a line, unchanged text shorter than this is
+ * rewritten rather than skipped with a cursor motion, which
+ * takes about this many bytes on an ANSI terminal.
+ */
+#define	MOVECOST	8
+
+/*
+ * Counts of the work done by update, for "display-update-stats".
+ * Bucket i of the latency histogram counts the updates that
+ * took less than 2**i microseconds, and more than the
+ * previous bucket; the last bucket counts all the slower ones.
+ */
+#define	NLATENCY	22
+
+static long nupdate;		/* Calls to update		*/
+static long nchanged;		/* Rows marked VFCHG		*/
+static long nwritten;		/* Rows written to terminal	*/
+static long nspans;		/* Spans written in those rows	*/
+static long nscroll;		/* Scrolls of the terminal	*/
+static long bytes0;		/* ttbytes at the last reset	*/
+static long writes0;		/* ttwrites at the last reset	*/
+static long totalus;		/* Total time in update		*/
+static long maxus;		/* Slowest update		*/
+static long latency[NLATENCY];	/* Histogram of update times	*/
+
 /*
  * These variables are set by ttykbd.c when a mouse button is pressed.
  */
@@ -36,7 +64,8 @@ int mouse_column;		/* screen column (0 = left)	*/
  * Forward declarations.
  */
 static void vtputs (const uchar *s, int n);
-static void uline (int row, VIDEO *vvp);
+static void uline (int row, VIDEO *vvp, VIDEO *pvp);
+static void uscroll (int top, int bot);
 static void modeline (EWINDOW *wp);
 
 /*
@@ -78,7 +107,8 @@ newframe (void)
 
   /* Allocate the VIDEO array. */
   fp->f_video = (VIDEO *) calloc (NROW, sizeof(VIDEO));
-  if (fp->f_video == NULL)
+  fp->f_pvideo = (VIDEO *) calloc (NROW, sizeof(VIDEO));
+  if (fp->f_video == NULL || fp->f_pvideo == NULL)
     abort ();
 
   /* Insert the new frame at the end of the list. */
@@ -290,6 +320,8 @@ vteeol (void)
 static void
 vtputline (LINE *lp, int row, int wleftcol, int linenumber)
 {
+  int off, col;
+
   curfp->f_video[row].v_color = CTEXT;
   curfp->f_video[row].v_flag |= VFCHG;
   leftcol = wleftcol;
@@ -298,7 +330,14 @@ vtputline (LINE *lp, int row, int wleftcol, int linenumber)
     {
       vtputlineno (row, linenumber);
       vtmove (row, curfp->f_tleftcol);
-      vtputs (lgets (lp), llength (lp));
+
+      /* If the window is scrolled right, skip the characters
+       * that are off the left edge, starting from the
+       * checkpoint nearest to it.
+       */
+      lfindcol (lp, wleftcol - curfp->f_tleftcol, &off, &col);
+      curfp->f_vtcol += col;
+      vtputs (lgets (lp) + off, llength (lp) - off);
     }
   vteeol ();
   leftcol = 0;
@@ -320,11 +359,12 @@ update (void)
   EWINDOW *wp;
   VIDEO *vp;
   int i;
-  int c;
   int curcol;
   int currow;
-  uchar *s, *end;
+  struct timeval start, stop;
+  long us;
 
+  gettimeofday (&start, NULL);
   if (curmsgf != FALSE || newmsgf != FALSE)
     {
       ALLWIND (wp)		/* For all windows.     */
@@ -335,23 +375,7 @@ update (void)
   /*
    * Find the column number of the cursor, taking tabs and UTF-8 into account.
    */
-  curcol = 0;
-  lp = curwp->w_dot.p;		/* The line containing the cursor. */
-  s = lgets (lp);
-  end = (uchar *) wlgetcptr (lp, curwp->w_dot.o);
-  while (s < end)
-    {
-      int ulen;
-
-      c = ugetc (s, 0, &ulen);
-      s += ulen;
-      if (c == '\t')
-	curcol += (tabsize - curcol % tabsize);
-      else if (c < 0x80 && CISCTRL (c) != FALSE)
-	curcol += 2;
-      else
-	curcol += uwidth(c);
-    }
+  curcol = lwidth (curwp->w_dot.p, curwp->w_dot.o);
 
   /* If the cursor column is outside what's currently visible on
    * the screen, adjust the current window's left column
@@ -507,6 +531,9 @@ update (void)
       lp = lforw (lp);
     }
 
+  for (i = 0; i < curfp->f_nrow - 1; ++i)
+    if ((curfp->f_video[i].v_flag & VFCHG) != 0)
+      ++nchanged;
   if (curfp->f_sgarbf != FALSE)
     {
       /* The "screen is garbage" flag is set, so write out every
@@ -518,19 +545,28 @@ update (void)
       ttmove (0, 0);
       tteeop ();
       for (i = 0; i < curfp->f_nrow - 1; ++i)
-	uline (i, &curfp->f_video[i]);
+	{
+	  vp = &curfp->f_pvideo[i];
+	  vp->v_color = CTEXT;
+	  wmemset (vp->v_text, ' ', NCOL);
+	  uline (i, &curfp->f_video[i], vp);
+	}
     }
 
   else
     {
-      /* The screen is not all garbage.  Write out only
+      /* The screen is not all garbage.  If the text
+       * in a window has moved up or down, scroll it on the
+       * physical screen first.  Then write out only
        * the changed lines to the physical screen.
        */
+      ALLWIND (wp)
+	uscroll (wp->w_toprow, wp->w_toprow + wp->w_ntrows - 1);
       for (i = 0; i < curfp->f_nrow - 1; ++i)
 	{
 	  vp = &curfp->f_video[i];
 	  if ((vp->v_flag & VFCHG) != 0)
-	    uline (i, vp);
+	    uline (i, vp, &curfp->f_pvideo[i]);
 	}
     }
 
@@ -539,22 +575,296 @@ update (void)
    */
   ttmove (currow, curcol + curfp->f_tleftcol);
   ttflush ();
+
+  gettimeofday (&stop, NULL);
+  us = (stop.tv_sec - start.tv_sec) * 1000000L + stop.tv_usec - start.tv_usec;
+  ++nupdate;
+  totalus += us;
+  if (us > maxus)
+    maxus = us;
+  for (i = 0; i < NLATENCY - 1 && us >= (1L << i); i++)
+    ;
+  ++latency[i];
+}
+
+/*
+ * Return the number of screen columns taken by the n
+ * characters at s, as the terminal code displays them: a combining
+ * character is put in the same column as the one after it.
+ * Return -1 if the width of some character isn't known.
+ */
+static int
+vtwidth (const wchar_t *s, int n)
+{
+  int i, w, width;
+
+  width = 0;
+  for (i = 0; i < n; i++)
+    {
+      if (s[i] < 0x80)
+	++width;
+      else if (!ucombining (s[i]))
+	{
+	  if ((w = uwidth (s[i])) < 0)
+	    return (-1);
+	  width += w;
+	}
+    }
+  return (width);
 }
 
 /*
  * Update a single line on the physical screen. This routine only
  * uses basic functionality (no insert and delete character,
  * but erase to end of line). The "vvp" points at the VIDEO
- * structure for the line on the virtual screen.  Avoid erase to end of
+ * structure for the line on the virtual screen, and "pvp"
+ * points at the copy of what the physical screen shows now.
+ * Only the spans of characters that differ are written,
+ * and the copy is updated to match.  Avoid erase to end of
  * line when updating CMODE color lines, because of the way that
  * reverse video works on most terminals.
  */
 static void
-uline (int row, VIDEO *vvp)
+uline (int row, VIDEO *vvp, VIDEO *pvp)
 {
+  const wchar_t *new, *old;
+  int i, j, start, end, col, ncol, w;
+  long nspans0 = nspans;
+
   vvp->v_flag &= ~VFCHG;	/* Changes done.        */
   ttcolor (vvp->v_color);
-  ttputline (row, 0, (const wchar_t *) &vvp->v_text[0]);
+  new = vvp->v_text;
+  old = pvp->v_text;
+  ncol = curfp->f_ncol;
+  if (vvp->v_color != pvp->v_color)
+    goto whole;
+
+  /* Find the blank part at the end of the new line,
+   * which can be cleared with an erase to end of line.
+   */
+  end = ncol;
+  if (vvp->v_color == CTEXT)
+    {
+      while (end > 0 && new[end - 1] == ' ')
+	--end;
+      if (end > 0 && end < ncol && ucombining (new[end - 1]))
+	++end;
+    }
+
+  col = 0;
+  i = 0;
+  for (;;)
+    {
+      /* Skip the unchanged characters, keeping track of the
+       * screen column.  The terminal code displays a combining
+       * character with the character after it, so a changed
+       * span must include any combining characters before it.
+       */
+      for (start = i; i < ncol && new[i] == old[i]; i++)
+	;
+      if (i == ncol)
+	break;
+      while (i > start && (ucombining (new[i - 1]) || ucombining (old[i - 1])))
+	--i;
+      if ((w = vtwidth (new + start, i - start)) < 0)
+	goto whole;
+      if ((col += w) >= ncol)
+	break;			/* Pushed off by wide chars */
+      if (i >= end)
+	{
+	  ttmove (row, col);
+	  tteeol ();
+	  ++nspans;
+	  break;
+	}
+
+      /* Find the end of the span, merging spans that are
+       * separated by only a few unchanged characters.  If the
+       * new text doesn't take the same width as the old, the
+       * rest of the line moves, so write all of it.
+       */
+      start = i;
+      for (j = ++i; j < ncol && j - i < MOVECOST; j++)
+	if (new[j] != old[j])
+	  i = j + 1;
+      while (i < ncol && (ucombining (new[i - 1]) || ucombining (old[i - 1])))
+	++i;
+      if ((w = vtwidth (new + start, i - start)) < 0)
+	goto whole;
+      if (w != vtwidth (old + start, i - start))
+	i = ncol;
+      if (i > end)
+	{
+	  if ((w = vtwidth (new + start, end - start)) < 0)
+	    goto whole;
+	  if (end > start)
+	    ttputline (row, col, new + start, end - start);
+	  if (col + w < ncol)
+	    {
+	      ttmove (row, col + w);
+	      tteeol ();
+	    }
+	  ++nspans;
+	  break;
+	}
+      ttputline (row, col, new + start, i - start);
+      col += w;
+      ++nspans;
+    }
+  wmemcpy (pvp->v_text, new, ncol);
+  if (nspans != nspans0)
+    ++nwritten;
+  return;
+
+whole:
+  ttputline (row, 0, new, ncol);
+  ++nspans;
+  ++nwritten;
+  pvp->v_color = vvp->v_color;
+  wmemcpy (pvp->v_text, new, ncol);
+}
+
+/*
+ * Return a hash of the text and color of the screen row "vp".
+ */
+static unsigned int
+vthash (const VIDEO *vp)
+{
+  unsigned int h;
+  int i;
+
+  h = 2166136261u ^ vp->v_color;
+  for (i = 0; i < curfp->f_ncol; i++)
+    h = (h ^ vp->v_text[i]) * 16777619u;
+  return (h);
+}
+
+/*
+ * Return roughly the number of bytes that uline
+ * would send to change the physical row "pvp" into
+ * the virtual row "vvp": the changed characters, and
+ * a cursor motion for each span of them.
+ */
+static int
+vtcost (const VIDEO *vvp, const VIDEO *pvp)
+{
+  int i, n, same;
+
+  if (vvp->v_color != pvp->v_color)
+    return (MOVECOST + curfp->f_ncol);
+  n = 0;
+  same = TRUE;
+  for (i = 0; i < curfp->f_ncol; i++)
+    if (vvp->v_text[i] != pvp->v_text[i])
+      {
+	n += same ? MOVECOST + 1 : 1;
+	same = FALSE;
+      }
+    else
+      same = TRUE;
+  return (n);
+}
+
+/*
+ * Check whether the text in rows "top" through "bot" of the
+ * virtual screen, which is a window, is the text on the physical
+ * screen moved up or down, as it is after C-N at the bottom of the
+ * window or a page scroll.  Find the distance that lets the
+ * most rows match, comparing hashes of the rows.  If deleting or
+ * inserting that many lines in a scrolling region, and then
+ * changing the rows that still don't match, costs less than
+ * repainting the changed rows, scroll the physical screen, and
+ * move the rows of the copy of it to match.  Blank rows don't
+ * count as matches, because they are cheap to repaint anyway.
+ */
+static void
+uscroll (int top, int bot)
+{
+  static unsigned int vh[NROW];	/* Hashes of virtual rows	*/
+  static unsigned int ph[NROW];	/* Hashes of physical rows	*/
+  static VIDEO blank;		/* A blank row			*/
+  VIDEO *vp, *pp;
+  unsigned int hblank;
+  int i, k, n, nchg, match, best, bestk, cost, kcost;
+
+  n = bot - top + 1;
+  if (n < 3)
+    return;
+  vp = &curfp->f_video[top];
+  pp = &curfp->f_pvideo[top];
+  nchg = 0;
+  for (i = 0; i < n; i++)
+    if ((vp[i].v_flag & VFCHG) != 0)
+      ++nchg;
+  if (nchg < 2)
+    return;
+
+  blank.v_color = CTEXT;
+  wmemset (blank.v_text, ' ', NCOL);
+  hblank = vthash (&blank);
+  for (i = 0; i < n; i++)
+    {
+      vh[i] = vthash (&vp[i]);
+      ph[i] = vthash (&pp[i]);
+    }
+
+  /* Find the distance k such that virtual row i
+   * matches physical row i + k for the most rows.
+   */
+  best = bestk = 0;
+  for (k = 1 - n; k < n; k++)
+    {
+      if (k == 0)
+	continue;
+      match = 0;
+      for (i = k < 0 ? -k : 0; i < n && i + k < n; i++)
+	if (vh[i] == ph[i + k] && vh[i] != hblank)
+	  ++match;
+      if (match > best)
+	{
+	  best = match;
+	  bestk = k;
+	}
+    }
+  if (best == 0)
+    return;
+
+  /* Compare the costs of repainting in place and of scrolling.
+   */
+  cost = 0;
+  for (i = 0; i < n; i++)
+    if (vh[i] != ph[i])
+      cost += vtcost (&vp[i], &pp[i]);
+  kcost = bestk > 0 ? tcdell[bestk] : tcinsl[-bestk];
+  for (i = 0; i < n && kcost < cost; i++)
+    {
+      k = i + bestk;
+      if (k < 0 || k >= n)
+	kcost += vtcost (&vp[i], &blank);
+      else if (vh[i] != ph[k])
+	kcost += vtcost (&vp[i], &pp[k]);
+    }
+  if (kcost >= cost)
+    return;
+
+  ttcolor (CTEXT);
+  ++nscroll;
+  if (bestk > 0)
+    {
+      ttdell (top, bot, bestk);
+      memmove (&pp[0], &pp[bestk], (n - bestk) * sizeof (VIDEO));
+      for (i = n - bestk; i < n; i++)
+	pp[i] = blank;
+    }
+  else
+    {
+      ttinsl (top, bot, -bestk);
+      memmove (&pp[-bestk], &pp[0], (n + bestk) * sizeof (VIDEO));
+      for (i = 0; i < -bestk; i++)
+	pp[i] = blank;
+    }
+  for (i = 0; i < n; i++)
+    vp[i].v_flag |= VFCHG;
 }
 
 /*
@@ -602,6 +912,13 @@ modeline (EWINDOW *wp)
       vtstring ("File:");
       vtstring (bp->b_fname);
     }
+  if ((n = loadpercent (bp)) >= 0)
+    {				/* Background read.	*/
+      char buf[16];
+
+      snprintf (buf, sizeof (buf), " [%d%%]", n);
+      vtstring (buf);
+    }
   if (curmsgf != FALSE		/* Message alert.       */
       && wp->w_wndp == NULL)
     {
@@ -732,3 +1049,87 @@ listframes (int f, int n, int k)
     }
   return (popblist ());
 }
+
+/*
+ * Format a time of us microseconds in buf,
+ * in units that keep it short.
+ */
+static void
+ussize (char *buf, long us)
+{
+  if (us < 10 * 1000)
+    sprintf (buf, "%ldus", us);
+  else if (us < 10 * 1000 * 1000)
+    sprintf (buf, "%ldms", us / 1000);
+  else
+    sprintf (buf, "%lds", us / (1000 * 1000));
+}
+
+/*
+ * Pop up a window showing the work done by update since
+ * the editor started, or since the counts were reset: the
+ * number of updates, the screen rows marked as changed, the
+ * rows and spans of rows written to the terminal, the scrolls,
+ * the bytes and writes sent to the terminal, and a histogram
+ * of the time taken by each update.  With an argument,
+ * reset the counts instead.
+ */
+int
+updatestats (int f, int n, int k)
+{
+  int s, i;
+  char lo[16], hi[16], total[16], mean[16], max[16];
+  char line[128];
+
+  if (f != FALSE)
+    {
+      nupdate = nchanged = nwritten = nspans = nscroll = 0;
+      totalus = maxus = 0;
+      memset (latency, 0, sizeof (latency));
+      bytes0 = ttbytes;
+      writes0 = ttwrites;
+      eprintf ("[Update counts reset]");
+      return (TRUE);
+    }
+  blistp->b_flag &= ~BFCHG;	/* Blow away old.       */
+  if ((s = bclear (blistp)) != TRUE)
+    return (s);
+  strcpy (blistp->b_fname, "");
+  ussize (total, totalus);
+  ussize (mean, nupdate == 0 ? 0 : totalus / nupdate);
+  ussize (max, maxus);
+  snprintf (line, sizeof (line),
+	    "Updates %ld, time %s, mean %s, max %s",
+	    nupdate, total, mean, max);
+  if (addline (line) == FALSE)
+    return FALSE;
+  snprintf (line, sizeof (line),
+	    "Rows changed %ld, written %ld, spans %ld, scrolls %ld",
+	    nchanged, nwritten, nspans, nscroll);
+  if (addline (line) == FALSE)
+    return FALSE;
+  snprintf (line, sizeof (line), "Bytes %ld, writes %ld",
+	    ttbytes - bytes0, ttwrites - writes0);
+  if (addline (line) == FALSE)
+    return FALSE;
+  if (addline ("") == FALSE)
+    return FALSE;
+  if (addline ("           Time   Updates") == FALSE)
+    return FALSE;
+  if (addline ("           ----   -------") == FALSE)
+    return FALSE;
+  for (i = 0; i < NLATENCY; i++)
+    {
+      if (latency[i] == 0)
+	continue;
+      ussize (lo, i == 0 ? 0 : 1L << (i - 1));
+      ussize (hi, 1L << i);
+      if (i == NLATENCY - 1)
+	snprintf (line, sizeof (line), "%6s -        %9ld", lo, latency[i]);
+      else
+	snprintf (line, sizeof (line), "%6s - %-6s %9ld", lo, hi, latency[i]);
+      if (addline (line) == FALSE)
+	return FALSE;
+    }
+  return (popblist ());
+}
@@ -76,7 +76,38 @@
  */
 #include	"def.h"
 
+#include	<limits.h>
+#include	<sys/time.h>
+
 int savetabs = 1;		/* TRUE if tabs are preserved when saving files */
+int piecetable = 1;		/* TRUE if files are read as file images	*/
+int bgread = 1;			/* TRUE if big files are read in background	*/
+int atomicsave = 0;		/* TRUE if files are saved by renaming		*/
+
+/*
+ * The state of a file image whose lines are being split
+ * and inserted into a buffer.  Big files are read in
+ * batches of LOADBATCH lines while the editor is idle.
+ */
+typedef struct LOAD
+{
+  uchar *d_image;		/* Start of file image		*/
+  uchar *d_next;		/* Start of next line		*/
+  uchar *d_end;			/* End of file image		*/
+  LINE *d_lp2;			/* Insert lines before this one	*/
+  int d_nline;			/* Number of lines read so far	*/
+  int d_hadnl;			/* Last line had a newline?	*/
+  long *d_ends;			/* Offsets of newlines, or NULL	*/
+  long d_nends;			/* Number of newline offsets	*/
+  long d_iend;			/* Next newline offset		*/
+}
+LOAD;
+
+#define	LOADMIN		(4L * 1024 * 1024) /* Smaller files are read at once */
+#define	LOADBATCH	20000		/* Lines read per batch		*/
+
+static void loaddone (BUFFER *bp, int s);
+static int readback (BUFFER *bp, LINE *lp2, int *statptr);
 
 /*
  * Read a file into the current
@@ -113,6 +144,8 @@ insertf (const char *fname)
 
   bp = curbp;			/* Make local copy      */
   wp = curwp;			/* Make local copy      */
+  if (checkreadonly () == FALSE)
+    return (FALSE);
   if ((s = ffropen (fname)) != FIOSUC)
     {				/* Hard file open.      */
       if (kbdmop == NULL)
@@ -131,6 +164,7 @@ insertf (const char *fname)
   lp2 = wp->w_dot.p;		/* Insert lines between */
   lp1 = lback (lp2);		/*  lp1 and lp2         */
   hadnl = readlines (lp2, &s);	/* Read the lines       */
+  jouaddlines (lforw (lp1), lp2);
 
   wp->w_dot.p = lp2;		/* Move dot after lines */
   wp->w_dot.o = 0;		/*  just inserted       */
@@ -326,6 +360,11 @@ togglereadonly (int f, int n, int k)
 int
 checkreadonly (void)
 {
+  if (curbp->b_load != NULL)
+    {
+      eprintf ("Buffer is still being read");
+      return FALSE;
+    }
   if ((curbp->b_flag & BFRO) != 0)
     {
       eprintf ("Buffer is read-only");
@@ -375,13 +414,14 @@ readin (const char *fname)
 	eprintf ("[New file]");
       goto out;
     }
-  if (!readlines (lp2, &s))
+  if (!(bgread ? readback (bp, lp2, &s) : readlines (lp2, &s)))
     {				/* Last line didn't have \n?    */
       lp1 = lastline(bp);	/* Delete empty last line	*/
       lp2 = lback(lp1);
+      lidxdelete (bp, lp1);
       lp2->l_fp = lp1->l_fp;
       lp1->l_fp->l_bp = lp2;
-      free (lp1);
+      lrelease (bp, lp1);
     }
 #if	BACKUP
   bp->b_flag |= BFBAK;		/* Need a backup.       */
@@ -405,6 +445,12 @@ out:
    */
   bp->b_dot.p = lp1;
 
+  /* Start the crash journal, and recover any changes
+   * left in an old one.
+   */
+  if (s != FIOERR)
+    jouread (bp);
+
   /* Set up the mode for this file.
    */
 #if USE_RUBY
@@ -423,6 +469,366 @@ out:
   return (s != FIOERR);		/* False if error.      */
 }
 
+/*
+ * Split the lines in a file image, and insert them into buffer "bp"
+ * before the line dp->d_lp2.  Stop after "max" lines.  The lines aren't
+ * copied; they point at their text in the image, which is kept until
+ * the buffer is freed.  This is the piece table method of reading files.
+ * Return FIOSUC if there are more lines to read, FIOEOF at the end
+ * of the image, or FIOERR if there isn't enough memory.
+ */
+static int
+loadlines (BUFFER *bp, LOAD *dp, int max)
+{
+  LINE *lp1, *lp2;
+  uchar *p, *nl, *end;
+  int nbytes;
+
+  lp2 = dp->d_lp2;
+  end = dp->d_end;
+  for (p = dp->d_next; p < end && max > 0; --max)
+    {
+      if (dp->d_ends == NULL)
+	nl = (uchar *) memchr (p, '\n', end - p);
+      else if (dp->d_iend < dp->d_nends)
+	nl = dp->d_image + dp->d_ends[dp->d_iend++];
+      else
+	nl = NULL;
+      if (nl == NULL)
+	{			/* Last line has no \n	*/
+	  nbytes = end - p;
+	  dp->d_hadnl = FALSE;
+	}
+      else
+	{			/* Delete CR before LF	*/
+	  nbytes = nl - p;
+	  if (nbytes > 0 && nl[-1] == '\r')
+	    --nbytes;
+	}
+      if ((lp1 = lallocp (bp, p, nbytes)) == NULL)
+	{
+	  dp->d_next = p;
+	  return (FIOERR);
+	}
+      lp1->l_bp = lp2->l_bp;	/* Insert lp1           */
+      lp1->l_fp = lp2;		/*  before lp2          */
+      lp2->l_bp->l_fp = lp1;
+      lp2->l_bp = lp1;
+      lidxinsert (bp, lp1);
+      ++dp->d_nline;
+      p = nl == NULL ? end : nl + 1;
+    }
+  dp->d_next = p;
+  return (p < end ? FIOSUC : FIOEOF);
+}
+
+/*
+ * Set up "dp" to read the lines in the file image "image" of
+ * "size" bytes, obtained from ffgetimage, into buffer "bp" before
+ * line "lp2".  The image is given to the buffer's line arena.
+ * If the file was preloaded, use the newlines that were found
+ * then instead of looking for them again.
+ * Return FALSE if there isn't enough memory; the image is freed.
+ */
+static int
+loadinit (BUFFER *bp, LOAD *dp, LINE *lp2, uchar *image, long size)
+{
+  if (limage (bp, image, size) == FALSE)
+    {
+      fffreeimage (image, size);
+      return (FALSE);
+    }
+  dp->d_image = image;
+  dp->d_next = image;
+  dp->d_end = image + size;
+  dp->d_lp2 = lp2;
+  dp->d_nline = 0;
+  dp->d_hadnl = TRUE;
+  if ((dp->d_nends = ffgetsplit (&dp->d_ends)) < 0)
+    dp->d_ends = NULL;
+  dp->d_iend = 0;
+  return (TRUE);
+}
+
+/*
+ * Print the number of lines read, unless an error
+ * message is on the echo line.
+ */
+static void
+readcount (int s, int nline)
+{
+  if (s == FIOEOF && kbdmop == NULL)
+    {				/* Don't zap an error.  */
+      if (nline == 1)
+	eprintf ("[Read 1 line]");
+      else
+	eprintf ("[Read %d lines]", nline);
+    }
+}
+
+/*
+ * Insert the lines in the file image "image" of "size" bytes,
+ * obtained from ffgetimage, before lp2.  This is used by readlines,
+ * and the return value and *statptr are the same.
+ */
+static int
+readimage (
+     LINE *lp2,		/* insert lines before this one */
+     uchar *image,	/* file image			*/
+     long size,		/* size of image		*/
+     int *statptr)	/* return status                */
+{
+  LOAD load;
+  int s;
+
+  load.d_nline = 0;
+  if (loadinit (curbp, &load, lp2, image, size) == FALSE)
+    s = FIOERR;
+  else
+    {
+      while ((s = loadlines (curbp, &load, INT_MAX)) == FIOSUC)
+	;
+      free ((char *) load.d_ends);
+    }
+  ffclose ();			/* Ignore errors.       */
+  readcount (s, load.d_nline);
+  *statptr = s;			/* Return file I/O stat */
+  return (s == FIOERR || load.d_hadnl);
+}
+
+/*
+ * Start reading the open file in the background into buffer "bp",
+ * before line "lp2".  Only the first batch of lines is read here,
+ * enough to fill the screen; loadstep reads the rest while
+ * the editor is waiting for keys.  Small files, and files that
+ * can't be read as images, are read right away by readlines.
+ * The return value and *statptr are the same as for readlines.
+ */
+static int
+readback (BUFFER *bp, LINE *lp2, int *statptr)
+{
+  LOAD *dp;
+  uchar *image;
+  long size;
+  int s;
+
+  if (!piecetable || ffgetimage (&image, &size) != FIOSUC)
+    return (readlines (lp2, statptr));
+  if (size < LOADMIN)
+    return (readimage (lp2, image, size, statptr));
+  if ((dp = (LOAD *) malloc (sizeof (LOAD))) == NULL)
+    {
+      fffreeimage (image, size);
+      return (readlines (lp2, statptr));
+    }
+  if (loadinit (bp, dp, lp2, image, size) == FALSE)
+    {
+      free (dp);
+      ffclose ();
+      *statptr = FIOERR;
+      return (TRUE);
+    }
+  ffclose ();			/* Ignore errors.	*/
+  bp->b_load = dp;
+  if ((s = loadlines (bp, dp, LOADBATCH)) != FIOSUC)
+    {				/* Done already?	*/
+      loaddone (bp, s);
+      *statptr = s;
+      return (TRUE);
+    }
+  *statptr = FIOSUC;
+  return (TRUE);
+}
+
+/*
+ * Finish reading a file in the background into buffer "bp",
+ * with status "s".  Delete the empty line at the end of the buffer
+ * if the last line didn't end with a newline, just as readin does,
+ * and free the load state.
+ */
+static void
+loaddone (BUFFER *bp, int s)
+{
+  LOAD *dp = bp->b_load;
+  LINE *lp1, *lp2;
+  EWINDOW *wp;
+
+  if (s == FIOEOF && !dp->d_hadnl)
+    {				/* Delete empty last line	*/
+      lp1 = dp->d_lp2;
+      lp2 = lback (lp1);
+      ALLWIND (wp)
+      {
+	if (wp->w_bufp != bp)
+	  continue;
+	if (wp->w_linep == lp1)
+	  wp->w_linep = lp2;
+	if (wp->w_dot.p == lp1)
+	  {
+	    wp->w_dot.p = lp2;
+	    wp->w_dot.o = 0;
+	  }
+      }
+      if (bp->b_dot.p == lp1)
+	bp->b_dot.p = lp2;
+      lidxdelete (bp, lp1);
+      lp2->l_fp = lp1->l_fp;
+      lp1->l_fp->l_bp = lp2;
+      lrelease (bp, lp1);
+    }
+  readcount (s, dp->d_nline);
+  loadfree (bp);
+}
+
+/*
+ * Free the state of a file being read into
+ * buffer "bp" in the background, if any.  The lines
+ * read so far, and the file image, stay in the buffer.
+ */
+void
+loadfree (BUFFER *bp)
+{
+  EWINDOW *wp;
+
+  if (bp->b_load == NULL)
+    return;
+  free ((char *) bp->b_load->d_ends);
+  free ((char *) bp->b_load);
+  bp->b_load = NULL;
+  ALLWIND (wp)
+  {
+    if (wp->w_bufp == bp)
+      wp->w_flag |= WFMODE;
+  }
+}
+
+/*
+ * Read the next batch of lines of the first buffer
+ * that is being read in the background.  This is called by
+ * the main loop while there are no keys waiting.
+ * Return TRUE if there is still more to read.
+ */
+int
+loadstep (void)
+{
+  BUFFER *bp;
+  EWINDOW *wp;
+  int s;
+
+  ALLBUF (bp)
+  {
+    if (bp->b_load == NULL)
+      continue;
+    if ((s = loadlines (bp, bp->b_load, LOADBATCH)) != FIOSUC)
+      loaddone (bp, s);
+    ALLWIND (wp)
+    {
+      if (wp->w_bufp == bp)
+	wp->w_flag |= WFMODE | WFHARD;
+    }
+    break;
+  }
+  return (loadpending ());
+}
+
+/*
+ * Return TRUE if any buffer is being read in the background.
+ */
+int
+loadpending (void)
+{
+  BUFFER *bp;
+
+  ALLBUF (bp)
+  {
+    if (bp->b_load != NULL)
+      return (TRUE);
+  }
+  return (FALSE);
+}
+
+/*
+ * Return the percentage of the file that has been read
+ * into buffer "bp", or -1 if it isn't being read in the background.
+ */
+int
+loadpercent (BUFFER *bp)
+{
+  LOAD *dp;
+
+  if ((dp = bp->b_load) == NULL)
+    return (-1);
+  return ((int) ((double) (dp->d_next - dp->d_image) * 100
+		 / (dp->d_end - dp->d_image)));
+}
+
+/*
+ * Stop reading files in the background.  The lines read
+ * so far are kept, but the buffers are made read-only, so that
+ * they can't be saved by mistake over the complete files.
+ * Return TRUE if any files were being read.
+ */
+int
+loadcancel (void)
+{
+  BUFFER *bp;
+  int n;
+
+  n = 0;
+  ALLBUF (bp)
+  {
+    if (bp->b_load == NULL)
+      continue;
+    n += bp->b_load->d_nline;
+    bp->b_flag |= BFRO;
+    loadfree (bp);
+  }
+  if (n == 0)
+    return (FALSE);
+  eprintf ("[Reading stopped after %d lines; buffer is read-only]", n);
+  return (TRUE);
+}
+
+/*
+ * Finish reading the file in buffer "bp", if it is being
+ * read in the background.  Used before writing the buffer.
+ */
+void
+loadall (BUFFER *bp)
+{
+  int s;
+
+  if (bp->b_load == NULL)
+    return;
+  while ((s = loadlines (bp, bp->b_load, INT_MAX)) == FIOSUC)
+    ;
+  loaddone (bp, s);
+}
+
+/*
+ * Read lines into buffer "bp", if it is being read in the
+ * background, until it has a line "n" (zero-based) or the
+ * whole file has been read.  Used before moving to a line
+ * that may not have been read yet.
+ */
+void
+loadto (BUFFER *bp, int n)
+{
+  EWINDOW *wp;
+  int s;
+
+  if (bp->b_load == NULL)
+    return;
+  while (bp->b_load != NULL && blinep (bp, n) == bp->b_linep)
+    if ((s = loadlines (bp, bp->b_load, LOADBATCH)) != FIOSUC)
+      loaddone (bp, s);
+  ALLWIND (wp)
+  {
+    if (wp->w_bufp == bp)
+      wp->w_flag |= WFMODE | WFHARD;
+  }
+}
+
 /*
  * Read lines from the open file, inserting them before lp2.  Return
  * TRUE if the last line read was terminated by a newline; return FALSE
@@ -439,15 +845,19 @@ readlines (
   int nline;
   int nbytes;
   char *line;
+  uchar *image;
+  long size;
 
-  nline = 0;
   eprintf ("[Reading...]");
+  if (piecetable && ffgetimage (&image, &size) == FIOSUC)
+    return (readimage (lp2, image, size, statptr));
+  nline = 0;
   do
     {
       s = ffgetline (&line, &nbytes);	/* read next line       */
       if (s != FIOSUC && nbytes == 0)	/* True end-of-file?    */
 	break;
-      if ((lp1 = lallocx (nbytes)) == NULL)
+      if ((lp1 = lallocx (curbp, nbytes)) == NULL)
 	{
 	  s = FIOERR;		/* Keep message on the  */
 	  break;		/* display.             */
@@ -456,6 +866,7 @@ readlines (
       lp1->l_fp = lp2;		/*  before lp2          */
       lp2->l_bp->l_fp = lp1;
       lp2->l_bp = lp1;
+      lidxinsert (curbp, lp1);
       lputs (lp1, line, nbytes);
       ++nline;
     }
@@ -530,7 +941,9 @@ updatemode (void)
  * This function expands tabs in a line of text, storing the resulting
  * text in a dynamically allocated buffer.  The address of the buffer
  * is returned.  The buffer is overwritten on each call to this function.
- * The expanded length is returned to the caller in *len.
+ * The expanded length is returned to the caller in *len.  The line
+ * is expanded in one pass; the buffer is only grown (by doubling)
+ * when a tab needs more room than is left.
  */
 static char *
 expand (const char *text, int *len)
@@ -543,19 +956,14 @@ expand (const char *text, int *len)
   int col;			/* Current column       */
   int ncols;			/* Cols used by 1 char  */
   int c;			/* current character    */
-  int oldlen;			/* length of original   */
+  const char *end;		/* end of original      */
 
-  for (col = 0, i = 0, oldlen = *len; oldlen; oldlen--)
+  end = text + *len;
+  for (col = 0, i = 0, c = 0; text < end; )
     {
-      if ((c = *text++ & 0xff) == '\t')
-	ncols = tabsize - (col % tabsize);
-      else if (CISCTRL (c) != FALSE)
-	ncols = 2;
-      else
-	ncols = 1;
-      if (i + ncols > bufsize)
+      if (i + tabsize > bufsize - (end - text))
 	{			/* Time to grow buffer? */
-	  newsize = bufsize + 80;	/* Grow it by 80 bytes  */
+	  newsize = bufsize * 2 + (end - text) + tabsize;
 	  if (bufsize == 0)
 	    newbuf = (char *) malloc (newsize);
 	  else
@@ -569,12 +977,23 @@ expand (const char *text, int *len)
 	  buf = newbuf;
 	  bufsize = newsize;
 	}
-      col += ncols;
+
+      /* There is room for the rest of the line plus one tab;
+       * copy characters up to the next tab.
+       */
+      while (text < end && (c = *text++ & 0xff) != '\t')
+	{
+	  col += CISCTRL (c) != FALSE ? 2 : 1;
+	  buf[i++] = c;
+	}
       if (c == '\t')
-	while (ncols--)
-	  buf[i++] = ' ';
-      else
-	buf[i++] = c;
+	{
+	  ncols = tabsize - (col % tabsize);
+	  col += ncols;
+	  while (ncols--)
+	    buf[i++] = ' ';
+	  c = 0;
+	}
     }
   *len = i;
   return (buf);
@@ -586,7 +1005,7 @@ expand (const char *text, int *len)
  * "fileio.c" package. The number of lines written is
  * displayed.  Most of the grief is error checking of some sort.
  */
-static int
+int
 writeout (const char *fn)
 {
   int s;
@@ -595,6 +1014,11 @@ writeout (const char *fn)
   int nline;
   const char *buf;
   int llen;
+  double nbytes, secs;
+  struct timeval start, end;
+  char rate[64];
+
+  loadall (curbp);		/* Finish background read */
 
   /* Check if the file has no terminating newline.  This is the
    * case if the last line in the file is not empty.
@@ -607,20 +1031,24 @@ writeout (const char *fn)
 	return (FALSE);
       if (s == TRUE)
 	{			/* Add the blank line.  */
-	  if ((fp = lallocx (0)) == NULL)
+	  if ((fp = lallocx (curbp, 0)) == NULL)
 	    return (FALSE);
 	  fp->l_fp = lp->l_fp;
 	  fp->l_bp = lp;
 	  lp->l_fp->l_bp = fp;
 	  lp->l_fp = fp;
+	  lidxinsert (curbp, fp);
+	  jouaddlines (fp, fp->l_fp);
 	}
     }
 
   eprintf ("[Writing...]");
+  gettimeofday (&start, NULL);
   if ((s = ffwopen (fn)) != FIOSUC)	/* Open writes message. */
     return (FALSE);
   lp = firstline (curbp);		/* First line.          */
   nline = 0;				/* Number of lines.     */
+  nbytes = 0;				/* Number of bytes.     */
   while (lp != curbp->b_linep)
     {
       llen = llength (lp);
@@ -644,6 +1072,7 @@ writeout (const char *fn)
 	}
       if (s != FIOSUC)
 	break;
+      nbytes += llen + (fp != curbp->b_linep);
       lp = fp;
     }
   if (s == FIOSUC)
@@ -651,10 +1080,17 @@ writeout (const char *fn)
       s = ffclose ();
       if (s == FIOSUC && kbdmop == NULL)
 	{
+	  gettimeofday (&end, NULL);
+	  secs = (end.tv_sec - start.tv_sec)
+		 + (end.tv_usec - start.tv_usec) / 1e6;
+	  if (secs < 1e-6)
+	    secs = 1e-6;
+	  snprintf (rate, sizeof (rate), "%.1f MB at %.1f MB/s",
+		    nbytes / 1e6, nbytes / 1e6 / secs);
 	  if (nline == 1)
-	    eprintf ("[Wrote 1 line]");
+	    eprintf ("[Wrote 1 line, %s]", rate);
 	  else
-	    eprintf ("[Wrote %d lines]", nline);
+	    eprintf ("[Wrote %d lines, %s]", nline, rate);
 	}
     }
   else				/* Ignore close error       */
@@ -688,6 +1124,7 @@ filewrite (int f, int n, int k)
     {
       strcpy (curbp->b_fname, expanded_fname);
       curbp->b_flag &= ~BFCHG;
+      jousaved (curbp);		/* Start new journal.	*/
       updatemode ();		/* Update mode lines.   */
     }
 #if	BACKUP
@@ -730,6 +1167,7 @@ filesave (int f, int n, int k)
   if ((s = writeout (curbp->b_fname)) == TRUE)
     {
       curbp->b_flag &= ~BFCHG;
+      jousaved (curbp);		/* Start new journal.	*/
       updatemode ();		/* Update mode lines.   */
     }
 #if	BACKUP
@@ -759,6 +1197,7 @@ filename (int f, int n, int k)
     return (s);
   adjustcase (fname);
   expanded_fname = fftilde (fname);
+  joufree (curbp);		/* Journal is for old file */
   strcpy (curbp->b_fname, expanded_fname);	/* Fix name.            */
   updatemode ();		/* Update mode lines    */
 #if	BACKUP
@@ -783,3 +1222,49 @@ setsavetabs (int f, int n, int k)
 	   savetabs ? "" : "not ");
   return (TRUE);
 }
+
+/*
+ * Set the atomicsave flag according to the numeric argument if present,
+ * or toggle the value if no argument present.  If atomicsave is nonzero,
+ * an existing file is saved by writing a new file in the same directory,
+ * flushing it to disk, and renaming it over the old one, so that the
+ * old file is never left half written.
+ */
+int
+setatomicsave (int f, int n, int k)
+{
+  atomicsave = f ? (n != 0) : !atomicsave;
+  eprintf ("[Files will %sbe saved atomically]",
+	   atomicsave ? "" : "not ");
+  return (TRUE);
+}
+
+/*
+ * Set the bgread flag according to the numeric argument if present,
+ * or toggle the value if no argument present.  If bgread is nonzero,
+ * big files are read in the background while the editor waits for keys.
+ */
+int
+setbgread (int f, int n, int k)
+{
+  bgread = f ? (n != 0) : !bgread;
+  eprintf ("[Big files will %sbe read in the background]",
+	   bgread ? "" : "not ");
+  return (TRUE);
+}
+
+/*
+ * Set the piecetable flag according to the numeric argument if present,
+ * or toggle the value if no argument present.  If piecetable is
+ * nonzero, files are read into memory in one go, and the lines
+ * of the buffer point into that image until they are changed,
+ * instead of each line being copied separately.
+ */
+int
+setpiecetable (int f, int n, int k)
+{
+  piecetable = f ? (n != 0) : !piecetable;
+  eprintf ("[Files will %sbe read as file images]",
+	   piecetable ? "" : "not ");
+  return (TRUE);
+}
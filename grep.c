@@ -0,0 +1,544 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Name:	MicroEMACS
+ *		Project grep
+ * By:		Mark Alexander
+ *		marka@pobox.com
+ *
+ * The commands in this file search all of the files under the
+ * current directory for a regular expression, without needing
+ * a cscope database.  The files are found and searched by a pool
+ * of threads (see ffwalk), and the matching lines are put in the
+ * tag list, so that they can be visited in turn with next-cscope,
+ * just like the results of find-grep.
+ */
+#include	"def.h"
+#include	"regexp.h"
+#include	<stdatomic.h>
+
+/*
+ * The characters that make a pattern a regular expression
+ * instead of a plain string.  PCRE2 also treats { as the
+ * start of a repeat count.
+ */
+#if USE_PCRE2
+#define	GREPSPECIAL	"^$.[]()|*+?\\{"
+#else
+#define	GREPSPECIAL	"^$.[]()|*+?\\"
+#endif
+
+/*
+ * A matching line found by one of the walking threads.
+ */
+typedef struct
+{
+  char *path;			/* File name			*/
+  int line;			/* Line number, starting at 1	*/
+  int own;			/* This hit owns path		*/
+}
+GREPHIT;
+
+/*
+ * The state of one walking thread.  Each thread needs its own
+ * compiled copy of the pattern, because regnexec keeps its
+ * DFA in the program.
+ */
+typedef struct
+{
+  regexp *prog;			/* Compiled pattern		*/
+  GREPHIT *hits;		/* Matching lines		*/
+  int nhits;			/* Number of entries in hits	*/
+  int size;			/* Allocated size of hits	*/
+}
+GREPWORKER;
+
+static GREPWORKER workers[NWALK];
+static int grepliteral;		/* Pattern has no special chars	*/
+
+static char grepinclude[NPAT];	/* Globs for files to search	*/
+static char grepexclude[NPAT] = ".git .hg .svn *.o *.a *.so";
+				/* Globs for names to skip	*/
+static int greplimit = 1000;	/* Stop after this many hits	*/
+static atomic_int grepnhits;	/* Hits found by all threads	*/
+
+/*
+ * Does the string s match the shell wildcard pattern
+ * that starts at p and ends at pend?  The pattern can
+ * contain *, ?, and [...] (with ! for negation).
+ */
+static int
+globmatch (const char *p, const char *pend, const char *s)
+{
+  int match, negate;
+
+  while (p < pend)
+    {
+      switch (*p)
+	{
+	case '*':
+	  if (++p == pend)
+	    return (TRUE);
+	  do
+	    {
+	      if (globmatch (p, pend, s))
+		return (TRUE);
+	    }
+	  while (*s++ != '\0');
+	  return (FALSE);
+	case '?':
+	  if (*s == '\0')
+	    return (FALSE);
+	  break;
+	case '[':
+	  if (*s == '\0')
+	    return (FALSE);
+	  match = FALSE;
+	  negate = p + 1 < pend && p[1] == '!';
+	  if (negate)
+	    p++;
+	  while (++p < pend && *p != ']')
+	    {
+	      if (p + 2 < pend && p[1] == '-' && p[2] != ']')
+		{
+		  if (*s >= p[0] && *s <= p[2])
+		    match = TRUE;
+		  p += 2;
+		}
+	      else if (*s == *p)
+		match = TRUE;
+	    }
+	  if (match == negate)
+	    return (FALSE);
+	  break;
+	default:
+	  if (*s != *p)
+	    return (FALSE);
+	  break;
+	}
+      p++;
+      s++;
+    }
+  return (*s == '\0');
+}
+
+/*
+ * Does the file name s match any of the space-separated
+ * wildcard patterns in list?
+ */
+static int
+globlist (const char *list, const char *s)
+{
+  const char *end;
+
+  for (;;)
+    {
+      while (*list == ' ')
+	list++;
+      if (*list == '\0')
+	return (FALSE);
+      for (end = list; *end != ' ' && *end != '\0'; end++)
+	;
+      if (globmatch (list, end, s))
+	return (TRUE);
+      list = end;
+    }
+}
+
+/*
+ * Return TRUE if the directory or file "path" should
+ * be skipped because its name matches the exclude list,
+ * or because it's the trigram index.
+ */
+static int
+grepexcluded (const char *path)
+{
+  const char *name;
+
+  if ((name = strrchr (path, '/')) != NULL)
+    name++;
+  else
+    name = path;
+  return (globlist (grepexclude, name) || tgisindex (name));
+}
+
+/*
+ * Called by the walking threads to ask if a directory or file
+ * should be visited.  Names that match the exclude list are
+ * skipped.  If there is an include list, only files whose names
+ * match it are searched.  Files that the trigram index shows
+ * can't contain the pattern are skipped too.
+ */
+static int
+grepwant (const char *path, int isdir)
+{
+  const char *name;
+
+  if (grepexcluded (path))
+    return (FALSE);
+  if (isdir)
+    return (TRUE);
+  if ((name = strrchr (path, '/')) != NULL)
+    name++;
+  else
+    name = path;
+  if (grepinclude[0] != '\0' && !globlist (grepinclude, name))
+    return (FALSE);
+  return (!tgskip (path));
+}
+
+/*
+ * Called by the walking threads to ask if a directory or file
+ * should be read while building the trigram index.  The include
+ * list isn't used, so that the index can be used with any include
+ * list.  Files that haven't changed since the old index was built
+ * aren't read again.
+ */
+static int
+indexwant (const char *path, int isdir)
+{
+  if (grepexcluded (path))
+    return (FALSE);
+  return (isdir || !tgkeep (path));
+}
+
+/*
+ * Add a hit at line "line" of file "path" to the list of
+ * hits for a walking thread.  Return FALSE if out of memory.
+ */
+static int
+grephit (GREPWORKER *gw, const char *path, int line)
+{
+  GREPHIT *hp;
+  int own;
+
+  if (gw->nhits == gw->size)
+    {
+      gw->size = gw->size == 0 ? 64 : 2 * gw->size;
+      hp = (GREPHIT *) realloc (gw->hits, gw->size * sizeof (GREPHIT));
+      if (hp == NULL)
+	return (FALSE);
+      gw->hits = hp;
+    }
+  hp = &gw->hits[gw->nhits];
+  own = gw->nhits == 0 || strcmp (hp[-1].path, path) != 0;
+  if (own)
+    {
+      if ((hp->path = strdup (path)) == NULL)
+	return (FALSE);
+    }
+  else
+    hp->path = hp[-1].path;
+  hp->own = own;
+  hp->line = line;
+  gw->nhits++;
+  atomic_fetch_add (&grepnhits, 1);
+  return (TRUE);
+}
+
+/*
+ * Return the number of newlines in the n bytes at s.
+ */
+static int
+countlines (const uchar *s, long n)
+{
+  const uchar *end = s + n;
+  int count = 0;
+
+  while ((s = (const uchar *) memchr (s, '\n', end - s)) != NULL)
+    {
+      count++;
+      s++;
+    }
+  return (count);
+}
+
+/*
+ * Called by walking thread "w" with the n bytes of
+ * the file "path".  Find the lines that contain the pattern,
+ * and add them to the thread's hits.  Files that look
+ * like binaries (they have a NUL near the start) are skipped.
+ * A literal pattern is searched for in the whole file at once
+ * by litscan, and the line number found only when it's there;
+ * a regular expression is matched against one line at a time.  Return
+ * FALSE to stop the walk once the threads between them have
+ * found as many hits as the limit.
+ * A NULL path means the thread is finished.
+ */
+static int
+grepscan (const char *path, const uchar *buf, long n, int w)
+{
+  GREPWORKER *gw = &workers[w];
+  const uchar *s, *p, *end;
+  int line;
+
+  if (path == NULL)
+    {
+      regdone ();
+      return (TRUE);
+    }
+  if (memchr (buf, '\0', n < 4096 ? n : 4096) != NULL)
+    return (TRUE);
+  s = buf;
+  end = buf + n;
+  line = 1;
+  while (s < end)
+    {
+      if (grepliteral)
+	{
+	  if ((p = litscan (s, end)) == NULL)
+	    break;
+	  line += countlines (s, p - s);
+	  if (grephit (gw, path, line) == FALSE)
+	    return (FALSE);
+	  s = p;
+	}
+      else
+	{
+	  if ((p = (const uchar *) memchr (s, '\n', end - s)) == NULL)
+	    p = end;
+	  if (regnexec (gw->prog, (const char *) s, p - s, 0)
+	      && grephit (gw, path, line) == FALSE)
+	    return (FALSE);
+	}
+      if (atomic_load (&grepnhits) >= greplimit)
+	return (FALSE);
+
+      /* Skip to the start of the next line.
+       */
+      if ((p = (const uchar *) memchr (s, '\n', end - s)) == NULL)
+	break;
+      s = p + 1;
+      line++;
+    }
+  return (TRUE);
+}
+
+/*
+ * Compare two hits for qsort, by file name and then line number.
+ */
+static int
+hitcmp (const void *a, const void *b)
+{
+  const GREPHIT *ha = (const GREPHIT *) a;
+  const GREPHIT *hb = (const GREPHIT *) b;
+  int c;
+
+  if ((c = strcmp (ha->path, hb->path)) != 0)
+    return (c);
+  return (ha->line - hb->line);
+}
+
+/*
+ * Free the hits and programs of the walking threads.
+ */
+static void
+grepfree (void)
+{
+  GREPWORKER *gw;
+  int i;
+
+  for (gw = workers; gw < workers + NWALK; gw++)
+    {
+      for (i = 0; i < gw->nhits; i++)
+	if (gw->hits[i].own)
+	  free (gw->hits[i].path);
+      free ((char *) gw->hits);
+      if (gw->prog != NULL)
+	regfree (gw->prog);
+      gw->hits = NULL;
+      gw->nhits = gw->size = 0;
+      gw->prog = NULL;
+    }
+}
+
+/*
+ * Search the files under the current directory for "string",
+ * and replace the tag list with the lines that contain it.
+ * This is called by searchtag (in tags.c) just before
+ * it starts searching through the tag list.
+ */
+static int
+prepprojgrep (const char *string)
+{
+  GREPWORKER *gw;
+  GREPHIT *all;
+  tagfile *tf;
+  int i, n, s;
+
+  freetags (FALSE, 1, KRANDOM);
+  grepliteral = strpbrk (string, GREPSPECIAL "\n") == NULL;
+  if (grepliteral)
+    litcompexact ((const uchar *) string);
+  atomic_store (&grepnhits, 0);
+  if (tgload ())
+    tgquery (string, grepliteral);
+  s = FALSE;
+  if (!grepliteral)
+    for (gw = workers; gw < workers + NWALK; gw++)
+      if ((gw->prog = regcomp (string)) == NULL)
+	goto out;		/* regerror shows message */
+  eprintf ("[Searching...]");
+  update ();
+  if (ffwalk (".", grepwant, grepscan) == FALSE)
+    {
+      eprintf ("Unable to search files");
+      goto out;
+    }
+
+  /* Gather the hits from all of the threads, sort them, and
+   * add the first greplimit of them to the tag list.
+   */
+  n = 0;
+  for (gw = workers; gw < workers + NWALK; gw++)
+    n += gw->nhits;
+  if ((all = (GREPHIT *) malloc ((n + 1) * sizeof (GREPHIT))) == NULL)
+    {
+      eprintf ("Out of memory");
+      goto out;
+    }
+  n = 0;
+  for (gw = workers; gw < workers + NWALK; gw++)
+    for (i = 0; i < gw->nhits; i++)
+      all[n++] = gw->hits[i];
+  qsort (all, n, sizeof (GREPHIT), hitcmp);
+  if (n > greplimit)
+    n = greplimit;
+  s = TRUE;
+  tf = NULL;
+  for (i = 0; i < n; i++)
+    {
+      if (tf == NULL || strcmp (tf->fname, all[i].path) != 0)
+	if ((tf = findtagfile (all[i].path)) == NULL)
+	  {
+	    eprintf ("Unable to create file structure");
+	    s = FALSE;
+	    break;
+	  }
+      if (addtagref (string, tf, all[i].line, 0L, FALSE) == NULL)
+	{
+	  eprintf ("Unable to create tag structure");
+	  s = FALSE;
+	  break;
+	}
+    }
+  free ((char *) all);
+  if (s == TRUE && n == greplimit)
+    eprintf ("[Stopped after %d matches]", n);
+  else if (s == TRUE)
+    eprintf ("[%d matches]", n);
+
+out:
+  grepfree ();
+  return (s);
+}
+
+/*
+ * Search all of the files under the current directory for
+ * a regular expression, and visit the first line that contains
+ * it.  With an argument, visit the next such line.  All of
+ * the work of searching the list of lines is done in searchtag
+ * (tags.c), but the list is made by prepprojgrep above.
+ */
+int
+projgrep (int f, int n, int k)
+{
+  return searchtag (f, n, prepprojgrep, "grep");
+}
+
+/*
+ * Set the list of shell wildcard patterns for the names
+ * of files that project-grep searches.  An empty list means
+ * search all files.
+ */
+int
+setgrepinclude (int f, int n, int k)
+{
+  int s;
+
+  s = ereply ("Grep files matching [%s]: ", grepinclude, NPAT, grepinclude);
+  if (s == FALSE)
+    grepinclude[0] = '\0';
+  return (s == ABORT ? s : TRUE);
+}
+
+/*
+ * Set the list of shell wildcard patterns for the names
+ * of files and directories that project-grep skips.
+ */
+int
+setgrepexclude (int f, int n, int k)
+{
+  int s;
+
+  s = ereply ("Grep skips names matching [%s]: ", grepexclude, NPAT,
+	      grepexclude);
+  if (s == FALSE)
+    grepexclude[0] = '\0';
+  return (s == ABORT ? s : TRUE);
+}
+
+/*
+ * Set the maximum number of matching lines that project-grep
+ * finds to the numeric argument, or to the default of 1000 if
+ * there is no argument.
+ */
+int
+setgreplimit (int f, int n, int k)
+{
+  if (!f)
+    n = 1000;
+  else if (n < 1)
+    {
+      eprintf ("Illegal grep limit %d", n);
+      return (FALSE);
+    }
+  greplimit = n;
+  eprintf ("[Grep will stop after %d matches]", n);
+  return (TRUE);
+}
+
+/*
+ * Build or update the trigram index of the files under the
+ * current directory, which project-grep uses to avoid reading
+ * files that can't contain a match.  Only the files that have
+ * changed since the index was last built are read.
+ */
+int
+makegrepindex (int f, int n, int k)
+{
+  tgload ();
+  if (tgstart () == FALSE)
+    {
+      tgfree ();
+      return (FALSE);
+    }
+  eprintf ("[Indexing...]");
+  update ();
+  if (ffwalk (".", indexwant, tgscan) == FALSE)
+    {
+      eprintf ("Unable to index files");
+      tgfree ();
+      return (FALSE);
+    }
+  n = tgsave ();
+  tgfree ();
+  return (n);
+}
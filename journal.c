@@ -0,0 +1,617 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Name:	MicroEMACS
+ *		Crash journals
+ * By:		Mark Alexander
+ *		marka@pobox.com
+ *
+ * When journaling is turned on with set-journal, every change
+ * made to a buffer that is associated with a file is recorded
+ * in a journal file, whose name is the file name with ".pejou"
+ * appended.  The journal starts out empty when the file is read
+ * or saved, so the file plus the journal always give the current
+ * contents of the buffer.
+ * When a file is read and a journal is left over from an editor
+ * that crashed, the user is offered the chance to replay it.
+ *
+ * The changes are recorded at the level of the line primitives
+ * (linsert, lnewline, and ldelete), so everything that
+ * changes a buffer, including undo and redo, is recorded.  Each
+ * record gives the line number and offset of the change, so
+ * replaying it doesn't depend on the window size or on where
+ * the dot was.  Records are collected in a buffer, which
+ * is written out when the editor is waiting for a key, when
+ * it fills up, or when it has been holding changes for JOUDELAY
+ * milliseconds.
+ *
+ * A journal starts with the line JOUMAGIC, followed by records
+ * of these forms, where l and o are the zero-based line number
+ * (-1 for the end of the buffer) and character offset of the dot:
+ *
+ *	I l o n\n<n bytes>\n	linsert (n, 0, bytes)
+ *	C l o n c\n		linsert (n, c, NULL)
+ *	N l o\n			lnewline ()
+ *	D l o n\n		ldelete (n, FALSE)
+ *	L l n b\n<b bytes>	n lines, each followed by a newline,
+ *				inserted before line l
+ */
+#include	"def.h"
+
+#include	<limits.h>
+#include	<sys/time.h>
+
+#define	JOUEXT		".pejou"	/* Appended to file name	*/
+#define	JOUMAGIC	"pe journal 1\n" /* First line of a journal	*/
+#define	JOUBUFSIZE	8192		/* Size of record buffer	*/
+#define	JOUDELAY	500		/* Max ms to hold records	*/
+
+int journal = FALSE;		/* TRUE if changes are journaled	*/
+
+/*
+ * The journal of one buffer.  The file isn't
+ * opened until the first change is recorded.
+ */
+typedef struct JOURNAL
+{
+  int j_fd;			/* File descriptor, or -1	*/
+  int j_append;			/* Add to existing journal?	*/
+  int j_used;			/* Bytes used in j_buf		*/
+  long j_time;			/* When j_buf stopped being empty */
+  char j_fname[NFILEN + 8];	/* Journal file name		*/
+  char j_buf[JOUBUFSIZE];	/* Records not yet written	*/
+}
+JOURNAL;
+
+/*
+ * Return the current time in milliseconds.
+ */
+static long
+msnow (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (tv.tv_sec * 1000L + tv.tv_usec / 1000);
+}
+
+/*
+ * Set the journal flag according to the numeric argument if present,
+ * or toggle the value if no argument present.  The setting takes
+ * effect the next time a file is read or saved.
+ */
+int
+setjournal (int f, int n, int k)
+{
+  if (f)
+    journal = n != 0;
+  else
+    journal = !journal;
+  if (journal)
+    eprintf ("[Changes will be journaled]");
+  else
+    eprintf ("[Changes will not be journaled]");
+  return (TRUE);
+}
+
+/*
+ * Stop journaling buffer "bp".  If "rm" is TRUE,
+ * and the journal file belongs to this buffer, delete it.
+ */
+static void
+joustop (BUFFER *bp, int rm)
+{
+  JOURNAL *jp;
+
+  if ((jp = bp->b_jou) == NULL)
+    return;
+  if (jp->j_fd >= 0)
+    ffjclose (jp->j_fd);
+  if (rm && (jp->j_fd >= 0 || jp->j_append))
+    remove (jp->j_fname);
+  free ((char *) jp);
+  bp->b_jou = NULL;
+}
+
+/*
+ * Write out the records collected for buffer "bp", opening
+ * the journal file first if necessary.  If there is an error,
+ * stop journaling the buffer.  Return FALSE on error.
+ */
+static int
+jouwrite (BUFFER *bp)
+{
+  JOURNAL *jp = bp->b_jou;
+
+  if (jp->j_fd < 0)
+    {
+      if (ffjopen (jp->j_fname, jp->j_append, &jp->j_fd) != FIOSUC)
+	{
+	  joustop (bp, FALSE);
+	  return (FALSE);
+	}
+      if (!jp->j_append
+	  && ffjwrite (jp->j_fd, JOUMAGIC, sizeof (JOUMAGIC) - 1) != FIOSUC)
+	{
+	  joustop (bp, TRUE);
+	  return (FALSE);
+	}
+    }
+  if (jp->j_used != 0 && ffjwrite (jp->j_fd, jp->j_buf, jp->j_used) != FIOSUC)
+    {
+      joustop (bp, TRUE);
+      return (FALSE);
+    }
+  jp->j_used = 0;
+  return (TRUE);
+}
+
+/*
+ * Add "n" bytes at "s" to the records for buffer "bp".
+ * Text that doesn't fit in the buffer is written directly.
+ * Return FALSE if journaling had to be stopped.
+ */
+static int
+jouput (BUFFER *bp, const char *s, long n)
+{
+  JOURNAL *jp = bp->b_jou;
+  int len;
+
+  while (n > 0)
+    {
+      if (jp->j_used == JOUBUFSIZE)
+	{
+	  if (jouwrite (bp) == FALSE)
+	    return (FALSE);
+	}
+      if (jp->j_used == 0 && n >= JOUBUFSIZE)
+	{			/* Skip the buffer	*/
+	  len = n > INT_MAX ? INT_MAX : (int) n;
+	  if (jouwrite (bp) == FALSE)
+	    return (FALSE);
+	  if (ffjwrite (jp->j_fd, s, len) != FIOSUC)
+	    {
+	      joustop (bp, TRUE);
+	      return (FALSE);
+	    }
+	}
+      else
+	{
+	  if (jp->j_used == 0)
+	    jp->j_time = msnow ();
+	  len = JOUBUFSIZE - jp->j_used;
+	  if (len > n)
+	    len = n;
+	  memcpy (&jp->j_buf[jp->j_used], s, len);
+	  jp->j_used += len;
+	}
+      s += len;
+      n -= len;
+    }
+  return (TRUE);
+}
+
+/*
+ * Start a record for the current buffer, consisting of the
+ * "kind" letter, the position of the dot, and the number "n".
+ * Return FALSE if journaling had to be stopped.
+ */
+static int
+joustart (int kind, int n)
+{
+  char rec[64];
+  int l, len;
+
+  l = curwp->w_dot.p == curbp->b_linep ? -1 : lineno (curwp->w_dot.p);
+  if (kind == 'N')
+    len = snprintf (rec, sizeof (rec), "N %d %d\n", l, curwp->w_dot.o);
+  else
+    len = snprintf (rec, sizeof (rec), "%c %d %d %d", kind, l,
+		    curwp->w_dot.o, n);
+  return (jouput (curbp, rec, len));
+}
+
+/*
+ * Finish a record for the current buffer, and write out the
+ * records if they have been waiting for long enough.
+ */
+static void
+jouend (void)
+{
+  JOURNAL *jp = curbp->b_jou;
+
+  if (jp != NULL && jp->j_used != 0 && msnow () - jp->j_time >= JOUDELAY)
+    jouwrite (curbp);
+}
+
+/*
+ * Record a call to linsert (n, c, s) at the dot.
+ */
+void
+jouinsert (int n, int c, const char *s)
+{
+  char rec[16];
+  int len;
+
+  if (curbp->b_jou == NULL || n <= 0)
+    return;
+  if (s == NULL)
+    {
+      if (joustart ('C', n) == FALSE)
+	return;
+      len = snprintf (rec, sizeof (rec), " %d\n", c);
+      if (jouput (curbp, rec, len) == FALSE)
+	return;
+    }
+  else if (joustart ('I', n) == FALSE
+	   || jouput (curbp, "\n", 1) == FALSE
+	   || jouput (curbp, s, n) == FALSE
+	   || jouput (curbp, "\n", 1) == FALSE)
+    return;
+  jouend ();
+}
+
+/*
+ * Record a call to lnewline at the dot.
+ */
+void
+jounewline (void)
+{
+  if (curbp->b_jou == NULL || joustart ('N', 0) == FALSE)
+    return;
+  jouend ();
+}
+
+/*
+ * Record a call to ldelete (n, kflag) at the dot.
+ */
+void
+joudelete (int n)
+{
+  if (curbp->b_jou == NULL || n <= 0
+      || joustart ('D', n) == FALSE || jouput (curbp, "\n", 1) == FALSE)
+    return;
+  jouend ();
+}
+
+/*
+ * Record the lines from "lp" up to, but not including, "lp2",
+ * which have just been linked into the current buffer without
+ * going through the line primitives, as when inserting a file.
+ */
+void
+jouaddlines (LINE *lp, LINE *lp2)
+{
+  LINE *lp1;
+  long nbytes;
+  int n, l;
+  char rec[64];
+
+  if (curbp->b_jou == NULL || lp == lp2)
+    return;
+  n = 0;
+  nbytes = 0;
+  for (lp1 = lp; lp1 != lp2; lp1 = lforw (lp1))
+    {
+      ++n;
+      nbytes += llength (lp1) + 1;
+    }
+  l = lineno (lp);
+  snprintf (rec, sizeof (rec), "L %d %d %ld\n", l, n, nbytes);
+  if (jouput (curbp, rec, strlen (rec)) == FALSE)
+    return;
+  for (lp1 = lp; lp1 != lp2; lp1 = lforw (lp1))
+    if (jouput (curbp, (const char *) lgets (lp1), llength (lp1)) == FALSE
+	|| jouput (curbp, "\n", 1) == FALSE)
+      return;
+  jouend ();
+}
+
+/*
+ * Write out the records collected for all buffers.
+ * This is called by the main loop when no keys are waiting.
+ */
+void
+jouflush (void)
+{
+  BUFFER *bp;
+
+  ALLBUF (bp)
+  {
+    if (bp->b_jou != NULL && bp->b_jou->j_used != 0)
+      jouwrite (bp);
+  }
+}
+
+/*
+ * Stop journaling buffer "bp", and delete its journal.
+ * This is called when the changes in the buffer are
+ * being thrown away.
+ */
+void
+joufree (BUFFER *bp)
+{
+  joustop (bp, TRUE);
+}
+
+/*
+ * Delete the journals of all buffers.  This is called
+ * when the editor exits normally.
+ */
+void
+jouexit (void)
+{
+  BUFFER *bp;
+
+  ALLBUF (bp)
+  {
+    joustop (bp, TRUE);
+  }
+}
+
+/*
+ * Start a new, empty journal for buffer "bp", whose
+ * contents are now the same as its file.
+ * Return the journal, or NULL if there isn't one.
+ */
+static JOURNAL *
+joustart1 (BUFFER *bp)
+{
+  JOURNAL *jp;
+
+  if (!journal || bp->b_fname[0] == 0)
+    return (NULL);
+  if ((jp = (JOURNAL *) malloc (sizeof (JOURNAL))) == NULL)
+    return (NULL);
+  jp->j_fd = -1;
+  jp->j_append = FALSE;
+  jp->j_used = 0;
+  snprintf (jp->j_fname, sizeof (jp->j_fname), "%s%s", bp->b_fname, JOUEXT);
+  bp->b_jou = jp;
+  return (jp);
+}
+
+/*
+ * Buffer "bp" has just been saved to its file.  Delete the old
+ * journal, which may have had a different name, and start a new one.
+ */
+void
+jousaved (BUFFER *bp)
+{
+  joustop (bp, TRUE);
+  joustart1 (bp);
+}
+
+/*
+ * Get a number, preceded by a space, from the journal
+ * image at *pp, and store it in *vp.  Return FALSE if there
+ * isn't one before "end".
+ */
+static int
+jougetnum (const uchar **pp, const uchar *end, long *vp)
+{
+  const uchar *p = *pp;
+  long v;
+  int neg;
+
+  if (p >= end || *p++ != ' ')
+    return (FALSE);
+  neg = p < end && *p == '-';
+  if (neg)
+    ++p;
+  if (p >= end || *p < '0' || *p > '9')
+    return (FALSE);
+  for (v = 0; p < end && *p >= '0' && *p <= '9'; ++p)
+    v = v * 10 + *p - '0';
+  *vp = neg ? -v : v;
+  *pp = p;
+  return (TRUE);
+}
+
+/*
+ * Insert the "len" bytes of newline-terminated lines at "s"
+ * into the current buffer before line "lp2", the same way
+ * readlines does.  Return FALSE if there is an error.
+ */
+static int
+jouputlines (LINE *lp2, const uchar *s, long len)
+{
+  const uchar *nl, *end;
+  LINE *lp1;
+
+  for (end = s + len; s < end; s = nl + 1)
+    {
+      if ((nl = (const uchar *) memchr (s, '\n', end - s)) == NULL)
+	return (FALSE);
+      if ((lp1 = lallocx (curbp, nl - s)) == NULL)
+	return (FALSE);
+      lp1->l_bp = lp2->l_bp;	/* Insert lp1           */
+      lp1->l_fp = lp2;		/*  before lp2          */
+      lp2->l_bp->l_fp = lp1;
+      lp2->l_bp = lp1;
+      lidxinsert (curbp, lp1);
+      lputs (lp1, s, nl - s);
+    }
+  lchange (WFHARD);
+  return (TRUE);
+}
+
+/*
+ * Replay the journal records in the "size" bytes at "image" on
+ * the current buffer.  Return the number of records replayed, or
+ * -1 - the number of records replayed if a record can't be replayed.
+ * A record cut off at the end of the journal, which happens if the
+ * editor crashed while writing it, is ignored.
+ */
+static int
+jouplay (const uchar *image, long size)
+{
+  const uchar *p, *end;
+  long v[4];
+  int kind, nv, i, n, s;
+  LINE *lp;
+
+  end = image + size;
+  p = image + sizeof (JOUMAGIC) - 1;
+  for (n = 0; p < end; ++n)
+    {
+      kind = *p++;
+      switch (kind)
+	{
+	case 'N':
+	  nv = 2;
+	  break;
+	case 'I':
+	case 'D':
+	case 'L':
+	  nv = 3;
+	  break;
+	case 'C':
+	  nv = 4;
+	  break;
+	default:
+	  return (-1 - n);
+	}
+      for (i = 0; i < nv; i++)
+	if (jougetnum (&p, end, &v[i]) == FALSE)
+	  return (p >= end ? n : -1 - n);
+      if (p >= end)
+	return (n);
+      if (*p++ != '\n')
+	return (-1 - n);
+
+      /* The data for I and L records must be all there.
+       */
+      if ((kind == 'I' && end - p < v[2] + 1) || (kind == 'L' && end - p < v[2]))
+	return (n);
+
+      /* L records give the line to insert before, which
+       * is the header line if the lines went at the end.
+       * The others give the position of the dot.
+       */
+      lp = v[0] < 0 ? curbp->b_linep : blinep (curbp, (int) v[0]);
+      if (kind == 'L')
+	{
+	  if (jouputlines (lp, p, v[2]) == FALSE)
+	    return (-1 - n);
+	  p += v[2];
+	  continue;
+	}
+      if ((v[0] >= 0 && lp == curbp->b_linep)
+	  || v[1] < 0 || v[1] > wllength (lp))
+	return (-1 - n);
+      curwp->w_dot.p = lp;
+      curwp->w_dot.o = (int) v[1];
+      switch (kind)
+	{
+	case 'I':
+	  s = linsert ((int) v[2], 0, (char *) p);
+	  p += v[2] + 1;
+	  break;
+	case 'C':
+	  s = linsert ((int) v[2], (int) v[3], NULLPTR);
+	  break;
+	case 'N':
+	  s = lnewline ();
+	  break;
+	default:		/* 'D': stops at end of buffer	*/
+	  ldelete ((int) v[2], FALSE);
+	  s = TRUE;
+	  break;
+	}
+      if (s != TRUE)
+	return (-1 - n);
+    }
+  return (n);
+}
+
+/*
+ * Replay the journal image on buffer "bp", with redisplay
+ * and undo records turned off.  If "bp" isn't in the current
+ * window, which happens when reading files at startup, it is
+ * put there for the replay, and taken out again afterwards.
+ */
+static void
+jourecover (BUFFER *bp, const uchar *image, long size)
+{
+  BUFFER *oldbp;
+  EWINDOW oldwin;
+  JOURNAL *jp;
+  int n, swap;
+
+  loadall (bp);			/* Finish background read */
+  oldbp = curbp;
+  oldwin = *curwp;
+  swap = curwp->w_bufp != bp;
+  curbp = bp;
+  curwp->w_bufp = bp;
+  jp = bp->b_jou;
+  bp->b_jou = NULL;		/* Don't record the replay */
+  disablesaveundo ();
+  n = jouplay (image, size);
+  enablesaveundo ();
+  bp->b_jou = jp;
+  if (swap)
+    {
+      curbp = oldbp;
+      *curwp = oldwin;
+      bp->b_dot.p = firstline (bp);
+      bp->b_dot.o = 0;
+    }
+  curwp->w_flag |= WFMODE | WFHARD;
+  if (n < 0)
+    {				/* Keep the journal	*/
+      eprintf ("Journal %s is damaged after %d changes", jp->j_fname, -1 - n);
+      joustop (bp, FALSE);
+      return;
+    }
+  jp->j_append = TRUE;		/* Later changes go after these */
+  eprintf ("[Recovered %d changes]", n);
+}
+
+/*
+ * Start a journal for buffer "bp", whose file has
+ * just been read by readin.  If there is a journal
+ * left over for the file, offer to replay it.
+ */
+void
+jouread (BUFFER *bp)
+{
+  JOURNAL *jp;
+  uchar *image;
+  long size;
+
+  if ((jp = joustart1 (bp)) == NULL)
+    return;
+  if (ffropen (jp->j_fname) != FIOSUC)
+    return;
+  if (ffgetimage (&image, &size) != FIOSUC)
+    {				/* Empty journal	*/
+      ffclose ();
+      return;
+    }
+  ffclose ();
+  if (size > (long) sizeof (JOUMAGIC) - 1
+      && memcmp (image, JOUMAGIC, sizeof (JOUMAGIC) - 1) == 0
+      && (bp->b_flag & BFRO) == 0
+      && eyesno ("Recover unsaved changes from journal") == TRUE)
+    jourecover (bp, image, size);
+  fffreeimage (image, size);
+}
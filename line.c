@@ -47,6 +47,8 @@
 #include	"def.h"
 
 #define	NBLOCK	16		/* Line block chunk size        */
+#define	LCSTEP	64		/* Chars between checkpoints	*/
+#define	LCMIN	256		/* Min bytes to use checkpoints	*/
 
 #ifndef	KBLOCK
 #define	KBLOCK	256		/* Kill buffer block size.      */
@@ -62,59 +64,959 @@ static int kused = 0;			/* # of bytes used in KB.       */
 static int ksize = 0;			/* # of bytes allocated in KB.  */
 static int kchars = 0;			/* # of UTF-8 chars in KB.	*/
 
+/*
+ * A long line may have a cache of checkpoints, so that
+ * finding the byte offset or the screen column of a character
+ * index doesn't have to decode the entire line from the start.
+ * Checkpoint i is at character i * LCSTEP.  p_off is its byte
+ * offset, and p_col and p_width are its column, as counted
+ * by lcolstep; checkpoint 0 is always at the start of the
+ * line.  Only the first c_n offsets are valid, and the first
+ * c_ncols columns, which were counted with a tab size of
+ * c_tabsize.  Edits throw away the checkpoints that follow
+ * the point of the edit; they are rebuilt lazily as they
+ * are needed.  Pure ASCII lines don't need the offsets,
+ * but can still use the columns.
+ */
+typedef struct LCPOINT
+{
+  int p_off;			/* Byte offset			*/
+  int p_col;			/* Column, one per character	*/
+  int p_width;			/* Column on the terminal	*/
+}
+LCPOINT;
+
+typedef struct LCACHE
+{
+  struct LCACHE *c_next;	/* Next cache in hash chain	*/
+  const LINE *c_line;		/* Line that owns the cache	*/
+  int c_nchars;			/* # of chars in line, or -1	*/
+  int c_n;			/* # of valid checkpoint offsets */
+  int c_ncols;			/* # of valid checkpoint columns */
+  int c_tabsize;		/* Tab size used for columns	*/
+  int c_max;			/* # of allocated checkpoints	*/
+  LCPOINT c_pt[];		/* Checkpoints			*/
+}
+LCACHE;
+
 /*
  * Forward declarations.
  */
 static int ldelnewline (void);
 
 /*
- * This routine allocates a block
- * of memory large enough to hold a LINE
- * containing "used" characters. The block is
- * always rounded up a bit. Return a pointer
- * to the new block, or NULL if there isn't
- * any memory left. Print a message in the
- * message line if no space.
+ * Lines are allocated from an arena that belongs to
+ * their buffer, so that reading a big file doesn't
+ * call malloc once per line, and clearing the buffer
+ * doesn't call free once per line.
+ *
+ * Lines read from files are packed end to end in
+ * "bump" chunks.  They are never freed individually;
+ * when one of them is released (usually because it was
+ * edited and had to be reallocated), its space is lost
+ * until the whole arena goes away.  Lines created by
+ * editing come from "slab" chunks, carved into power-of-two
+ * size classes; a released slab line goes on a free list
+ * for its class and is reused.  Lines too large for the
+ * largest class are malloc'ed separately, and are kept
+ * on a list so they can be found when the arena is freed.
+ *
+ * The arena also owns the images of the files that were read
+ * into the buffer with the piece table method (see readlines):
+ * the lines of such a file are just headers in a bump chunk,
+ * pointing at their text in the image.
  */
-LINE *
-lalloc (int used)
+#define	ACLASSES 8		/* # of slab size classes	*/
+#define	AMINTEXT 16		/* Text size of smallest class	*/
+#define	ACHUNK	(256 * 1024)	/* Size of slab and bump chunks	*/
+#define	AALIGN(n) (((n) + sizeof (void *) - 1) & ~(sizeof (void *) - 1))
+
+/*
+ * Header of a chunk, or of a large line.
+ */
+typedef struct ABLOCK
+{
+  struct ABLOCK *a_next;	/* Next block in list		*/
+  struct ABLOCK *a_prev;	/* Previous block in list	*/
+  size_t a_size;		/* Size, including header	*/
+}
+ABLOCK;
+
+#define	ABLOCKHDR_SIZE AALIGN (sizeof (ABLOCK))
+
+/*
+ * An image of a file read into the buffer.
+ */
+typedef struct AIMAGE
+{
+  struct AIMAGE *i_next;	/* Next image			*/
+  uchar *i_buf;			/* The file contents		*/
+  long i_size;			/* Size of the file		*/
+}
+AIMAGE;
+
+typedef struct ARENA
+{
+  ABLOCK *a_chunks;		/* Slab and bump chunks		*/
+  ABLOCK *a_big;		/* Separately allocated lines	*/
+  AIMAGE *a_images;		/* File images			*/
+  LINE *a_free[ACLASSES];	/* Slab free lists, via l_fp	*/
+  char *a_slabp;		/* Unused part of slab chunk	*/
+  size_t a_slabn;		/* Bytes left there		*/
+  char *a_bumpp;		/* Unused part of bump chunk	*/
+  size_t a_bumpn;		/* Bytes left there		*/
+  size_t a_total;		/* Bytes malloc'ed		*/
+  size_t a_live;		/* Bytes in lines in use	*/
+  size_t a_freed;		/* Bytes on slab free lists	*/
+  size_t a_lost;		/* Bytes lost in bump chunks	*/
+  size_t a_image;		/* Bytes in file images		*/
+  long a_nchunks;		/* # of chunks			*/
+  long a_nbig;			/* # of large lines		*/
+  long a_nlines;		/* # of lines in use		*/
+}
+ARENA;
+
+/*
+ * The checkpoint caches are kept in a hash table keyed by
+ * the line, rather than pointed to by the line header, because
+ * only long lines have them; a pointer in every LINE would
+ * cost every short line 8 bytes.  A line that has a cache
+ * has the LFCACHE flag, so other lines never look in the table.
+ */
+static LCACHE **lctab = NULL;		/* Hash chains of caches.	*/
+static int lcbits = 0;			/* Log2 of # of chains.		*/
+static long ncaches = 0;		/* # of live LCACHEs.		*/
+
+/*
+ * Return the number of the hash chain for the
+ * checkpoint cache of line "lp".
+ */
+static int
+lchash (const LINE *lp)
+{
+  return ((unsigned int) ((size_t) lp >> 3) * 2654435761u) >> (32 - lcbits);
+}
+
+/*
+ * Return the checkpoint cache of line "lp",
+ * or NULL if it doesn't have one.
+ */
+static LCACHE *
+lcfind (const LINE *lp)
+{
+  LCACHE *cp;
+
+  if ((lp->l_flag & LFCACHE) == 0)
+    return NULL;
+  for (cp = lctab[lchash (lp)]; cp->c_line != lp; cp = cp->c_next)
+    ;
+  return cp;
+}
+
+/*
+ * Take the checkpoint cache of line "lp" out of
+ * the hash table, and return it, or NULL if the line
+ * doesn't have one.  The caller must free it or
+ * give it to another line with lclink.
+ */
+static LCACHE *
+lcunlink (LINE *lp)
 {
+  LCACHE **cpp, *cp;
+
+  if ((lp->l_flag & LFCACHE) == 0)
+    return NULL;
+  cpp = &lctab[lchash (lp)];
+  while ((*cpp)->c_line != lp)
+    cpp = &(*cpp)->c_next;
+  cp = *cpp;
+  *cpp = cp->c_next;
+  lp->l_flag &= ~LFCACHE;
+  --ncaches;
+  return cp;
+}
+
+/*
+ * Make "cp" the checkpoint cache of line "lp", which
+ * doesn't have one.  The hash table is doubled when there
+ * are more caches than chains.  Return FALSE if the table
+ * can't be allocated at all.
+ */
+static int
+lclink (LINE *lp, LCACHE *cp)
+{
+  LCACHE **ntab, *cp2, *next;
+  int i, n, h;
+
+  n = lctab == NULL ? 0 : 1 << lcbits;
+  if (ncaches >= n
+      && (ntab = (LCACHE **) calloc (n == 0 ? 64 : 2 * n,
+				     sizeof (LCACHE *))) != NULL)
+    {
+      lcbits = n == 0 ? 6 : lcbits + 1;
+      for (i = 0; i < n; i++)
+	for (cp2 = lctab[i]; cp2 != NULL; cp2 = next)
+	  {
+	    next = cp2->c_next;
+	    h = lchash (cp2->c_line);
+	    cp2->c_next = ntab[h];
+	    ntab[h] = cp2;
+	  }
+      free (lctab);
+      lctab = ntab;
+    }
+  if (lctab == NULL)
+    return FALSE;
+  h = lchash (lp);
+  cp->c_line = lp;
+  cp->c_next = lctab[h];
+  lctab[h] = cp;
+  lp->l_flag |= LFCACHE;
+  ++ncaches;
+  return TRUE;
+}
+
+/*
+ * Return the arena for buffer "bp", creating
+ * it if necessary.  Return NULL if there isn't
+ * any memory left.
+ */
+static ARENA *
+agetarena (BUFFER *bp)
+{
+  ARENA *ap;
+
+  if ((ap = bp->b_arena) != NULL)
+    return ap;
+  if ((ap = (ARENA *) malloc (sizeof (ARENA))) == NULL)
+    return NULL;
+  memset (ap, 0, sizeof (ARENA));
+  bp->b_arena = ap;
+  return ap;
+}
+
+/*
+ * Allocate a block of "size" bytes (including
+ * the ABLOCK header) and link it onto the
+ * list "*listp".  Return NULL if there isn't any memory.
+ */
+static ABLOCK *
+anewblock (ARENA *ap, ABLOCK **listp, size_t size)
+{
+  ABLOCK *bp;
+
+  if ((bp = (ABLOCK *) malloc (size)) == NULL)
+    return NULL;
+  bp->a_size = size;
+  bp->a_prev = NULL;
+  bp->a_next = *listp;
+  if (*listp != NULL)
+    (*listp)->a_prev = bp;
+  *listp = bp;
+  ap->a_total += size;
+  return bp;
+}
+
+/*
+ * Allocate "size" bytes from the chunk whose unused
+ * part is described by "*pp" and "*np", getting a
+ * new chunk if there isn't enough room.  The tail of
+ * the old chunk is counted as lost.
+ */
+static char *
+achunkalloc (ARENA *ap, char **pp, size_t *np, size_t size)
+{
+  ABLOCK *bp;
+  char *p;
+
+  if (*np < size)
+    {
+      if ((bp = anewblock (ap, &ap->a_chunks, ACHUNK)) == NULL)
+	return NULL;
+      ap->a_lost += *np;
+      ap->a_nchunks++;
+      *pp = (char *) bp + ABLOCKHDR_SIZE;
+      *np = ACHUNK - ABLOCKHDR_SIZE;
+    }
+  p = *pp;
+  *pp += size;
+  *np -= size;
+  return p;
+}
+
+/*
+ * Allocate a line with room for "size" bytes
+ * of text, from the arena for buffer "bp".
+ * "kind" is LFSLAB or LFBUMP.  If "bp" is NULL,
+ * or the line is too big for a chunk, use malloc.
+ */
+static LINE *
+anewline (BUFFER *bp, int size, int kind)
+{
+  ARENA *ap;
+  ABLOCK *blk;
   LINE *lp;
-  int size;
+  int c;
+  size_t n;
 
-  size = (used + NBLOCK - 1) & ~(NBLOCK - 1);
-  if (size == 0)		/* Assume that an empty */
-    size = NBLOCK;		/* line is for type-in. */
-  if ((lp = (LINE *) malloc (LINEHDR_SIZE + size)) == NULL)
+  n = AALIGN (LINEHDR_SIZE + size);
+  if (bp == NULL)
+    {
+      lp = (LINE *) malloc (n);
+      kind = 0;
+    }
+  else if ((ap = agetarena (bp)) == NULL)
+    lp = NULL;
+  else if (kind == LFSLAB && size <= AMINTEXT << (ACLASSES - 1))
+    {
+      for (c = 0; (AMINTEXT << c) < size; c++)
+	;
+      if ((lp = ap->a_free[c]) != NULL)
+	{
+	  ap->a_free[c] = lp->l_fp;
+	  ap->a_freed -= n;
+	}
+      else
+	lp = (LINE *) achunkalloc (ap, &ap->a_slabp, &ap->a_slabn, n);
+    }
+  else if (kind == LFBUMP && n <= ACHUNK / 16)
+    lp = (LINE *) achunkalloc (ap, &ap->a_bumpp, &ap->a_bumpn, n);
+  else
+    {
+      kind = LFBIG;
+      n += ABLOCKHDR_SIZE;
+      if ((blk = anewblock (ap, &ap->a_big, n)) == NULL)
+	lp = NULL;
+      else
+	{
+	  lp = (LINE *) ((char *) blk + ABLOCKHDR_SIZE);
+	  ap->a_nbig++;
+	}
+    }
+  if (lp == NULL)
     {
       eprintf ("Cannot allocate %d bytes", size);
       return (NULL);
     }
+  if (bp != NULL)
+    {
+      ap->a_live += n;
+      ap->a_nlines++;
+    }
   lp->l_size = size;
+  lp->l_flag = kind;
+  lp->l_blk = NULL;
+  lp->l_text = (uchar *) lp + LINEHDR_SIZE;
+  return (lp);
+}
+
+/*
+ * This routine allocates a line for buffer "bp"
+ * large enough to hold "used" characters. The size
+ * is always rounded up to a slab size class, to
+ * leave some room for type-in.  If "bp" is NULL, the
+ * line does not belong to any arena (this is used
+ * for buffer header lines).  Return a pointer
+ * to the new line, or NULL if there isn't
+ * any memory left. Print a message in the
+ * message line if no space.
+ */
+LINE *
+lalloc (BUFFER *bp, int used)
+{
+  LINE *lp;
+  int size;
+
+  if (used <= AMINTEXT << (ACLASSES - 1))
+    for (size = AMINTEXT; size < used; size <<= 1)
+      ;
+  else
+    size = (used + NBLOCK - 1) & ~(NBLOCK - 1);
+  if ((lp = anewline (bp, size, LFSLAB)) == NULL)
+    return (NULL);
   lp->l_used = used;
+  if (used == 0)
+    lp->l_flag |= LFASCII;
   return (lp);
 }
 
 /*
  * This routine is similar to lalloc, except
- * that it does not round up the allocation size.
+ * that it does not round up the allocation size,
+ * and packs the line into a bump chunk.
  * This is called by the file read functions,
  * and saves lots of memory reading in a new file.
  */
 LINE *
-lallocx (int used)
+lallocx (BUFFER *bp, int used)
 {
   LINE *lp;
 
-  if ((lp = (LINE *) malloc (LINEHDR_SIZE + used)) == NULL)
-    {
-      eprintf ("Cannot allocate %d bytes", used);
-      return (NULL);
-    }
+  if ((lp = anewline (bp, used, LFBUMP)) == NULL)
+    return (NULL);
+  lp->l_used = used;
+  if (used == 0)
+    lp->l_flag |= LFASCII;
+  return (lp);
+}
+
+/*
+ * Allocate a line for buffer "bp" whose "used" bytes of text
+ * are at "text" in a file image that was passed to limage.
+ * Only the line header is allocated.  The line gets
+ * the LFPIECE flag, which tells the line editing functions
+ * that the text isn't in the arena (see LINEHDR_SIZE in def.h).
+ */
+LINE *
+lallocp (BUFFER *bp, uchar *text, int used)
+{
+  LINE *lp;
+
+  if ((lp = anewline (bp, 0, LFBUMP)) == NULL)
+    return (NULL);
+  lp->l_text = text;
   lp->l_size = lp->l_used = used;
+  lp->l_flag |= LFPIECE;
+  if (uisascii (text, used))
+    lp->l_flag |= LFASCII;
   return (lp);
 }
 
+/*
+ * Give the file image "image" of "size" bytes, obtained
+ * from ffgetimage, to the arena for buffer "bp".  It is
+ * freed with fffreeimage when the arena is freed.
+ * Return FALSE if there isn't enough memory.
+ */
+int
+limage (BUFFER *bp, uchar *image, long size)
+{
+  ARENA *ap;
+  AIMAGE *ip;
+
+  if ((ap = agetarena (bp)) == NULL
+      || (ip = (AIMAGE *) malloc (sizeof (AIMAGE))) == NULL)
+    {
+      eprintf ("Cannot allocate %d bytes", (int) sizeof (AIMAGE));
+      return (FALSE);
+    }
+  ip->i_buf = image;
+  ip->i_size = size;
+  ip->i_next = ap->a_images;
+  ap->a_images = ip;
+  ap->a_image += size;
+  return (TRUE);
+}
+
+/*
+ * Release the memory used by line "lp",
+ * which belongs to buffer "bp", including its
+ * checkpoint cache.  The caller must have
+ * unlinked the line already.  If the line is
+ * in the occur list, its entry is cleared.
+ */
+void
+lrelease (BUFFER *bp, LINE *lp)
+{
+  ARENA *ap = bp != NULL ? bp->b_arena : NULL;
+  ABLOCK *blk;
+  size_t n;
+  int c;
+
+  if (lp->l_flag & LFOCCUR)
+    occurmove (lp, NULL);
+  free (lcunlink (lp));
+  n = AALIGN (LINEHDR_SIZE + ((lp->l_flag & LFPIECE) ? 0 : lp->l_size));
+  switch (lp->l_flag & (LFSLAB | LFBUMP | LFBIG))
+    {
+    case LFSLAB:
+      for (c = 0; (AMINTEXT << c) < lp->l_size; c++)
+	;
+      lp->l_fp = ap->a_free[c];
+      ap->a_free[c] = lp;
+      ap->a_freed += n;
+      break;
+    case LFBUMP:
+      ap->a_lost += n;
+      break;
+    case LFBIG:
+      blk = (ABLOCK *) ((char *) lp - ABLOCKHDR_SIZE);
+      if (blk->a_prev != NULL)
+	blk->a_prev->a_next = blk->a_next;
+      else
+	ap->a_big = blk->a_next;
+      if (blk->a_next != NULL)
+	blk->a_next->a_prev = blk->a_prev;
+      ap->a_total -= blk->a_size;
+      ap->a_nbig--;
+      n += ABLOCKHDR_SIZE;
+      free ((char *) blk);
+      break;
+    default:			/* Not in an arena		*/
+      free ((char *) lp);
+      return;
+    }
+  ap->a_live -= n;
+  ap->a_nlines--;
+}
+
+/*
+ * Release all of the lines in buffer "bp" in
+ * one step, by freeing the chunks of its arena.
+ * Only the checkpoint caches have to be looked
+ * for line by line, and that only happens if
+ * there are any caches at all.  The caller
+ * must reinitialize the line list.
+ */
+void
+lfreeall (BUFFER *bp)
+{
+  ARENA *ap;
+  ABLOCK *blk, *next;
+  AIMAGE *ip, *inext;
+  LINE *lp;
+
+  lidxfree (bp);
+  occurclear (bp);
+  if ((ap = bp->b_arena) == NULL)
+    return;
+  if (ncaches != 0)
+    for (lp = firstline (bp); lp != bp->b_linep; lp = lforw (lp))
+      if ((lp->l_flag & LFCACHE) != 0)
+	free (lcunlink (lp));
+  for (blk = ap->a_chunks; blk != NULL; blk = next)
+    {
+      next = blk->a_next;
+      free ((char *) blk);
+    }
+  for (blk = ap->a_big; blk != NULL; blk = next)
+    {
+      next = blk->a_next;
+      free ((char *) blk);
+    }
+  for (ip = ap->a_images; ip != NULL; ip = inext)
+    {
+      inext = ip->i_next;
+      fffreeimage (ip->i_buf, ip->i_size);
+      free ((char *) ip);
+    }
+  free ((char *) ap);
+  bp->b_arena = NULL;
+}
+
+/*
+ * Format a byte count compactly for listarenas.
+ */
+static void
+asize (char *buf, size_t n)
+{
+  if (n < 10 * 1024)
+    sprintf (buf, "%luB", (unsigned long) n);
+  else if (n < 10 * 1024 * 1024)
+    sprintf (buf, "%luK", (unsigned long) (n >> 10));
+  else
+    sprintf (buf, "%luM", (unsigned long) (n >> 20));
+}
+
+/*
+ * Pop up a window showing the line storage
+ * used by each buffer: the number of lines, chunks,
+ * and separately allocated large lines, the bytes
+ * allocated, the bytes in lines that are in use, the
+ * bytes waiting on slab free lists, the bytes lost
+ * in bump chunks, the fragmentation, which is the
+ * percentage of allocated bytes not in use by lines,
+ * and the size of the file images.
+ */
+int
+listarenas (int f, int n, int k)
+{
+  BUFFER *bp;
+  ARENA *ap;
+  int s;
+  char total[16], live[16], freed[16], lost[16], image[16];
+  char line[128 + NBUFN];
+
+  blistp->b_flag &= ~BFCHG;	/* Blow away old.       */
+  if ((s = bclear (blistp)) != TRUE)
+    return (s);
+  strcpy (blistp->b_fname, "");
+  if (addline ("    Lines Chunks  Big  Total   Live   Free   Lost Frag  Image Buffer") == FALSE)
+    return FALSE;
+  if (addline ("    ----- ------  ---  -----   ----   ----   ---- ----  ----- ------") == FALSE)
+    return FALSE;
+  ALLBUF (bp)
+  {
+    if ((ap = bp->b_arena) == NULL)
+      continue;
+    asize (total, ap->a_total);
+    asize (live, ap->a_live);
+    asize (freed, ap->a_freed);
+    asize (lost, ap->a_lost);
+    asize (image, ap->a_image);
+    snprintf (line, sizeof (line), "%9ld %6ld %4ld %6s %6s %6s %6s %3d%% %6s %s",
+	      ap->a_nlines, ap->a_nchunks, ap->a_nbig,
+	      total, live, freed, lost,
+	      ap->a_total == 0 ? 0 :
+	      (int) ((ap->a_total - ap->a_live) * 100 / ap->a_total),
+	      image, bp->b_bname);
+    if (addline (line) == FALSE)
+      return FALSE;
+  }
+  return (popblist ());
+}
+
+/*
+ * Look at the text of line "lp" after it has been
+ * stored wholesale (by lputs), and set the LFASCII
+ * flag accordingly.  Any old checkpoints are discarded.
+ */
+void
+lscan (LINE *lp)
+{
+  if (uisascii (lp->l_text, lp->l_used))
+    lp->l_flag |= LFASCII;
+  else
+    lp->l_flag &= ~LFASCII;
+  free (lcunlink (lp));
+}
+
+/*
+ * The text of line "lp" has been changed at byte
+ * offset "offset" and beyond.  The character count
+ * is no longer known, and checkpoints past the
+ * offset are no longer valid, but the ones before
+ * (or at) the offset are still good.
+ */
+static void
+linval (LINE *lp, int offset)
+{
+  LCACHE *cp = lcfind (lp);
+
+  if (cp == NULL)
+    return;
+  cp->c_nchars = -1;
+  while (cp->c_n > 1 && cp->c_pt[cp->c_n - 1].p_off > offset)
+    cp->c_n--;
+  if (cp->c_ncols > cp->c_n)
+    cp->c_ncols = cp->c_n;
+}
+
+/*
+ * Note that "bytes" bytes of text from "s" were
+ * inserted into line "lp" at byte offset "offset".
+ * The line stays pure ASCII only if the new text is.
+ */
+static void
+linserted (LINE *lp, int offset, const uchar *s, int bytes)
+{
+  if ((lp->l_flag & LFASCII) != 0 && !uisascii (s, bytes))
+    lp->l_flag &= ~LFASCII;
+  linval (lp, offset);
+}
+
+/*
+ * Return the checkpoint cache for line "lp",
+ * allocating it if necessary.  Return NULL if
+ * the line is too short to bother with, or
+ * if there isn't enough memory; the caller then
+ * has to scan the line from the start.
+ */
+static LCACHE *
+lgetcache (LINE *lp)
+{
+  LCACHE *cp, *ncp;
+  int max;
+
+  if (lp->l_used < LCMIN)
+    return NULL;
+  max = lp->l_used / LCSTEP + 1;
+  cp = lcfind (lp);
+  if (cp != NULL && cp->c_max >= max)
+    return cp;
+  max += max / 2;
+  lcunlink (lp);
+  ncp = (LCACHE *) realloc (cp, sizeof (LCACHE) + max * sizeof (LCPOINT));
+  if (ncp == NULL)
+    {				/* Keep old, smaller cache	*/
+      if (cp != NULL)
+	lclink (lp, cp);
+      return cp;
+    }
+  if (cp == NULL)
+    {
+      ncp->c_nchars = -1;
+      ncp->c_n = 1;
+      ncp->c_ncols = 1;
+      ncp->c_tabsize = tabsize;
+      ncp->c_pt[0].p_off = 0;
+      ncp->c_pt[0].p_col = 0;
+      ncp->c_pt[0].p_width = 0;
+    }
+  cp = ncp;
+  cp->c_max = max;
+  if (lclink (lp, cp) == FALSE)
+    {
+      free (cp);
+      return NULL;
+    }
+  return cp;
+}
+
+/*
+ * Add checkpoints to the cache "cp" for line "lp"
+ * until there are enough to cover character index
+ * k * LCSTEP, or the end of the line is reached.
+ * Return the index of the checkpoint nearest to
+ * (but not after) character k * LCSTEP.
+ */
+static int
+lextend (LINE *lp, LCACHE *cp, int k)
+{
+  const uchar *s, *end;
+  int i;
+
+  if (k < cp->c_n)
+    return k;
+  s = lp->l_text + cp->c_pt[cp->c_n - 1].p_off;
+  end = lp->l_text + lp->l_used;
+  while (cp->c_n <= k && cp->c_n < cp->c_max)
+    {
+      for (i = 0; i < LCSTEP && s < end; i++)
+	s += uclen (s);
+      if (i < LCSTEP)
+	break;			/* Hit end of line		*/
+      cp->c_pt[cp->c_n++].p_off = s - lp->l_text;
+    }
+  return k < cp->c_n ? k : cp->c_n - 1;
+}
+
+/*
+ * Return the byte offset of the nth UTF-8
+ * character in line "lp".  This is normally
+ * called via the wloffset macro, which handles
+ * pure ASCII lines itself.  On long lines, start
+ * from the nearest checkpoint, so that at most
+ * LCSTEP characters have to be decoded.
+ */
+int
+loffset (LINE *lp, int n)
+{
+  LCACHE *cp;
+  int k;
+
+  if ((lp->l_flag & LFASCII) != 0)
+    return n;
+  if ((cp = lgetcache (lp)) == NULL)
+    return uoffset (lp->l_text, n);
+  k = lextend (lp, cp, n / LCSTEP);
+  return cp->c_pt[k].p_off + uoffset (lp->l_text + cp->c_pt[k].p_off,
+				     n - k * LCSTEP);
+}
+
+/*
+ * Return the number of UTF-8 characters in line "lp".
+ * This is normally called via the wllength macro,
+ * which handles pure ASCII lines itself.  On long
+ * lines the count is remembered until the next edit.
+ */
+int
+lnchars (LINE *lp)
+{
+  LCACHE *cp;
+  int k;
+
+  if ((lp->l_flag & LFASCII) != 0)
+    return lp->l_used;
+  if ((cp = lgetcache (lp)) == NULL)
+    return unslen (lp->l_text, lp->l_used);
+  if (cp->c_nchars < 0)
+    {
+      k = lextend (lp, cp, lp->l_used / LCSTEP);
+      cp->c_nchars = k * LCSTEP + unslen (lp->l_text + cp->c_pt[k].p_off,
+					  lp->l_used - cp->c_pt[k].p_off);
+    }
+  return cp->c_nchars;
+}
+
+/*
+ * Advance the columns *col and *width past the character c.
+ * Both put a tab at the next tab stop, and count a control
+ * character as two columns, for the ^X it is shown as.  *col
+ * counts any other character as one column, like the virtual
+ * screen does; *width counts it as wide as the terminal
+ * shows it, which is where the cursor goes.
+ */
+static void
+lcolstep (wchar_t c, int *col, int *width)
+{
+  if (c == '\t')
+    {
+      *col += tabsize - *col % tabsize;
+      *width += tabsize - *width % tabsize;
+    }
+  else if (c < 0x80)
+    {
+      if (CISCTRL (c) != FALSE)
+	{
+	  *col += 2;
+	  *width += 2;
+	}
+      else
+	{
+	  *col += 1;
+	  *width += 1;
+	}
+    }
+  else
+    {
+      *col += 1;
+      *width += uwidth (c);
+    }
+}
+
+/*
+ * Add checkpoint columns to the cache "cp" for line "lp"
+ * until there are enough to cover character index
+ * k * LCSTEP, or the end of the line is reached, adding
+ * checkpoint offsets along the way.  Return the index of
+ * the checkpoint nearest to (but not after) character
+ * k * LCSTEP.
+ */
+static int
+lextendcols (LINE *lp, LCACHE *cp, int k)
+{
+  const uchar *s, *end;
+  LCPOINT *pp;
+  int i, col, width, len;
+
+  if (cp->c_tabsize != tabsize)
+    {
+      cp->c_tabsize = tabsize;
+      cp->c_ncols = 1;
+    }
+  end = lp->l_text + lp->l_used;
+  while (cp->c_ncols <= k && cp->c_ncols < cp->c_max)
+    {
+      pp = &cp->c_pt[cp->c_ncols - 1];
+      s = lp->l_text + pp->p_off;
+      col = pp->p_col;
+      width = pp->p_width;
+      for (i = 0; i < LCSTEP && s < end; i++)
+	{
+	  lcolstep (ugetc (s, 0, &len), &col, &width);
+	  s += len;
+	}
+      if (i < LCSTEP)
+	break;			/* Hit end of line		*/
+      pp[1].p_off = s - lp->l_text;
+      pp[1].p_col = col;
+      pp[1].p_width = width;
+      if (cp->c_n == cp->c_ncols)
+	cp->c_n++;
+      cp->c_ncols++;
+    }
+  return k < cp->c_ncols ? k : cp->c_ncols - 1;
+}
+
+/*
+ * Find the columns at which the nth character of
+ * line "lp" starts.  On long lines, start from the
+ * nearest checkpoint.
+ */
+static void
+lcolumns (LINE *lp, int n, int *col, int *width)
+{
+  LCACHE *cp;
+  const uchar *s, *end;
+  int k, len;
+
+  if ((cp = lgetcache (lp)) == NULL)
+    {
+      k = 0;
+      s = lp->l_text;
+      *col = *width = 0;
+    }
+  else
+    {
+      k = lextendcols (lp, cp, n / LCSTEP);
+      s = lp->l_text + cp->c_pt[k].p_off;
+      *col = cp->c_pt[k].p_col;
+      *width = cp->c_pt[k].p_width;
+    }
+  end = lp->l_text + lp->l_used;
+  for (n -= k * LCSTEP; n > 0 && s < end; n--)
+    {
+      lcolstep (ugetc (s, 0, &len), col, width);
+      s += len;
+    }
+}
+
+/*
+ * Return the column at which the nth character
+ * of line "lp" starts, counting each character
+ * other than tabs and controls as one column.
+ */
+int
+lcolumn (LINE *lp, int n)
+{
+  int col, width;
+
+  lcolumns (lp, n, &col, &width);
+  return col;
+}
+
+/*
+ * Return the column at which the nth character of
+ * line "lp" is shown on the terminal.
+ */
+int
+lwidth (LINE *lp, int n)
+{
+  int col, width;
+
+  lcolumns (lp, n, &col, &width);
+  return width;
+}
+
+/*
+ * Find the last checkpoint of line "lp" that starts
+ * at or before column "col", as counted by lcolumn.
+ * Store its byte offset in "*off" and its column in
+ * "*colp", and return its character index.  The caller
+ * can scan forward from there instead of from the start
+ * of the line.
+ */
+int
+lfindcol (LINE *lp, int col, int *off, int *colp)
+{
+  LCACHE *cp;
+  int n, lo, hi, mid;
+
+  if (col <= 0 || (cp = lgetcache (lp)) == NULL)
+    {
+      *off = *colp = 0;
+      return 0;
+    }
+  lextendcols (lp, cp, 0);
+  do				/* Add checkpoints up to col	*/
+    n = cp->c_ncols;
+  while (cp->c_pt[n - 1].p_col <= col && lextendcols (lp, cp, n) == n);
+  lo = 0;			/* Binary search for the last	*/
+  hi = cp->c_ncols - 1;		/*  checkpoint <= col		*/
+  while (lo < hi)
+    {
+      mid = (lo + hi + 1) / 2;
+      if (cp->c_pt[mid].p_col <= col)
+	lo = mid;
+      else
+	hi = mid - 1;
+    }
+  *off = cp->c_pt[lo].p_off;
+  *colp = cp->c_pt[lo].p_col;
+  return lo * LCSTEP;
+}
+
 /*
  * Delete line "lp". Fix all of the
  * links that might point at it (they are
@@ -246,12 +1148,14 @@ linsert (int n, int c, char *s)
   EWINDOW *wp;
   LINE *lp2;
   LINE *lp3;
+  LCACHE *cp;
   POS dot;
   int chars, bytes, offset, buflen;
   char buf[6];
 
   if (checkreadonly () == FALSE)
     return FALSE;
+  jouinsert (n, c, s);		/* Record in journal	*/
   lchange (WFEDIT);
   dot = curwp->w_dot;		/* Save current line.	*/
 
@@ -286,17 +1190,19 @@ linsert (int n, int c, char *s)
 	  eprintf ("bug: linsert");
 	  return (FALSE);
 	}
-      if ((lp2 = lalloc (bytes)) == NULL)	/* Allocate new line    */
+      if ((lp2 = lalloc (curbp, bytes)) == NULL)	/* Allocate new line    */
 	return (FALSE);
+      lp2->l_flag |= LFASCII;		/* Empty so far		*/
       lp3 = dot.p->l_bp;		/* Previous line        */
       lp3->l_fp = lp2;			/* Link in              */
       lp2->l_fp = dot.p;
       dot.p->l_bp = lp2;
       lp2->l_bp = lp3;
+      lidxinsert (curbp, lp2);
     }
   else if (dot.p->l_used + bytes > dot.p->l_size)
     {					/* Hard: reallocate     */
-      if ((lp2 = lalloc (dot.p->l_used + bytes)) == NULL)
+      if ((lp2 = lalloc (curbp, dot.p->l_used + bytes)) == NULL)
 	return (FALSE);
       memcpy (&lp2->l_text[0], &dot.p->l_text[0], offset);
       memcpy (&lp2->l_text[offset + bytes], &dot.p->l_text[offset],
@@ -305,7 +1211,13 @@ linsert (int n, int c, char *s)
       lp2->l_fp = dot.p->l_fp;
       dot.p->l_fp->l_bp = lp2;
       lp2->l_bp = dot.p->l_bp;
-      free ((char *) dot.p);
+      lp2->l_flag |= dot.p->l_flag & LFASCII;	/* Inherit flag and cache */
+      if ((cp = lcunlink (dot.p)) != NULL && lclink (lp2, cp) == FALSE)
+	free (cp);
+      lidxreplace (curbp, dot.p, lp2);
+      if (dot.p->l_flag & LFOCCUR)
+	occurmove (dot.p, lp2);
+      lrelease (curbp, dot.p);
     }
   else
     {				/* Easy: in place       */
@@ -324,6 +1236,7 @@ linsert (int n, int c, char *s)
     }
   else
     memcpy (&lp2->l_text[offset], s, bytes);	/* copy the characters  */
+  linserted (lp2, offset, &lp2->l_text[offset], bytes);
 
   ALLWIND (wp)
   {				/* Update windows       */
@@ -428,6 +1341,7 @@ lnewline (void)
 
   if (checkreadonly () == FALSE)
     return FALSE;
+  jounewline ();		/* Record in journal	*/
   lchange (WFHARD);
   lp1 = curwp->w_dot.p;			/* Get the address and  */
   doto = curwp->w_dot.o;		/* offset of "."        */
@@ -436,17 +1350,25 @@ lnewline (void)
   /* Save undo information. */
   saveundo (UINSERT, NULL, 1, 1, 1, "\n");
 
-  if ((lp2 = lalloc (offset)) == NULL)	/* New first half line  */
+  if ((lp2 = lalloc (curbp, offset)) == NULL)	/* New first half line  */
     return (FALSE);
   memcpy (&lp2->l_text[0], &lp1->l_text[0], offset);	/* shuffle text */
-  if (offset != 0) {
+  if ((lp1->l_flag & LFPIECE) != 0)
+    {				/* Just skip the first half */
+      lp1->l_text += offset;
+      lp1->l_size -= offset;
+    }
+  else if (offset != 0) {
     memmove (&lp1->l_text[0], &lp1->l_text[offset], lp1->l_used - offset);
   }
   lp1->l_used -= offset;
+  lp2->l_flag |= lp1->l_flag & LFASCII;	/* Both halves inherit flag */
+  linval (lp1, 0);
   lp2->l_bp = lp1->l_bp;
   lp1->l_bp = lp2;
   lp2->l_bp->l_fp = lp2;
   lp2->l_fp = lp1;
+  lidxinsert (curbp, lp2);
 
   ALLWIND (wp)
   {				/* Update windows       */
@@ -491,7 +1413,6 @@ adjustfordelete (POS *oldpos, int nchars, EWINDOW *wp)
     }
 }
 
-
 /*
  * This function deletes "n" characters,
  * starting at dot. Because lines are stored as UTF-8
@@ -509,7 +1430,7 @@ ldelete (int n, int kflag)
 {
   uchar *cp1, *cp2, *end;
   POS dot;
-  int bytes, chars;
+  int bytes, chars, offset;
   EWINDOW *wp;
 
   if (n < 0)
@@ -519,6 +1440,7 @@ ldelete (int n, int kflag)
     }
   if (checkreadonly () == FALSE)
     return FALSE;
+  joudelete (n);		/* Record in journal	*/
   while (n != 0)
     {
       dot = curwp->w_dot;
@@ -550,12 +1472,20 @@ ldelete (int n, int kflag)
 	}
       lchange (WFEDIT);
       cp2 = cp1 + bytes;			/* Scrunch text.        */
+      offset = cp1 - dot.p->l_text;
       if (kflag != FALSE)	/* Kill?                */
 	if (kinsert ((const char *) cp1, bytes) == FALSE)
 	  return (FALSE);
       saveundo(UDELETE, NULL, chars, bytes, cp1);
-      memmove (cp1, cp2, end - cp2);
+      if ((dot.p->l_flag & LFPIECE) != 0 && offset == 0)
+	{			/* Just skip the head	*/
+	  dot.p->l_text += bytes;
+	  dot.p->l_size -= bytes;
+	}
+      else
+	memmove (cp1, cp2, end - cp2);
       dot.p->l_used -= bytes;
+      linval (dot.p, offset);
       ALLWIND (wp)
       {				/* Fix windows          */
 	adjustfordelete (&dot, chars, wp);
@@ -637,16 +1567,27 @@ ldelnewline (void)
 	    wp->w_mark.o += chars;
 	  }
       }
+      linserted (lp1, lp1->l_used, lp2->l_text, lp2->l_used);
       lp1->l_used += lp2->l_used;
+      lidxdelete (curbp, lp2);
+      if (lp2->l_flag & LFOCCUR)
+	occurmove (lp2, lp1);
       lp1->l_fp = lp2->l_fp;
       lp2->l_fp->l_bp = lp1;
-      free ((char *) lp2);
+      lrelease (curbp, lp2);
       return (TRUE);
     }
-  if ((lp3 = lalloc (lp1->l_used + lp2->l_used)) == NULL)
+  if ((lp3 = lalloc (curbp, lp1->l_used + lp2->l_used)) == NULL)
     return (FALSE);
   memcpy (&lp3->l_text[0], &lp1->l_text[0], lp1->l_used);
   memcpy (&lp3->l_text[lp1->l_used], &lp2->l_text[0], lp2->l_used);
+  lp3->l_flag |= lp1->l_flag & lp2->l_flag & LFASCII;
+  lidxdelete (curbp, lp2);
+  lidxreplace (curbp, lp1, lp3);
+  if (lp1->l_flag & LFOCCUR)
+    occurmove (lp1, lp3);
+  if (lp2->l_flag & LFOCCUR)
+    occurmove (lp2, lp3);
   lp1->l_bp->l_fp = lp3;
   lp3->l_fp = lp2->l_fp;
   lp2->l_fp->l_bp = lp3;
@@ -659,8 +1600,8 @@ ldelnewline (void)
       wp->w_savep = lp3;
     adjustfordelnewline(lp1, lp2, lp3, wp);
   }
-  free ((char *) lp1);
-  free ((char *) lp2);
+  lrelease (curbp, lp1);
+  lrelease (curbp, lp2);
   return (TRUE);
 }
 
@@ -697,6 +1638,75 @@ lputc (POS pos, wchar_t c)
   saveundo (UMOVE, &curwp->w_dot);
 }
 
+/*
+ * Find the capitalization of the found string that starts
+ * at offset o in line lp.  f says use exact case of replacement
+ * string (same thing that happens with lowercase found), so
+ * bypass check.  Return LOWER, UPPER, or UPPER | LOWER
+ * (capitalize only the first character).
+ */
+static int
+replcase (LINE *lp, int o, int f)
+{
+  int rtype;
+  int c;
+
+  if (casefold == FALSE)	/* is case folding turned off?  */
+    f = TRUE;			/* disable case hack            */
+  rtype = LOWER;
+  c = wlgetc (lp, o);
+  if (CISUPPER (c) != FALSE && f == FALSE)
+    {
+      rtype = UPPER | LOWER;
+      if (o + 1 < wllength (lp))
+	{
+	  c = wlgetc (lp, o + 1);
+	  if (CISUPPER (c) != FALSE)
+	    {
+	      rtype = UPPER;
+	    }
+	}
+    }
+  return (rtype);
+}
+
+/*
+ * Copy the replacement string st to buf, with the case
+ * changes that lreplace would make to it when replacing the
+ * found string at offset o in line lp.  The case changes
+ * can make a UTF-8 character longer, so buf must have room
+ * for 2 * strlen (st) bytes.  Return the number of bytes
+ * stored in buf.
+ */
+int
+lrepltext (uchar *buf, const char *st, LINE *lp, int o, int f)
+{
+  int rtype;
+  int c;
+  int clen;
+  const char *end;
+  uchar *s;
+
+  rtype = replcase (lp, o, f);
+  s = buf;
+  end = st + strlen (st);
+  while (st < end)
+    {
+      c = ugetc ((const uchar *) st, 0, &clen);
+      if ((rtype & UPPER) != 0 && CISLOWER (c) != 0)
+	s += uputc (CTOUPPER (c), s);
+      else
+	{
+	  memcpy (s, st, clen);
+	  s += clen;
+	}
+      st += clen;
+      if (rtype == (UPPER | LOWER))
+	rtype = LOWER;
+    }
+  return (s - buf);
+}
+
 /*
  * Replace plen characters before dot with argument string.
  * Control-J characters in st are interpreted as newlines.
@@ -718,29 +1728,12 @@ lreplace (
 
   if (checkreadonly () == FALSE)
     return FALSE;
-  if (casefold == FALSE)	/* is case folding turned off?  */
-    f = TRUE;			/* disable case hack            */
 
   /*
    * Find the capitalization of the word that was found.
-   * f says use exact case of replacement string (same thing that
-   * happens with lowercase found), so bypass check.
    */
   backchar (TRUE, plen, KRANDOM);
-  rtype = LOWER;
-  c = wlgetc (curwp->w_dot.p, curwp->w_dot.o);
-  if (CISUPPER (c) != FALSE && f == FALSE)
-    {
-      rtype = UPPER | LOWER;
-      if (curwp->w_dot.o + 1 < wllength (curwp->w_dot.p))
-	{
-	  c = wlgetc (curwp->w_dot.p, curwp->w_dot.o + 1);
-	  if (CISUPPER (c) != FALSE)
-	    {
-	      rtype = UPPER;
-	    }
-	}
-    }
+  rtype = replcase (curwp->w_dot.p, curwp->w_dot.o, f);
 
   /*
    * make the string lengths match (either pad the line
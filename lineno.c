@@ -0,0 +1,549 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Name:	MicroEMACS
+ *		Line number index
+ * By:		Mark Alexander
+ *		marka@pobox.com
+ *
+ * The functions in this file convert between line pointers
+ * and line numbers without walking the entire buffer.
+ *
+ * The lines of a buffer are divided into blocks of consecutive
+ * lines, and each line points to its block.  The blocks are kept
+ * in buffer order in a treap (a binary search tree whose nodes
+ * also have random priorities, which keeps it balanced), and each
+ * block holds the number of lines in its subtree.  The tree
+ * gives the number of lines before any block, or the block
+ * containing any line number, in O(log n) time; then at
+ * most LBMAX lines within the block have to be walked.  Adding
+ * a line to a block, splitting a block, and removing a block
+ * also take O(log n) time.
+ *
+ * The index for a buffer is built the first time a line number
+ * is needed, and is kept up to date by the line insertion and
+ * deletion functions in line.c and file.c, which call lidxinsert,
+ * lidxdelete, and lidxreplace.  If memory runs out, the index is
+ * simply discarded, and line numbers are computed the slow way
+ * until it can be built again.
+ */
+#include	"def.h"
+
+#define	LBMAX	128		/* Split blocks larger than this */
+#define	LBMIN	16		/* Try to merge smaller blocks	*/
+
+typedef struct LBLOCK
+{
+  LINE *k_first;		/* First line in block		*/
+  int k_nlines;			/* # of lines in block		*/
+  int k_sum;			/* # of lines in subtree	*/
+  unsigned int k_prio;		/* Priority, smallest at root	*/
+  struct LBLOCK *k_left;	/* Blocks before this one	*/
+  struct LBLOCK *k_right;	/* Blocks after this one	*/
+  struct LBLOCK *k_parent;	/* Parent in tree, or NULL	*/
+}
+LBLOCK;
+
+typedef struct LINDEX
+{
+  LBLOCK *x_root;		/* Root of tree of blocks	*/
+  int x_nlines;			/* Total # of lines		*/
+  unsigned int x_seed;		/* Random number seed		*/
+}
+LINDEX;
+
+#define	KSUM(kp)	((kp) == NULL ? 0 : (kp)->k_sum)
+
+/*
+ * Free the blocks in the subtree kp.
+ */
+static void
+lidxfreetree (LBLOCK *kp)
+{
+  LBLOCK *right;
+
+  while (kp != NULL)
+    {
+      lidxfreetree (kp->k_left);
+      right = kp->k_right;
+      free (kp);
+      kp = right;
+    }
+}
+
+/*
+ * Free the line number index for buffer bp, if any.
+ * The l_blk pointers in the lines are left dangling;
+ * they are not looked at again until the index is rebuilt.
+ */
+void
+lidxfree (BUFFER *bp)
+{
+  LINDEX *xp;
+
+  if ((xp = bp->b_index) == NULL)
+    return;
+  lidxfreetree (xp->x_root);
+  free (xp);
+  bp->b_index = NULL;
+}
+
+/*
+ * Allocate a block with no lines and a random priority.
+ * Return NULL if there isn't enough memory.
+ */
+static LBLOCK *
+lidxnewblock (LINDEX *xp, LINE *lp)
+{
+  LBLOCK *kp;
+
+  if ((kp = (LBLOCK *) malloc (sizeof (LBLOCK))) == NULL)
+    return NULL;
+  xp->x_seed = xp->x_seed * 1103515245 + 12345;
+  kp->k_first = lp;
+  kp->k_nlines = kp->k_sum = 0;
+  kp->k_prio = xp->x_seed >> 8;
+  kp->k_left = kp->k_right = kp->k_parent = NULL;
+  return kp;
+}
+
+/*
+ * Recompute the line counts of the subtrees from
+ * kp up to the root.
+ */
+static void
+lidxfixup (LBLOCK *kp)
+{
+  for (; kp != NULL; kp = kp->k_parent)
+    kp->k_sum = kp->k_nlines + KSUM (kp->k_left) + KSUM (kp->k_right);
+}
+
+/*
+ * Rotate block kp up above its parent, keeping the
+ * blocks in the same order.
+ */
+static void
+lidxrotate (LINDEX *xp, LBLOCK *kp)
+{
+  LBLOCK *pp = kp->k_parent;
+  LBLOCK *gp = pp->k_parent;
+
+  if (pp->k_left == kp)
+    {
+      if ((pp->k_left = kp->k_right) != NULL)
+	pp->k_left->k_parent = pp;
+      kp->k_right = pp;
+    }
+  else
+    {
+      if ((pp->k_right = kp->k_left) != NULL)
+	pp->k_right->k_parent = pp;
+      kp->k_left = pp;
+    }
+  pp->k_parent = kp;
+  kp->k_parent = gp;
+  if (gp == NULL)
+    xp->x_root = kp;
+  else if (gp->k_left == pp)
+    gp->k_left = kp;
+  else
+    gp->k_right = kp;
+  pp->k_sum = pp->k_nlines + KSUM (pp->k_left) + KSUM (pp->k_right);
+  kp->k_sum = kp->k_nlines + KSUM (kp->k_left) + KSUM (kp->k_right);
+}
+
+/*
+ * Insert block np into the index just after block kp,
+ * or as the only block if kp is NULL.
+ */
+static void
+lidxaddblock (LINDEX *xp, LBLOCK *np, LBLOCK *kp)
+{
+  LBLOCK *pp;
+
+  np->k_sum = np->k_nlines;
+  if (kp == NULL)
+    {
+      xp->x_root = np;
+      return;
+    }
+  if (kp->k_right == NULL)
+    {
+      kp->k_right = np;
+      np->k_parent = kp;
+    }
+  else
+    {
+      for (pp = kp->k_right; pp->k_left != NULL; pp = pp->k_left)
+	;
+      pp->k_left = np;
+      np->k_parent = pp;
+    }
+  lidxfixup (np->k_parent);
+  while (np->k_parent != NULL && np->k_parent->k_prio > np->k_prio)
+    lidxrotate (xp, np);
+}
+
+/*
+ * Remove block kp from the index and free it.
+ */
+static void
+lidxdelblock (LINDEX *xp, LBLOCK *kp)
+{
+  LBLOCK *cp, *pp;
+
+  while (kp->k_left != NULL && kp->k_right != NULL)
+    {
+      if (kp->k_left->k_prio < kp->k_right->k_prio)
+	lidxrotate (xp, kp->k_left);
+      else
+	lidxrotate (xp, kp->k_right);
+    }
+  cp = kp->k_left != NULL ? kp->k_left : kp->k_right;
+  pp = kp->k_parent;
+  if (cp != NULL)
+    cp->k_parent = pp;
+  if (pp == NULL)
+    xp->x_root = cp;
+  else if (pp->k_left == kp)
+    pp->k_left = cp;
+  else
+    pp->k_right = cp;
+  lidxfixup (pp);
+  free (kp);
+}
+
+/*
+ * Return the block after block kp, or NULL if
+ * kp is the last block.
+ */
+static LBLOCK *
+lidxnext (LBLOCK *kp)
+{
+  if (kp->k_right != NULL)
+    {
+      for (kp = kp->k_right; kp->k_left != NULL; kp = kp->k_left)
+	;
+      return kp;
+    }
+  while (kp->k_parent != NULL && kp->k_parent->k_right == kp)
+    kp = kp->k_parent;
+  return kp->k_parent;
+}
+
+/*
+ * Add d to the line count of block kp.
+ */
+static void
+lidxadd (LINDEX *xp, LBLOCK *kp, int d)
+{
+  kp->k_nlines += d;
+  xp->x_nlines += d;
+  for (; kp != NULL; kp = kp->k_parent)
+    kp->k_sum += d;
+}
+
+/*
+ * Return the number of lines in the blocks
+ * before block kp.
+ */
+static int
+lidxprefix (LBLOCK *kp)
+{
+  int n;
+
+  n = KSUM (kp->k_left);
+  for (; kp->k_parent != NULL; kp = kp->k_parent)
+    if (kp->k_parent->k_right == kp)
+      n += KSUM (kp->k_parent->k_left) + kp->k_parent->k_nlines;
+  return n;
+}
+
+/*
+ * Compute the line counts of all of the subtrees
+ * in the subtree kp, and return the count for kp.
+ */
+static int
+lidxsum (LBLOCK *kp)
+{
+  if (kp == NULL)
+    return 0;
+  kp->k_sum = kp->k_nlines + lidxsum (kp->k_left) + lidxsum (kp->k_right);
+  return kp->k_sum;
+}
+
+/*
+ * Build the line number index for buffer bp.
+ * Return the index, or NULL if there isn't enough memory.
+ * The blocks are added at the right end of the tree, so
+ * the tree can be built in O(n) time by keeping track of
+ * the path from the root to the last block.
+ */
+static LINDEX *
+lidxbuild (BUFFER *bp)
+{
+  LINDEX *xp;
+  LBLOCK *kp, *pp, *cp;
+  LINE *lp;
+
+  if ((xp = bp->b_index) != NULL)
+    return xp;
+  if ((xp = (LINDEX *) malloc (sizeof (LINDEX))) == NULL)
+    return NULL;
+  memset (xp, 0, sizeof (LINDEX));
+  xp->x_seed = 1;
+  bp->b_index = xp;
+  kp = NULL;
+  for (lp = firstline (bp); lp != bp->b_linep; lp = lforw (lp))
+    {
+      if (kp == NULL || kp->k_nlines == LBMAX / 2)
+	{
+	  if ((cp = lidxnewblock (xp, lp)) == NULL)
+	    {
+	      lidxfree (bp);
+	      return NULL;
+	    }
+
+	  /* Climb the right edge of the tree to the first
+	   * block with a smaller priority, and put the new
+	   * block below it, with the blocks climbed past
+	   * as its left subtree.
+	   */
+	  for (pp = NULL; kp != NULL && kp->k_prio > cp->k_prio;
+	       kp = kp->k_parent)
+	    pp = kp;
+	  if ((cp->k_left = pp) != NULL)
+	    pp->k_parent = cp;
+	  if ((cp->k_parent = kp) != NULL)
+	    kp->k_right = cp;
+	  else
+	    xp->x_root = cp;
+	  kp = cp;
+	}
+      lp->l_blk = kp;
+      kp->k_nlines++;
+      xp->x_nlines++;
+    }
+  lidxsum (xp->x_root);
+  return xp;
+}
+
+/*
+ * Split block kp into two halves.
+ * Return FALSE if there isn't enough memory.
+ */
+static int
+lidxsplit (LINDEX *xp, LBLOCK *kp)
+{
+  LBLOCK *np;
+  LINE *lp;
+  int i, half;
+
+  half = kp->k_nlines / 2;
+  for (lp = kp->k_first, i = 0; i < half; i++)
+    lp = lforw (lp);
+  if ((np = lidxnewblock (xp, lp)) == NULL)
+    return FALSE;
+  np->k_nlines = kp->k_nlines - half;
+  kp->k_nlines = half;
+  for (i = 0; i < np->k_nlines; i++, lp = lforw (lp))
+    lp->l_blk = np;
+  lidxaddblock (xp, np, kp);
+  return TRUE;
+}
+
+/*
+ * Line lp has just been linked into buffer bp.
+ * Add it to the block of the line before it,
+ * or the line after it if it is the first line.
+ */
+void
+lidxinsert (BUFFER *bp, LINE *lp)
+{
+  LINDEX *xp;
+  LBLOCK *kp;
+  LINE *prev, *next;
+
+  lp->l_blk = NULL;
+  if ((xp = bp->b_index) == NULL)
+    return;
+  prev = lback (lp);
+  next = lforw (lp);
+  if (prev != bp->b_linep)
+    kp = prev->l_blk;
+  else if (next != bp->b_linep)
+    {
+      kp = next->l_blk;
+      kp->k_first = lp;
+    }
+  else
+    {
+      /* First line in an empty buffer. */
+      if ((kp = lidxnewblock (xp, lp)) == NULL)
+	{
+	  lidxfree (bp);
+	  return;
+	}
+      lidxaddblock (xp, kp, NULL);
+    }
+  lp->l_blk = kp;
+  lidxadd (xp, kp, 1);
+  if (kp->k_nlines > LBMAX && lidxsplit (xp, kp) == FALSE)
+    lidxfree (bp);
+}
+
+/*
+ * Line lp in buffer bp is about to be unlinked.
+ * Remove it from its block.  Merge the block with
+ * the next one if both are small.
+ */
+void
+lidxdelete (BUFFER *bp, LINE *lp)
+{
+  LINDEX *xp;
+  LBLOCK *kp, *np;
+  LINE *clp;
+  int i;
+
+  if ((xp = bp->b_index) == NULL || (kp = lp->l_blk) == NULL)
+    return;
+  lp->l_blk = NULL;
+  if (kp->k_first == lp)
+    kp->k_first = lforw (lp);
+  lidxadd (xp, kp, -1);
+  if (kp->k_nlines == 0)
+    {
+      lidxdelblock (xp, kp);
+      return;
+    }
+  if (kp->k_nlines < LBMIN && (np = lidxnext (kp)) != NULL
+      && kp->k_nlines + np->k_nlines <= LBMAX)
+    {
+      for (clp = np->k_first, i = 0; i < np->k_nlines;
+	   i++, clp = lforw (clp))
+	clp->l_blk = kp;
+      kp->k_nlines += np->k_nlines;
+      lidxfixup (kp);
+      lidxdelblock (xp, np);
+    }
+}
+
+/*
+ * Line newlp has just replaced line oldlp in buffer bp.
+ */
+void
+lidxreplace (BUFFER *bp, LINE *oldlp, LINE *newlp)
+{
+  LBLOCK *kp;
+
+  newlp->l_blk = kp = oldlp->l_blk;
+  if (bp->b_index == NULL || kp == NULL)
+    return;
+  if (kp->k_first == oldlp)
+    kp->k_first = newlp;
+}
+
+/*
+ * Calculate the zero-based line number for a given line pointer
+ * and buffer.  If the line is the header line, return the
+ * number of the last line.
+ */
+int
+blineno (BUFFER *bp, const LINE *lp)
+{
+  LINDEX *xp;
+  LBLOCK *kp;
+  const LINE *clp;
+  int nline;
+
+  if ((xp = lidxbuild (bp)) == NULL)
+    {
+      /* No memory for an index: do it the slow way. */
+      clp = firstline (bp);
+      nline = 0;
+      while (clp != lastline (bp) && clp != lp)
+	{
+	  clp = lforw (clp);
+	  ++nline;
+	}
+      return nline;
+    }
+  if (lp == bp->b_linep || (kp = lp->l_blk) == NULL)
+    return xp->x_nlines > 0 ? xp->x_nlines - 1 : 0;
+  nline = lidxprefix (kp);
+  for (clp = kp->k_first; clp != lp; clp = lforw (clp))
+    ++nline;
+  return nline;
+}
+
+/*
+ * Calculate the zero-based line number for a given line pointer
+ * in the current buffer.
+ */
+int
+lineno (const LINE *lp)
+{
+  return blineno (curbp, lp);
+}
+
+/*
+ * Return a pointer to the line with zero-based line number n
+ * in buffer bp, or the header line if there aren't that many lines.
+ */
+LINE *
+blinep (BUFFER *bp, int n)
+{
+  LINDEX *xp;
+  LBLOCK *kp;
+  LINE *lp;
+  int i;
+
+  if (n < 0)
+    return bp->b_linep;
+  if ((xp = lidxbuild (bp)) == NULL)
+    {
+      for (lp = firstline (bp); n > 0 && lp != bp->b_linep; n--)
+	lp = lforw (lp);
+      return lp;
+    }
+  if (n >= xp->x_nlines)
+    return bp->b_linep;
+
+  /* Descend the tree to find the block containing line n,
+   * leaving n as the number of the line within the block.
+   */
+  kp = xp->x_root;
+  for (;;)
+    {
+      if (n < KSUM (kp->k_left))
+	kp = kp->k_left;
+      else
+	{
+	  n -= KSUM (kp->k_left);
+	  if (n < kp->k_nlines)
+	    break;
+	  n -= kp->k_nlines;
+	  kp = kp->k_right;
+	}
+    }
+  for (lp = kp->k_first, i = 0; i < n; i++)
+    lp = lforw (lp);
+  return lp;
+}
@@ -0,0 +1,537 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Name:	MicroEMACS
+ *		Literal string search
+ * By:		Mark Alexander
+ *		marka@pobox.com
+ *
+ * The functions in this file search a buffer for a literal
+ * string, working directly on the UTF-8 bytes of the lines
+ * instead of decoding every character.  Within a line, the
+ * pattern is found with the Boyer-Moore-Horspool algorithm,
+ * or for short patterns by looking for the first byte with memchr
+ * (which the C library does a word or vector at a time) and then
+ * checking the second byte.  Case folding is done by mapping every
+ * byte through a table, so that "a" and "A" compare equal.
+ *
+ * A pattern containing newlines is split into segments at the
+ * newlines.  The first segment must match the end of a line, the
+ * last segment the start of a line, and the segments in between
+ * whole lines, so these matches need no searching within lines.
+ *
+ * Comparing bytes gives the same answer as comparing characters
+ * with ceq only if folding the case of a character never changes
+ * its length.  That is true when case folding is off, and when the
+ * pattern and the line are both pure ASCII.  But with case folding,
+ * a few non-ASCII characters are equal to ASCII ones (in most
+ * locales, dotless i matches "I", and long s matches "S").  So
+ * if the pattern contains non-ASCII characters, or one of those
+ * ASCII letters and the line isn't pure ASCII, the line is searched
+ * the old way, one character at a time.
+ */
+#include	"def.h"
+
+#include	<wctype.h>
+
+#define	LITSHORT	4		/* Shorter patterns use memchr	*/
+#define	LITNCHAR	0x10000		/* Characters checked for aliases */
+
+/*
+ * A segment of the pattern between newlines.
+ */
+typedef struct SEG
+{
+  int s_off;			/* Byte offset in lpat		*/
+  int s_len;			/* Length in bytes		*/
+  int s_coff;			/* Character offset in lupat	*/
+  int s_clen;			/* Length in characters		*/
+}
+SEG;
+
+static uchar lpat[NPAT];	/* Pattern, with bytes folded	*/
+static wchar_t lupat[NPAT];	/* Pattern as Unicode		*/
+static SEG segs[NPAT];		/* Segments of the pattern	*/
+static int nseg;		/* Number of segments		*/
+static uchar fold[256];		/* Byte folding table		*/
+static int fskip[256];		/* Forward Horspool shifts	*/
+static int bskip[256];		/* Backward Horspool shifts	*/
+static int nofold;		/* TRUE if fold changes nothing	*/
+static int quickfirst;		/* TRUE if memchr can find lpat[0] */
+static int exact;		/* Bytes can be compared on any line */
+static int asciiok;		/* ... or on pure ASCII lines	*/
+static char alias[128];		/* Non-ASCII chars fold to these */
+static int aliasdone;		/* TRUE if alias has been set up */
+
+/*
+ * Find the ASCII characters that some non-ASCII character
+ * is equal to when case is folded, according to ceq.  This
+ * depends only on the locale, so it is done once.  Characters
+ * outside the Basic Multilingual Plane are not checked; none of
+ * them fold to ASCII.
+ */
+static void
+litalias (void)
+{
+  wint_t up[128], u;
+  int c, a, high;
+
+  high = FALSE;
+  for (a = 0; a < 128; a++)
+    if ((up[a] = towupper (a)) >= 0x80)
+      high = TRUE;		/* E.g. Turkish i	*/
+  for (c = 0x80; c < LITNCHAR; c++)
+    {
+      if ((u = towupper (c)) < 0x80)
+	alias[u] = TRUE;
+      else if (high)
+	for (a = 0; a < 128; a++)
+	  if (up[a] == u)
+	    alias[a] = TRUE;
+    }
+  for (a = 0; a < 128; a++)
+    if (up[a] < 0x80 && alias[up[a]])
+      alias[a] = TRUE;
+  aliasdone = TRUE;
+}
+
+/*
+ * Set up the search tables for the pattern "pat", a
+ * UTF-8 string.  Fold case if "dofold" is TRUE.
+ */
+static void
+litsetup (const uchar *pat, int dofold)
+{
+  SEG *sp;
+  const uchar *s;
+  int i, m, len, ascii, hasalias;
+
+  for (i = 0; i < 256; i++)
+    fold[i] = dofold && i < 0x80 ? upmap[i] : i;
+  nofold = !dofold;
+  ascii = TRUE;
+  hasalias = FALSE;
+  nseg = 0;
+  sp = &segs[0];
+  sp->s_off = sp->s_coff = 0;
+  for (s = pat, i = 0; *s != 0; s += len, i++)
+    {
+      lupat[i] = ugetc (s, 0, &len);
+      if (lupat[i] >= 0x80)
+	ascii = FALSE;
+      else if (dofold)
+	{
+	  if (!aliasdone)
+	    litalias ();
+	  if (alias[lupat[i]])
+	    hasalias = TRUE;
+	}
+      if (*s == '\n')
+	{			/* End this segment	*/
+	  sp->s_len = s - pat - sp->s_off;
+	  sp->s_clen = i - sp->s_coff;
+	  ++sp;
+	  sp->s_off = s + 1 - pat;
+	  sp->s_coff = i + 1;
+	}
+    }
+  sp->s_len = s - pat - sp->s_off;
+  sp->s_clen = i - sp->s_coff;
+  nseg = sp - segs + 1;
+  for (i = 0; i < s - pat; i++)
+    lpat[i] = fold[pat[i]];
+  exact = nofold || (ascii && !hasalias);
+  asciiok = exact || ascii;
+
+  /* Shift tables for a single segment.
+   */
+  m = segs[0].s_len;
+  quickfirst = nofold || lpat[0] >= 0x80 || !CISALPHA (lpat[0]);
+  for (i = 0; i < 256; i++)
+    fskip[i] = bskip[i] = m;
+  for (i = 0; i < m - 1; i++)
+    fskip[lpat[i]] = m - 1 - i;
+  for (i = m - 1; i > 0; i--)
+    bskip[lpat[i]] = i;
+}
+
+/*
+ * Set up the search tables for the pattern "pat", a
+ * UTF-8 string, using the current case folding setting.
+ * This is cheap, so it is done before every search.
+ */
+void
+litcomp (const uchar *pat)
+{
+  litsetup (pat, casefold);
+}
+
+/*
+ * Set up the search tables for litscan to find the
+ * pattern "pat" exactly, without folding case.  This is
+ * how project-grep compares text.
+ */
+void
+litcompexact (const uchar *pat)
+{
+  litsetup (pat, FALSE);
+}
+
+/*
+ * Return TRUE if the bytes of line "lp" can be compared
+ * with the folded pattern bytes.
+ */
+static int
+bytewise (LINE *lp)
+{
+  return (exact || (asciiok && (lp->l_flag & LFASCII) != 0));
+}
+
+/*
+ * Compare the "n" bytes at "s" with the "n" folded
+ * pattern bytes at "p", and return TRUE if they match.
+ */
+static int
+fastcmp (const uchar *s, const uchar *p, int n)
+{
+  int i;
+
+  if (nofold)
+    return (memcmp (s, p, n) == 0);
+  for (i = 0; i < n; i++)
+    if (fold[s[i]] != p[i])
+      return (FALSE);
+  return (TRUE);
+}
+
+/*
+ * Compare segment "sp" with the text at "s", one character
+ * at a time, without going past "end".  Return a pointer
+ * to the end of the match, or NULL if it doesn't match.
+ */
+static const uchar *
+slowcmp (const SEG *sp, const uchar *s, const uchar *end)
+{
+  int i, len;
+
+  for (i = sp->s_coff; i < sp->s_coff + sp->s_clen; i++)
+    {
+      if (s >= end || !CEQ (ugetc (s, 0, &len), lupat[i]))
+	return (NULL);
+      s += len;
+    }
+  return (s);
+}
+
+/*
+ * If segment "sp" matches the text of line "lp" at byte
+ * offset "off", return the byte offset of the end of the
+ * match.  Otherwise return -1.
+ */
+static int
+segat (const SEG *sp, LINE *lp, int off)
+{
+  const uchar *s;
+
+  if (bytewise (lp))
+    {
+      if (off + sp->s_len <= llength (lp)
+	  && fastcmp (lgets (lp) + off, lpat + sp->s_off, sp->s_len))
+	return (off + sp->s_len);
+      return (-1);
+    }
+  if ((s = slowcmp (sp, lgets (lp) + off, lend (lp))) == NULL)
+    return (-1);
+  return (s - lgets (lp));
+}
+
+/*
+ * If segment "sp" matches the end of line "lp", starting
+ * at or after byte offset "from", return the byte offset of the
+ * start of the match.  Otherwise return -1.
+ */
+static int
+segsuffix (const SEG *sp, LINE *lp, int from)
+{
+  const uchar *s, *end;
+  int off;
+
+  if (bytewise (lp))
+    {
+      off = llength (lp) - sp->s_len;
+      return (off >= from && segat (sp, lp, off) >= 0 ? off : -1);
+    }
+  end = lend (lp);
+  for (s = lgets (lp) + from; s <= end; s += uclen (s))
+    {
+      if (slowcmp (sp, s, end) == end)
+	return (s - lgets (lp));
+      if (s == end)
+	break;
+    }
+  return (-1);
+}
+
+/*
+ * Find the first match of the first segment of the pattern
+ * in the bytes from "p" to "end", comparing bytes.  Return a
+ * pointer to the match, or NULL if there isn't one.  This
+ * is also used by project-grep, after litcompexact, to search
+ * whole files at once; it only reads the tables, so the
+ * grep threads can call it at the same time.
+ */
+const uchar *
+litscan (const uchar *p, const uchar *end)
+{
+  const uchar *last;
+  int m, c;
+
+  m = segs[0].s_len;
+  if (end - p < m)
+    return (NULL);
+  last = end - m;
+  if (m < LITSHORT && quickfirst)
+    {				/* memchr, then 2nd byte */
+      while ((p = (const uchar *) memchr (p, lpat[0], last - p + 1)) != NULL)
+	{
+	  if (m == 1
+	      || (fold[p[1]] == lpat[1] && fastcmp (p + 2, lpat + 2, m - 2)))
+	    return (p);
+	  if (++p > last)
+	    break;
+	}
+      return (NULL);
+    }
+  while (p <= last)
+    {				/* Horspool		*/
+      c = fold[p[m - 1]];
+      if (c == lpat[m - 1] && fastcmp (p, lpat, m - 1))
+	return (p);
+      p += fskip[c];
+    }
+  return (NULL);
+}
+
+/*
+ * Find the first match of the single segment pattern in
+ * line "lp" that starts at or after byte offset "from".
+ * Return the byte offset of the match, or -1 if there isn't one.
+ */
+static int
+segfind (LINE *lp, int from)
+{
+  const uchar *t, *p, *end;
+
+  t = lgets (lp);
+  end = lend (lp);
+  if (!bytewise (lp))
+    {
+      for (p = t + from; p < end; p += uclen (p))
+	if (slowcmp (&segs[0], p, end) != NULL)
+	  return (p - t);
+      return (-1);
+    }
+  if ((p = litscan (t + from, end)) == NULL)
+    return (-1);
+  return (p - t);
+}
+
+/*
+ * Find the last match of the single segment pattern in
+ * line "lp" that ends at or before byte offset "to".
+ * Return the byte offset of the match, or -1 if there isn't one.
+ */
+static int
+segrfind (LINE *lp, int to)
+{
+  const uchar *t, *p, *end, *e;
+  int m, off, c, found;
+
+  t = lgets (lp);
+  m = segs[0].s_len;
+  if (!bytewise (lp))
+    {
+      end = lend (lp);
+      found = -1;
+      for (p = t; p < t + to; p += uclen (p))
+	if ((e = slowcmp (&segs[0], p, end)) != NULL && e <= t + to)
+	  found = p - t;
+      return (found);
+    }
+  for (off = to - m; off >= 0; off -= bskip[c])
+    {				/* Horspool, backwards	*/
+      c = fold[t[off]];
+      if (c == lpat[0] && fastcmp (t + off + 1, lpat + 1, m - 1))
+	return (off);
+    }
+  return (-1);
+}
+
+/*
+ * Return the character offset of byte offset
+ * "off" in line "lp".
+ */
+static int
+charoff (LINE *lp, int off)
+{
+  if ((lp->l_flag & LFASCII) != 0)
+    return (off);
+  return (unslen (lgets (lp), off));
+}
+
+/*
+ * Search buffer "bp" forward from position "pos" for the
+ * pattern given to litcomp.  If it is found, set "pos" to
+ * the end of the match and return TRUE; otherwise return FALSE.
+ */
+int
+litforw (BUFFER *bp, POS *pos)
+{
+  LINE *lp, *tlp;
+  int from, off, end, i;
+
+  lp = pos->p;
+  if (lp == bp->b_linep)
+    return (FALSE);
+  for (from = wloffset (lp, pos->o); lp != bp->b_linep;
+       lp = lforw (lp), from = 0)
+    {
+      if (nseg == 1)
+	{
+	  if ((off = segfind (lp, from)) < 0)
+	    continue;
+	  pos->p = lp;
+	  pos->o = charoff (lp, off) + segs[0].s_clen;
+	  return (TRUE);
+	}
+      if (segsuffix (&segs[0], lp, from) < 0)
+	continue;
+      tlp = lp;
+      for (i = 1; i < nseg; i++)
+	{
+	  if ((tlp = lforw (tlp)) == bp->b_linep)
+	    return (FALSE);
+	  end = segat (&segs[i], tlp, 0);
+	  if (end < 0 || (i < nseg - 1 && end != llength (tlp)))
+	    break;
+	}
+      if (i == nseg)
+	{
+	  pos->p = tlp;
+	  pos->o = segs[nseg - 1].s_clen;
+	  return (TRUE);
+	}
+    }
+  return (FALSE);
+}
+
+/*
+ * Search buffer "bp" backward from position "pos" for the
+ * pattern given to litcomp.  The match must end at or before
+ * "pos".  If it is found, set "pos" to the start of the match
+ * and return TRUE; otherwise return FALSE.
+ */
+int
+litback (BUFFER *bp, POS *pos)
+{
+  LINE *lp, *tlp;
+  int to, off, end, i;
+
+  off = -1;
+  lp = pos->p;
+  for (to = wloffset (lp, pos->o);; lp = lback (lp), to = llength (lp))
+    {
+      if (nseg == 1)
+	{
+	  if ((off = segrfind (lp, to)) >= 0)
+	    {
+	      pos->p = lp;
+	      pos->o = charoff (lp, off);
+	      return (TRUE);
+	    }
+	}
+      else if ((end = segat (&segs[nseg - 1], lp, 0)) >= 0 && end <= to)
+	{
+	  tlp = lp;
+	  for (i = nseg - 2; i >= 0; i--)
+	    {
+	      if ((tlp = lback (tlp)) == bp->b_linep)
+		return (FALSE);
+	      if (i == 0)
+		off = segsuffix (&segs[0], tlp, 0);
+	      else if (segat (&segs[i], tlp, 0) != llength (tlp))
+		break;
+	    }
+	  if (i < 0 && off >= 0)
+	    {
+	      pos->p = tlp;
+	      pos->o = charoff (tlp, off);
+	      return (TRUE);
+	    }
+	}
+      if (lback (lp) == bp->b_linep)
+	return (FALSE);
+    }
+}
+
+/*
+ * Return TRUE if the pattern given to litcomp matches
+ * the text of buffer "bp" starting at byte offset "off"
+ * of line "lp".
+ */
+int
+litat (BUFFER *bp, LINE *lp, int off)
+{
+  int i, end;
+
+  if ((end = segat (&segs[0], lp, off)) < 0)
+    return (FALSE);
+  if (nseg == 1)
+    return (TRUE);
+  if (end != llength (lp))
+    return (FALSE);
+  for (i = 1; i < nseg; i++)
+    {
+      if ((lp = lforw (lp)) == bp->b_linep)
+	return (FALSE);
+      end = segat (&segs[i], lp, 0);
+      if (end < 0 || (i < nseg - 1 && end != llength (lp)))
+	return (FALSE);
+    }
+  return (TRUE);
+}
+
+/*
+ * Find the first match of the pattern given to litcomp
+ * that starts in line "lp" of buffer "bp", at or after
+ * byte offset "from".  Return the byte offset of the match,
+ * or -1 if there isn't one.
+ */
+int
+litfind (BUFFER *bp, LINE *lp, int from)
+{
+  int off;
+
+  if (nseg == 1)
+    return (segfind (lp, from));
+  if ((off = segsuffix (&segs[0], lp, from)) < 0 || !litat (bp, lp, off))
+    return (-1);
+  return (off);
+}
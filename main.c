@@ -57,6 +57,18 @@ int tabsize = 8;		/* No. of columns for a tab     */
 unsigned long *ruby_stack_ptr;
 #endif
 
+/*
+ * A file named on the command line, with the line
+ * and column to go to after it has been read.
+ */
+typedef struct FILEARG
+{
+  char *name;			/* File name			*/
+  int line;			/* Line number, or 0		*/
+  int column;			/* Column number, or 0		*/
+}
+FILEARG;
+
 /*
  * Forward declarations.
  */
@@ -81,6 +93,9 @@ main (int argc, char *argv[])
   ruby_stack_ptr = &ruby_stack;
 #endif
   int nbuf = 0;			/* number of buffers    */
+  int nfile;			/* number of file names */
+  FILEARG *files;		/* file names           */
+  const char **names;		/* just the names       */
 
   proptr = NULLPTR;		/* profile name         */
   for (n = 1; n < argc; n++)
@@ -138,8 +153,13 @@ main (int argc, char *argv[])
   keymapinit ();		/* Symbols, bindings.   */
   upmapinit ();			/* Upper case map table */
 
+  nfile = 0;
+  files = (FILEARG *) malloc (argc * sizeof (FILEARG));
+  names = (const char **) malloc (argc * sizeof (char *));
+  if (files == NULL || names == NULL)
+    abort ();
   for (n = 1 ; n < argc; n++)
-    {				/* Read in files        */
+    {				/* Find file names      */
       arg = argv[n];
       if (arg[0] == '-')
 	{			/* ignore options       */
@@ -173,19 +193,34 @@ main (int argc, char *argv[])
 		}
 	      line = atoi (lp);
 	    }
-	  ++nbuf;
-	  bufinit (arg, nbuf);	/* make buffer & window */
-//	  update ();
-	  readin (arg);		/* read in the file     */
-	  if (line != 0)	/* goto line specified  */
-	    {
-	      gotoline (TRUE, line, 0);
-	      line = 0;
-	      if (column != 0)
-		forwchar (TRUE, column - 1, KRANDOM);
-	    }
+	  files[nfile].name = arg;
+	  files[nfile].line = line;
+	  files[nfile].column = column;
+	  names[nfile] = arg;
+	  ++nfile;
+	  line = 0;		/* -g is for first file */
+	}
+    }
+
+  /* Let threads read the files into memory while
+   * the buffers are created in argument order.
+   */
+  ffpreload (names, nfile);
+  for (n = 0; n < nfile; n++)
+    {				/* Read in files        */
+      ++nbuf;
+      bufinit (files[n].name, nbuf);	/* make buffer & window */
+      readin (files[n].name);	/* read in the file     */
+      if (files[n].line != 0)	/* goto line specified  */
+	{
+	  gotoline (TRUE, files[n].line, 0);
+	  if (files[n].column != 0)
+	    forwchar (TRUE, files[n].column - 1, KRANDOM);
 	}
     }
+  ffpreloaddone ();
+  free ((char *) files);
+  free ((char *) names);
 
   if (nbuf == 0)
     {
@@ -220,7 +255,16 @@ main (int argc, char *argv[])
 loop:
   if (!inprof && !ttstat ())	/* If not in a profile, */
     update ();			/*  fix up the screen.  */
+  while (!inprof && loadpending () && ttwait (0) == FALSE)
+    {				/* Read big files while */
+      loadstep ();		/*  no keys are waiting */
+      update ();
+    }
+  if (!inprof && ttwait (0) == FALSE)
+    jouflush ();		/* Write crash journals */
   c = getkey ();
+  if (c == (KCTRL | 'G') && loadcancel ())
+    goto loop;			/* Stop background read	*/
   if (epresf != FALSE)
     {				/* Stuff on echo line?  */
       eerase ();		/* Get rid of echo line */
@@ -400,6 +444,7 @@ quit (int f, int n, int k)
       || anycb () == FALSE	/* All buffers clean.   */
       || (s = eyesno ("Quit")) == TRUE)
     {				/* User says it's OK.   */
+      jouexit ();		/* Remove journals	*/
       vttidy ();
       exit (GOOD);
     }
@@ -169,19 +169,7 @@ showcpos (int f, int n, int k)
 int
 getcolpos (void)
 {
-  int col, i, c;
-
-  col = 0;			/* Determine column.    */
-  for (i = 0; i < curwp->w_dot.o; ++i)
-    {
-      c = wlgetc (curwp->w_dot.p, i);
-      if (c == '\t')
-	col += (tabsize - col % tabsize) - 1;
-      else if (c < 0x80 && CISCTRL (c) != FALSE)
-	++col;
-      ++col;
-    }
-  return (col + 1);		/* Convert to origin 1. */
+  return (lcolumn (curwp->w_dot.p, curwp->w_dot.o) + 1);	/* Origin 1. */
 }
 
 /*
@@ -57,8 +57,27 @@
 
 #define	FAIL(m)	{ regerror(m); return(NULL); }
 
+/* The state of a match in progress is kept in variables local
+ * to the thread, so that several threads can run regnexec at
+ * once, as long as each has its own compiled program.
+ */
+#if defined(__GNUC__)
+#define	THREAD	__thread
+#else
+#define	THREAD
+#endif
+
 #if USE_PCRE2
 
+/* The match data and JIT stack are shared by all compiled programs,
+ * because only one match is ever in progress in a thread, and the
+ * results are copied out to the program's startp and endp arrays.
+ * They are created by the thread's first regnexec, and freed by regdone.
+ */
+static THREAD pcre2_match_data *regmd;	/* Result of the last match */
+static THREAD pcre2_jit_stack *regjit;	/* Stack for JIT-compiled matching */
+static THREAD pcre2_match_context *regmctx; /* Match context using regjit */
+
 regexp *
 regcomp (const char *exp)
 {
@@ -76,40 +95,79 @@ regcomp (const char *exp)
   if (r->re == NULL) {
     PCRE2_UCHAR buffer[256];
     pcre2_get_error_message(errornumber, buffer, sizeof(buffer));
+    free (r);
     FAIL ((const char *)buffer);
   }
-  r->md = pcre2_match_data_create_from_pattern(r->re, NULL);
+
+  /* Compile to machine code if the library supports it.  If it
+   * doesn't, pcre2_match quietly uses the interpreter instead.
+   */
+  pcre2_jit_compile (r->re, PCRE2_JIT_COMPLETE);
   return r;
 }
 
+/*
+ * Free this thread's match data and JIT stack.
+ */
+void
+regdone (void)
+{
+  if (regmd != NULL)
+    pcre2_match_data_free (regmd);
+  if (regjit != NULL)
+    pcre2_jit_stack_free (regjit);
+  if (regmctx != NULL)
+    pcre2_match_context_free (regmctx);
+  regmd = NULL;
+  regjit = NULL;
+  regmctx = NULL;
+}
+
 int
-regexec (regexp * prog, const char *string)
+regnexec (regexp * prog, const char *string, size_t len, int flags)
 {
   int i, rc, n;
   PCRE2_SIZE *ovector;
 
+  if (regmd == NULL)
+    {
+      regmd = pcre2_match_data_create (NSUBEXP, NULL);
+      regjit = pcre2_jit_stack_create (32 * 1024, 1024 * 1024, NULL);
+      regmctx = pcre2_match_context_create (NULL);
+      if (regmd == NULL || regjit == NULL || regmctx == NULL)
+	{
+	  regdone ();
+	  regerror ("out of space");
+	  return 0;
+	}
+      pcre2_jit_stack_assign (regmctx, NULL, regjit);
+    }
+
   rc = pcre2_match(
     prog->re,                   /* the compiled pattern */
     (PCRE2_SPTR)string,         /* the subject string */
-    (PCRE2_SIZE)strlen(string), /* the length of the subject */
+    (PCRE2_SIZE)len,            /* the length of the subject */
     0,                          /* start at offset 0 in the subject */
-    0,                          /* default options */
-    prog->md,                   /* block for storing the result */
-    NULL);                      /* use default match context */
+    (flags & REG_NOTBOL) ? PCRE2_NOTBOL : 0, /* options */
+    regmd,                      /* block for storing the result */
+    regmctx);                   /* match context with the JIT stack */
 
   if (rc < 0)
     return 0;			/* no match */
 
-  /* Make sure we don't exceed the maximum number of groups. */
+  /* Make sure we don't exceed the maximum number of groups.
+   * The match data only has room for NSUBEXP of them, so
+   * a return value of zero means there were more.
+   */
   n = rc;
-  if (n > NSUBEXP) {
+  if (n == 0) {
     char buf[256];
-    snprintf(buf, sizeof(buf), "[%d groups exceeds limit %d]", n, NSUBEXP);
+    snprintf(buf, sizeof(buf), "[groups exceed limit %d]", NSUBEXP);
     regerror (buf);
     n = NSUBEXP;
   }
 
-  ovector = pcre2_get_ovector_pointer(prog->md);
+  ovector = pcre2_get_ovector_pointer(regmd);
   for (i = 0; i < n; i++) {
     prog->startp[i] = (const char *) string + ovector[2*i];
     prog->endp[i]   = (const char *) string + ovector[2*i+1];
@@ -117,11 +175,16 @@ regexec (regexp * prog, const char *string)
   return 1;
 }
 
+int
+regexec (regexp * prog, const char *string)
+{
+  return regnexec (prog, string, strlen (string), 0);
+}
+
 void
 regfree (regexp * reg)
 {
-  pcre2_match_data_free(reg->md);   /* Release memory used for the match */
-  pcre2_code_free(reg->re);         /*   data and the compiled pattern. */
+  pcre2_code_free(reg->re);         /* Release the compiled pattern. */
   free (reg);
 }
 
@@ -273,6 +336,9 @@ STATIC void regc (char b);
 STATIC void reginsert (char op, char *opnd);
 STATIC void regtail (char *p, char *val);
 STATIC void regoptail (char *p, char *val);
+STATIC int regdfaexec (regexp * prog, const char *string, const char *end,
+		       int bol);
+STATIC void regdfafree (struct regdfa *d);
 #ifdef STRCSPN
 STATIC int strcspn ();
 #endif
@@ -331,6 +397,7 @@ regcomp (const char *exp)
     return (NULL);
 
   /* Dig out information for optimizations. */
+  r->regdfa = NULL;		/* Built on first use. */
   r->regstart = '\0';		/* Worst-case defaults. */
   r->reganch = 0;
   r->regmust = NULL;
@@ -378,9 +445,18 @@ regcomp (const char *exp)
 void
 regfree (regexp * reg)
 {
+  regdfafree (reg->regdfa);
   free (reg);
 }
 
+/*
+ - regdone - free this thread's matching resources; there are none
+ */
+void
+regdone (void)
+{
+}
+
 /*
  - reg - regular expression, i.e. main body or parenthesized thing
  *
@@ -808,15 +884,17 @@ regoptail (char *p, char *val)
 /*
  * Global work variables for regexec().
  */
-static const char *reginput;	/* String-input pointer. */
-static const char *regbol;	/* Beginning of input, for ^ check. */
-static const char **regstartp;	/* Pointer to startp array. */
-static const char **regendp;	/* Ditto for endp. */
+static THREAD const char *reginput;	/* String-input pointer. */
+static THREAD const char *regbol;	/* Beginning of input, for ^ check. */
+static THREAD const char *regeol;	/* End of input, for $ check. */
+static THREAD const char **regstartp;	/* Pointer to startp array. */
+static THREAD const char **regendp;	/* Ditto for endp. */
 
 /*
  * Forwards.
  */
 STATIC int regtry (regexp * prog, const char *string);
+STATIC int inset (const char *set, char c);
 STATIC int regmatch (char *prog);
 STATIC int regrepeat (char *p);
 
@@ -827,12 +905,25 @@ STATIC char *regprop ();
 #endif
 
 /*
- - regexec - match a regexp against a string
+ - regexec - match a regexp against a NUL-terminated string
  */
 int
 regexec (regexp * prog, const char *string)
+{
+  return (regnexec (prog, string, strlen (string), 0));
+}
+
+/*
+ - regnexec - match a regexp against the "len" bytes at "string",
+ * which need not be NUL-terminated, and may contain NULs.  If "flags"
+ * includes REG_NOTBOL, the string doesn't start at the beginning of
+ * a line, so ^ doesn't match there.
+ */
+int
+regnexec (regexp * prog, const char *string, size_t len, int flags)
 {
   const char *s;
+  const char *end;
 
   /* Be paranoid... */
   if (prog == NULL || string == NULL)
@@ -848,13 +939,16 @@ regexec (regexp * prog, const char *string)
       return (0);
     }
 
+  end = string + len;
+
   /* If there is a "must appear" string, look for it. */
   if (prog->regmust != NULL)
     {
       s = string;
-      while ((s = strchr (s, prog->regmust[0])) != NULL)
+      while ((s = memchr (s, prog->regmust[0], end - s)) != NULL)
 	{
-	  if (strncmp (s, prog->regmust, prog->regmlen) == 0)
+	  if (end - s >= prog->regmlen
+	      && memcmp (s, prog->regmust, prog->regmlen) == 0)
 	    break;		/* Found it. */
 	  s++;
 	}
@@ -862,18 +956,23 @@ regexec (regexp * prog, const char *string)
 	return (0);
     }
 
-  /* Mark beginning of line for ^ . */
-  regbol = string;
+  /* Mark beginning of line for ^ , and end for $ . */
+  regbol = (flags & REG_NOTBOL) ? NULL : string;
+  regeol = end;
+
+  /* Give up now if the DFA says there's no match anywhere. */
+  if (regdfaexec (prog, string, end, regbol != NULL) == 0)
+    return (0);
 
   /* Simplest case:  anchored match need be tried only once. */
   if (prog->reganch)
-    return (regtry (prog, string));
+    return (regbol != NULL && regtry (prog, string));
 
   /* Messy cases:  unanchored match. */
   s = string;
   if (prog->regstart != '\0')
     /* We know what char it must start with. */
-    while ((s = strchr (s, prog->regstart)) != NULL)
+    while ((s = memchr (s, prog->regstart, end - s)) != NULL)
       {
 	if (regtry (prog, s))
 	  return (1);
@@ -886,12 +985,22 @@ regexec (regexp * prog, const char *string)
 	if (regtry (prog, s))
 	  return (1);
       }
-    while (*s++ != '\0');
+    while (s++ < end);
 
   /* Failure. */
   return (0);
 }
 
+/*
+ - inset - is character c in the NUL-terminated set?  A NUL in the
+ * input can never be in the set, because it would end the set.
+ */
+static int
+inset (const char *set, char c)
+{
+  return (c != '\0' && strchr (set, c) != NULL);
+}
+
 /*
  - regtry - try match at specific point
  */
@@ -959,11 +1068,11 @@ regmatch (char *prog)
 	    return (0);
 	  break;
 	case EOL:
-	  if (*reginput != '\0')
+	  if (reginput != regeol)
 	    return (0);
 	  break;
 	case ANY:
-	  if (*reginput == '\0')
+	  if (reginput >= regeol)
 	    return (0);
 	  reginput++;
 	  break;
@@ -974,21 +1083,22 @@ regmatch (char *prog)
 
 	    opnd = OPERAND (scan);
 	    /* Inline the first character, for speed. */
-	    if (*opnd != *reginput)
+	    if (reginput >= regeol || *opnd != *reginput)
 	      return (0);
 	    len = strlen (opnd);
-	    if (len > 1 && strncmp (opnd, reginput, len) != 0)
+	    if (len > 1 && (regeol - reginput < len
+			    || memcmp (opnd, reginput, len) != 0))
 	      return (0);
 	    reginput += len;
 	  }
 	  break;
 	case ANYOF:
-	  if (*reginput == '\0' || strchr (OPERAND (scan), *reginput) == NULL)
+	  if (reginput >= regeol || !inset (OPERAND (scan), *reginput))
 	    return (0);
 	  reginput++;
 	  break;
 	case ANYBUT:
-	  if (*reginput == '\0' || strchr (OPERAND (scan), *reginput) != NULL)
+	  if (reginput >= regeol || inset (OPERAND (scan), *reginput))
 	    return (0);
 	  reginput++;
 	  break;
@@ -1101,7 +1211,8 @@ regmatch (char *prog)
 	    while (no >= min)
 	      {
 		/* If it could work, try it. */
-		if (nextch == '\0' || *reginput == nextch)
+		if (nextch == '\0'
+		    || (reginput < regeol && *reginput == nextch))
 		  if (regmatch (next))
 		    return (1);
 		/* Couldn't or didn't -- back up. */
@@ -1146,25 +1257,25 @@ regrepeat (char *p)
   switch (OP (p))
     {
     case ANY:
-      count = strlen (scan);
+      count = regeol - scan;
       scan += count;
       break;
     case EXACTLY:
-      while (*opnd == *scan)
+      while (scan < regeol && *opnd == *scan)
 	{
 	  count++;
 	  scan++;
 	}
       break;
     case ANYOF:
-      while (*scan != '\0' && strchr (opnd, *scan) != NULL)
+      while (scan < regeol && inset (opnd, *scan))
 	{
 	  count++;
 	  scan++;
 	}
       break;
     case ANYBUT:
-      while (*scan != '\0' && strchr (opnd, *scan) == NULL)
+      while (scan < regeol && !inset (opnd, *scan))
 	{
 	  count++;
 	  scan++;
@@ -1180,6 +1291,430 @@ regrepeat (char *p)
   return (count);
 }
 
+/*
+ * Lazy DFA.
+ *
+ * The backtracking matcher above can take quadratic or worse time on
+ * patterns like ".*foo.*bar", because it retries the whole pattern at
+ * every starting point, and backs up through every ".*".  So before
+ * running it, regnexec asks a DFA whether the string contains a match
+ * at all, which takes time linear in the length of the string.  Most
+ * lines in a search don't match, and for those the backtracker never
+ * runs; it is only used to find the exact extent of a match (and of
+ * its parenthesized parts) in a line that is known to contain one.
+ *
+ * The DFA is built lazily.  The program is first converted to a
+ * Thompson NFA, with one state for each character the program can
+ * match, and split states for its branches and loops.  A DFA state
+ * is the set of NFA states reachable after reading some input; it is
+ * created the first time the input leads to it, and its transitions
+ * are filled in as they are needed.  The start state is added to
+ * every set, so the DFA finds matches starting anywhere in the string.
+ * If a pattern needs more than DFAMAX DFA states, regdfaexec gives up
+ * and the backtracker does all the work, as before.  It also leaves
+ * patterns without loops to the backtracker, which is faster for
+ * them because of the regstart check, and never needs to back up far.
+ */
+#define	NFA_CHAR	0	/* Match one character in set, go to out. */
+#define	NFA_SPLIT	1	/* Go to out, and to out1 if it is >= 0. */
+#define	NFA_BOL		2	/* Go to out at beginning of line. */
+#define	NFA_EOL		3	/* Go to out at end of line. */
+#define	NFA_MATCH	4	/* The whole program has matched. */
+
+#define	DFAMAX		256	/* Maximum number of DFA states per program. */
+#define	DFAHASH		64	/* Size of DFA state hash table. */
+
+typedef struct
+{
+  char op;			/* NFA_CHAR, etc. */
+  int out;			/* Next state, or -1 if none. */
+  int out1;			/* Other next state for NFA_SPLIT. */
+  unsigned char set[32];	/* Bitmap of characters for NFA_CHAR. */
+}
+NFASTATE;
+
+typedef struct dstate
+{
+  struct dstate *next[256];	/* Transitions, NULL if not known yet. */
+  struct dstate *link;		/* Next state in the hash chain. */
+  unsigned hash;		/* Hash of set. */
+  char match;			/* Set contains NFA_MATCH. */
+  char eol;			/* Set contains an NFA_EOL. */
+  int nset;			/* Number of NFA states in set. */
+  int set[1];			/* NFA states, in increasing order. */
+}
+DSTATE;
+
+struct regdfa
+{
+  NFASTATE *nfa;		/* The NFA. */
+  int nnfa;			/* Number of NFA states. */
+  int start;			/* NFA state for the start of the program. */
+  int loops;			/* Program has STAR, PLUS, or BACK. */
+  int *mark;			/* Generation in which each state was added. */
+  int *stack;			/* Stack for computing closures. */
+  int gen;			/* Current generation. */
+  DSTATE *init[2];		/* Start DFA states, not at or at BOL. */
+  DSTATE *hash[DFAHASH];	/* Hash table of DFA states. */
+  int ndstate;			/* Number of DFA states. */
+};
+
+#define	SETBIT(set, c)	((set)[(unsigned char) (c) >> 3] |= 1 << ((c) & 7))
+#define	TSTBIT(set, c)	((set)[(unsigned char) (c) >> 3] & (1 << ((c) & 7)))
+
+/*
+ - nfasize - return the number of bytes in a node, including its operand
+ */
+static int
+nfasize (char *p)
+{
+  if (OP (p) == EXACTLY || OP (p) == ANYOF || OP (p) == ANYBUT)
+    return (3 + strlen (OPERAND (p)) + 1);
+  return (3);
+}
+
+/*
+ - nfaset - fill in the set of characters matched by simple node p
+ *
+ * As in regmatch, a NUL in the input is never in an ANYOF set, and
+ * is always in an ANYBUT set.
+ */
+static void
+nfaset (unsigned char *set, char *p)
+{
+  char *s;
+  int c;
+
+  memset (set, 0, 32);
+  switch (OP (p))
+    {
+    case ANY:
+      memset (set, 0xff, 32);
+      break;
+    case EXACTLY:
+      SETBIT (set, *OPERAND (p));
+      break;
+    case ANYOF:
+      for (s = OPERAND (p); *s != '\0'; s++)
+	SETBIT (set, *s);
+      break;
+    case ANYBUT:
+      memset (set, 0xff, 32);
+      for (s = OPERAND (p); *s != '\0'; s++)
+	{
+	  c = (unsigned char) *s;
+	  set[c >> 3] &= ~(1 << (c & 7));
+	}
+      break;
+    }
+}
+
+/*
+ - nfabuild - convert a program to an NFA
+ *
+ * The nodes of the program are laid out one after another, so
+ * the first pass numbers the NFA states for each node, and the
+ * second fills them in, following the "next" pointers.
+ */
+static struct regdfa *
+nfabuild (regexp * prog)
+{
+  struct regdfa *d;
+  NFASTATE *ns;
+  char *p, *q;
+  int *ids;
+  int n, i, plen;
+
+#define	TARGET(p)	((p) == NULL ? -1 : ids[(p) - prog->program])
+
+  for (p = prog->program + 1; OP (p) != END; p += nfasize (p))
+    ;
+  plen = p + 3 - prog->program;
+  if ((ids = (int *) malloc (plen * sizeof (int))) == NULL)
+    return (NULL);
+  n = 0;
+  for (p = prog->program + 1;; p += nfasize (p))
+    {
+      ids[p - prog->program] = n;
+      if (OP (p) == EXACTLY)
+	n += strlen (OPERAND (p));
+      else if (OP (p) == STAR || OP (p) == PLUS)
+	n += 2;
+      else
+	n += 1;
+      if (OP (p) == END)
+	break;
+    }
+
+  d = (struct regdfa *) calloc (1, sizeof (struct regdfa));
+  if (d == NULL
+      || (d->nfa = (NFASTATE *) calloc (n, sizeof (NFASTATE))) == NULL
+      || (d->mark = (int *) calloc (n, sizeof (int))) == NULL
+      || (d->stack = (int *) malloc ((2 * n + 1) * sizeof (int))) == NULL)
+    {
+      free (ids);
+      regdfafree (d);
+      return (NULL);
+    }
+  d->nnfa = n;
+  d->start = ids[1];
+
+  for (p = prog->program + 1;; p += nfasize (p))
+    {
+      i = ids[p - prog->program];
+      ns = &d->nfa[i];
+      ns->op = NFA_SPLIT;
+      ns->out = TARGET (regnext (p));
+      ns->out1 = -1;
+      switch (OP (p))
+	{
+	case END:
+	  ns->op = NFA_MATCH;
+	  break;
+	case BOL:
+	  ns->op = NFA_BOL;
+	  break;
+	case EOL:
+	  ns->op = NFA_EOL;
+	  break;
+	case ANY:
+	case ANYOF:
+	case ANYBUT:
+	  ns->op = NFA_CHAR;
+	  nfaset (ns->set, p);
+	  break;
+	case EXACTLY:
+	  for (q = OPERAND (p); *q != '\0'; q++, ns++)
+	    {
+	      ns->op = NFA_CHAR;
+	      ns->out = (q[1] != '\0') ? i + (q - OPERAND (p)) + 1
+		: TARGET (regnext (p));
+	      memset (ns->set, 0, 32);
+	      SETBIT (ns->set, *q);
+	    }
+	  break;
+	case BRANCH:
+	  /* As in regmatch, a BRANCH not followed by another
+	   * is the last (or only) alternative.
+	   */
+	  q = regnext (p);
+	  ns->out = TARGET (OPERAND (p));
+	  if (q != NULL && OP (q) == BRANCH)
+	    ns->out1 = TARGET (q);
+	  break;
+	case STAR:
+	  d->loops = 1;
+	  ns->out = i + 1;
+	  ns->out1 = TARGET (regnext (p));
+	  ns[1].op = NFA_CHAR;
+	  ns[1].out = i;
+	  nfaset (ns[1].set, OPERAND (p));
+	  break;
+	case PLUS:
+	  d->loops = 1;
+	  ns->op = NFA_CHAR;
+	  ns->out = i + 1;
+	  nfaset (ns->set, OPERAND (p));
+	  ns[1].op = NFA_SPLIT;
+	  ns[1].out = i;
+	  ns[1].out1 = TARGET (regnext (p));
+	  break;
+	case BACK:
+	  d->loops = 1;
+	  break;
+	default:
+	  /* NOTHING, OPEN, and CLOSE match the empty string. */
+	  break;
+	}
+      if (OP (p) == END)
+	break;
+    }
+#undef	TARGET
+  free (ids);
+  return (d);
+}
+
+/*
+ - nfaadd - add NFA state i, and the states reachable from it without
+ * reading input, to the set for the current generation.  BOL and EOL
+ * assertions are passed only if "bol" or "eol" say the input is there.
+ */
+static void
+nfaadd (struct regdfa *d, int i, int bol, int eol)
+{
+  NFASTATE *ns;
+  int sp;
+
+  sp = 0;
+  d->stack[sp++] = i;
+  while (sp > 0)
+    {
+      i = d->stack[--sp];
+      if (i < 0 || d->mark[i] == d->gen)
+	continue;
+      d->mark[i] = d->gen;
+      ns = &d->nfa[i];
+      switch (ns->op)
+	{
+	case NFA_SPLIT:
+	  d->stack[sp++] = ns->out1;
+	  d->stack[sp++] = ns->out;
+	  break;
+	case NFA_BOL:
+	  if (bol)
+	    d->stack[sp++] = ns->out;
+	  break;
+	case NFA_EOL:
+	  if (eol)
+	    d->stack[sp++] = ns->out;
+	  break;
+	}
+    }
+}
+
+/*
+ - dfastate - find or create the DFA state for the NFA states
+ * marked in the current generation; return NULL if there are too many
+ */
+static DSTATE *
+dfastate (struct regdfa *d)
+{
+  DSTATE *ds;
+  int i, n, op;
+  unsigned hash;
+  int *set;
+
+  /* Collect the states that read input, or accept, in order. */
+  set = d->stack;
+  n = 0;
+  hash = 0;
+  for (i = 0; i < d->nnfa; i++)
+    if (d->mark[i] == d->gen)
+      {
+	op = d->nfa[i].op;
+	if (op == NFA_CHAR || op == NFA_EOL || op == NFA_MATCH)
+	  {
+	    set[n++] = i;
+	    hash = hash * 31 + i;
+	  }
+      }
+
+  for (ds = d->hash[hash % DFAHASH]; ds != NULL; ds = ds->link)
+    if (ds->hash == hash && ds->nset == n
+	&& memcmp (ds->set, set, n * sizeof (int)) == 0)
+      return (ds);
+
+  if (d->ndstate >= DFAMAX)
+    return (NULL);
+  ds = (DSTATE *) calloc (1, sizeof (DSTATE) + n * sizeof (int));
+  if (ds == NULL)
+    return (NULL);
+  d->ndstate++;
+  ds->hash = hash;
+  ds->nset = n;
+  memcpy (ds->set, set, n * sizeof (int));
+  for (i = 0; i < n; i++)
+    {
+      op = d->nfa[set[i]].op;
+      if (op == NFA_MATCH)
+	ds->match = 1;
+      else if (op == NFA_EOL)
+	ds->eol = 1;
+    }
+  ds->link = d->hash[hash % DFAHASH];
+  d->hash[hash % DFAHASH] = ds;
+  return (ds);
+}
+
+/*
+ - regdfaexec - does the program match somewhere in the string?
+ *
+ * Return 1 if it does, 0 if it doesn't, or -1 if the DFA couldn't
+ * be built, or isn't worth using, and the backtracker has to find out.
+ */
+static int
+regdfaexec (regexp * prog, const char *string, const char *end, int bol)
+{
+  struct regdfa *d;
+  DSTATE *ds, *next;
+  NFASTATE *ns;
+  const char *s;
+  int c, i;
+
+  if ((d = prog->regdfa) == NULL)
+    {
+      if ((d = prog->regdfa = nfabuild (prog)) == NULL)
+	return (-1);
+    }
+  if (!d->loops)
+    return (-1);
+
+  if ((ds = d->init[bol]) == NULL)
+    {
+      d->gen++;
+      nfaadd (d, d->start, bol, 0);
+      if ((ds = d->init[bol] = dfastate (d)) == NULL)
+	return (-1);
+    }
+
+  for (s = string; !ds->match; s++)
+    {
+      if (s == end)
+	{
+	  /* Try passing the EOL assertions in the last state. */
+	  if (!ds->eol)
+	    return (0);
+	  d->gen++;
+	  for (i = 0; i < ds->nset; i++)
+	    if (d->nfa[ds->set[i]].op == NFA_EOL)
+	      nfaadd (d, d->nfa[ds->set[i]].out, bol && s == string, 1);
+	  for (i = 0; i < d->nnfa; i++)
+	    if (d->mark[i] == d->gen && d->nfa[i].op == NFA_MATCH)
+	      return (1);
+	  return (0);
+	}
+      c = (unsigned char) *s;
+      if ((next = ds->next[c]) == NULL)
+	{
+	  d->gen++;
+	  for (i = 0; i < ds->nset; i++)
+	    {
+	      ns = &d->nfa[ds->set[i]];
+	      if (ns->op == NFA_CHAR && TSTBIT (ns->set, c))
+		nfaadd (d, ns->out, 0, 0);
+	    }
+	  nfaadd (d, d->start, 0, 0);
+	  if ((next = ds->next[c] = dfastate (d)) == NULL)
+	    return (-1);
+	}
+      ds = next;
+    }
+  return (1);
+}
+
+/*
+ - regdfafree - free a DFA and all its states
+ */
+static void
+regdfafree (struct regdfa *d)
+{
+  DSTATE *ds, *link;
+  int i;
+
+  if (d == NULL)
+    return;
+  for (i = 0; i < DFAHASH; i++)
+    for (ds = d->hash[i]; ds != NULL; ds = link)
+      {
+	link = ds->link;
+	free (ds);
+      }
+  free (d->nfa);
+  free (d->mark);
+  free (d->stack);
+  free (d);
+}
+
 /*
  - regnext - dig the "next" pointer out of a node
  */
@@ -1367,3 +1902,65 @@ strcspn (s1, s2)
 #endif
 
 #endif /* USE_PCRE2 */
+
+/*
+ * A small cache of compiled programs, so that repeating a search or
+ * replace with the same pattern doesn't compile it again.  The least
+ * recently used program is thrown out to make room for a new one.
+ */
+#define	NREGCACHE	8
+
+static struct
+{
+  char *exp;			/* Pattern text */
+  regexp *prog;			/* Compiled program */
+  unsigned long used;		/* Time of last use */
+}
+regcache[NREGCACHE];
+
+static unsigned long regclock;	/* Incremented on every lookup */
+
+/*
+ - regcached - return the compiled program for "exp", compiling it only
+ * if it isn't already in the cache.  The program belongs to the cache,
+ * so the caller must not free it; it stays valid until NREGCACHE other
+ * patterns have been looked up.
+ */
+regexp *
+regcached (const char *exp)
+{
+  int i, lru;
+  regexp *prog;
+  char *copy;
+
+  if (exp == NULL)
+    FAIL ("NULL argument");
+  lru = 0;
+  for (i = 0; i < NREGCACHE; i++)
+    {
+      if (regcache[i].exp != NULL && strcmp (regcache[i].exp, exp) == 0)
+	{
+	  regcache[i].used = ++regclock;
+	  return (regcache[i].prog);
+	}
+      if (regcache[i].used < regcache[lru].used)
+	lru = i;
+    }
+
+  if ((prog = regcomp (exp)) == NULL)
+    return (NULL);
+  if ((copy = strdup (exp)) == NULL)
+    {
+      regfree (prog);
+      FAIL ("out of space");
+    }
+  if (regcache[lru].exp != NULL)
+    {
+      free (regcache[lru].exp);
+      regfree (regcache[lru].prog);
+    }
+  regcache[lru].exp = copy;
+  regcache[lru].prog = prog;
+  regcache[lru].used = ++regclock;
+  return (prog);
+}
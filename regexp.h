@@ -29,25 +29,32 @@
 #endif
 
 #define NSUBEXP  10
+
+/* Flags for regnexec.
+ */
+#define REG_NOTBOL	1	/* String doesn't start a line */
 typedef struct regexp
 {
   const char *startp[NSUBEXP];
   const char *endp[NSUBEXP];
 #if USE_PCRE2
   pcre2_code *re;		/* compiled regular expression */
-  pcre2_match_data *md;		/* result of a match */
 #else
   char regstart;		/* Internal use only. */
   char reganch;			/* Internal use only. */
   const char *regmust;		/* Internal use only. */
   int regmlen;			/* Internal use only. */
+  struct regdfa *regdfa;	/* Internal use only. */
   char program[1];		/* Unwarranted chumminess with compiler. */
 #endif
 }
 regexp;
 
 extern regexp *regcomp (const char *exp);
+extern regexp *regcached (const char *exp);
 extern int regexec (regexp * prog, const char *string);
+extern int regnexec (regexp * prog, const char *string, size_t len, int flags);
 extern int regsub (const regexp * prog, const char *source, char *dest, int destlen);
 extern void regerror (const char *s);
 extern void regfree (regexp * prog);
+extern void regdone (void);
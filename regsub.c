@@ -129,13 +129,8 @@ regsub (const regexp * rp, const char *source, char *dest, int destlen)
 	      return 0;
 	    }
 
-	  (void) strncpy (dst, prog->startp[no], len);
+	  memcpy (dst, prog->startp[no], len);
 	  dst += len;
-	  if (*(dst - 1) == '\0')
-	    {			/* strncpy hit NUL. */
-	      regerror ("damaged match string");
-	      return 0;
-	    }
 	}
     }
 
@@ -76,16 +76,6 @@
 
 #define CCHR(x)		((x)-'@')
 
-#define SRCH_BEGIN	(0)	/* Search sub-codes.    */
-#define	SRCH_FORW	(-1)
-#define SRCH_BACK	(-2)
-#define SRCH_PREV	(-3)
-#define SRCH_NEXT	(-4)
-#define SRCH_NOPR	(-5)
-#define SRCH_ACCM	(-6)
-#define SRCH_REGFORW	(-7)
-#define SRCH_REGBACK	(-8)
-
 typedef struct
 {
   int s_code;
@@ -96,7 +86,7 @@ SRCHCOM;
 
 static SRCHCOM cmds[NSRCH];
 static int cip;
-static regexp *regpat;
+static regexp *regpat;		/* Last program, owned by regcached */
 static wchar_t upat[NPAT];	/* Unicode copy of pat	*/
 int patlen;			/* # of Unicode characters in upat */
 
@@ -167,6 +157,31 @@ readpattern (const char *prompt)
   return (s);
 }
 
+/*
+ * Make "s" the search pattern without prompting, for
+ * commands that search on their own behalf.  If dir is a
+ * regular expression search, compile the pattern as well.
+ * Return FALSE if the pattern is too long, or if it isn't
+ * a valid regular expression.
+ */
+int
+setsearch (const char *s, int dir)
+{
+  if (strlen (s) >= NPAT)
+    {
+      eprintf ("Pattern too long");
+      return (FALSE);
+    }
+  strcpy ((char *) pat, s);
+  unicodepat ();
+  if (dir == SRCH_REGFORW || dir == SRCH_REGBACK)
+    {
+      if ((regpat = regcached (s)) == NULL)	/* regerror shows message */
+	return (FALSE);
+    }
+  return (TRUE);
+}
+
 /*
  * This routine does the real work of a regular expression
  * forward search. The pattern is sitting in the static
@@ -175,10 +190,10 @@ readpattern (const char *prompt)
  * is notified of the change, and TRUE is returned. If the
  * string isn't found, FALSE is returned.
  *
- * A copy of the line where the pattern was found is kept
- * around until the next search is performed, so that that
- * pointers to the pattern in regpat will still be valid
- * if regsub is called.  The copy is freed on the next search.
+ * The pattern is matched directly against the line text, so
+ * the pointers to the match in regpat point into the line
+ * itself.  They stay valid until the line is changed, which
+ * is after regsub has used them to build the replacement.
  */
 static int
 doregsrch (int dir)
@@ -186,10 +201,7 @@ doregsrch (int dir)
   LINE *clp;
   int cbo;
   LINE *lastline;
-  uchar *line;
-  int linelen;
-  static uchar *buf = NULL;
-  static int buflen = 0;
+  const char *line;
 
   clp = curwp->w_dot.p;
   cbo = curwp->w_dot.o;
@@ -201,47 +213,46 @@ doregsrch (int dir)
       /* Get byte offset of the UTF-8 character at cbo.
        */
       int offset = wloffset (clp, cbo);
-
-      /* Make a copy of the line in the temporary buffer.
+      int found, pos, start;
+
+      /* Search for the pattern in the part of the line after
+       * the dot (forward) or before it (reverse).  A search
+       * from the middle of the line mustn't let ^ match there.
+       * A reverse search wants the match nearest the dot, so
+       * it keeps looking after each match it finds, and uses
+       * the last one.  If found, calculate the character offset
+       * of the found string in the line, and set the dot to
+       * that location.
        */
+      line = (const char *) lgets (clp);
       if (dir == SRCH_REGFORW)
-	{
-	  line = lgets (clp) + offset;
-	  linelen = llength (clp) - offset;
-	}
+	found = regnexec (regpat, line + offset, llength (clp) - offset,
+			  offset > 0 ? REG_NOTBOL : 0);
       else
 	{
-	  line = lgets (clp);
-	  linelen = offset;
-	}
-      if (linelen + 1 > buflen)
-	{
-	  uchar *newbuf;
-
-	  buflen = linelen + 1;
-	  newbuf = (uchar *) realloc (buf, buflen);
-	  if (newbuf == NULL)
+	  found = regnexec (regpat, line, offset, 0);
+	  start = found ? regpat->startp[0] - line : 0;
+	  for (pos = start; found && pos < offset; )
 	    {
-	      eprintf ("Can't allocate %d bytes for searching", buflen);
-	      return (FALSE);
+	      pos += uclen ((const uchar *) line + pos);
+	      if (pos >= offset
+		  || !regnexec (regpat, line + pos, offset - pos, REG_NOTBOL)
+		  || regpat->startp[0] - line >= offset)
+		break;
+	      start = pos = regpat->startp[0] - line;
 	    }
-	  buf = newbuf;
+	  if (found)		/* Leave startp/endp at the chosen match */
+	    regnexec (regpat, line + start, offset - start,
+		      start > 0 ? REG_NOTBOL : 0);
 	}
-      memcpy (buf, line, linelen);
-      buf[linelen] = '\0';
-
-      /* Search for the pattern in the temporary buffer.
-       * If found, calculate the actual ending offset
-       * of the found string in the current line,
-       * and set the dot to that location.
-       */
-      if (regexec (regpat, (const char *) buf))
+      if (found)
 	{
 	  curwp->w_dot.p = clp;
 	  if (dir == SRCH_REGFORW)
-	    curwp->w_dot.o = unslen (buf, regpat->endp[0] - (char *) buf) + cbo;
+	    curwp->w_dot.o = unslen ((const uchar *) line,
+				     regpat->endp[0] - line);
 	  else
-	    curwp->w_dot.o = unslen (buf, regpat->startp[0] - (char *) buf);
+	    curwp->w_dot.o = unslen ((const uchar *) line, start);
 	  curwp->w_flag |= WFMOVE;
 	  return (TRUE);
 	}
@@ -284,11 +295,10 @@ regsearch (const char *prompt, int dir)
     return (s);
   srch_lastdir = dir;
 
-  /* Compile the pattern into a regexp program.
+  /* Compile the pattern into a regexp program, or find
+   * it in the cache if it has been used recently.
    */
-  if (regpat != NULL)
-    regfree (regpat);
-  if ((regpat = regcomp ((const char *) pat)) == NULL)	/* regerror shows message */
+  if ((regpat = regcached ((const char *) pat)) == NULL)	/* regerror shows message */
     return (FALSE);
 
   /* Search the current buffer for the pattern.
@@ -326,7 +336,8 @@ backregsearch (int f, int n, int k)
  * forward search. The pattern is sitting in the external
  * variable "pat". If found, dot is updated, the window system
  * is notified of the change, and TRUE is returned. If the
- * string isn't found, FALSE is returned.
+ * string isn't found, FALSE is returned.  The searching
+ * is done on the UTF-8 bytes by the functions in literal.c.
  */
 
 #ifndef SRCHASM
@@ -334,78 +345,15 @@ backregsearch (int f, int n, int k)
 static int
 forwsrch (void)
 {
-  LINE *clp;
-  const uchar *cend;
-  int cbo;
-  const uchar *cptr;
-  LINE *tlp;
-  const uchar *tend;
-  int tbo;
-  const uchar *tptr;
-  int pp;
-  LINE *lastline;
-  wchar_t uc;
-  int ulen;
+  POS pos;
 
-  clp = curwp->w_dot.p;
-  cbo = curwp->w_dot.o;
-  cend = lend (clp);
-  cptr = wlgetcptr (clp, cbo);
-  lastline = curbp->b_linep;
-  if (clp == lastline)
+  litcomp (pat);
+  pos = curwp->w_dot;
+  if (litforw (curbp, &pos) == FALSE)
     return (FALSE);
-  for (;;)
-    {
-    fail:
-      if (cptr >= cend)
-	{
-	  if ((clp = lforw (clp)) == lastline)
-	    return (FALSE);
-	  cend = lend (clp);
-	  cbo = 0;
-	  cptr = wlgetcptr (clp, cbo);
-	  if (upat[0] != '\n')
-	    goto fail;
-	}
-      else
-	{
-	  uc = ugetc (cptr, 0, &ulen);
-	  cptr += ulen;
-	  ++cbo;
-	  if (!CEQ (uc, upat[0]))
-	    goto fail;
-	}
-      tlp = clp;
-      tbo = cbo;
-      tptr = cptr;
-      tend = cend;
-      for (pp = 1; pp < patlen; pp++)
-	{
-	  if (tptr >= tend)
-	    {
-	      if ((tlp = lforw (tlp)) == lastline)
-		return (FALSE);
-	      if (upat[pp] != '\n')
-		goto fail;
-	      tend = lend (tlp);
-	      tbo = 0;
-	      tptr = lgets (tlp);
-	    }
-	  else
-	    {
-	      uc = ugetc (tptr, 0, &ulen);
-	      if (!CEQ (uc, upat[pp]))
-		goto fail;
-	      tptr += ulen;
-	      ++tbo;
-	    }
-	}
-      curwp->w_dot.p = tlp;
-      curwp->w_dot.o = tbo;
-      curwp->w_flag |= WFMOVE;
-      return (TRUE);
-    }
-  return (FALSE);
+  curwp->w_dot = pos;
+  curwp->w_flag |= WFMOVE;
+  return (TRUE);
 }
 
 /*
@@ -418,72 +366,15 @@ forwsrch (void)
 static int
 backsrch (void)
 {
-  LINE *clp;
-  int cbo;
-  const uchar *cptr;
-  LINE *tlp;
-  int tbo;
-  const uchar *tptr;
-  LINE *lastline;
-  int epp;
-  int pp;
-  wchar_t uc;
-  int ulen;
+  POS pos;
 
-  lastline = curbp->b_linep;
-  epp = patlen - 1;
-  clp = curwp->w_dot.p;
-  cbo = curwp->w_dot.o;
-  cptr = wlgetcptr (clp, cbo);
-  for (;;)
-    {
-    fail:
-      if (cbo == 0)
-	{
-	  if ((clp = lback (clp)) == lastline)
-	    return (FALSE);
-	  cbo = wllength (clp);
-	  cptr = wlgetcptr (clp, cbo);
-	  if (upat[epp] != '\n')
-	    goto fail;
-	}
-      else
-	{
-	  uc = ugetprevc (cptr, &ulen);
-	  cptr -= ulen;
-	  --cbo;
-	  if (!CEQ (uc, upat[epp]))
-	    goto fail;
-	}
-      tlp = clp;
-      tbo = cbo;
-      tptr = cptr;
-      pp = epp;
-      while (pp != 0)
-	{
-	  if (tbo == 0)
-	    {
-	      if ((tlp = lback (tlp)) == lastline)
-		return (FALSE);
-	      tbo = wllength (tlp);
-	      tptr = lend (tlp);
-	      if (upat[--pp] != '\n')
-		goto fail;
-	    }
-	  else
-	    {
-	      uc = ugetprevc (tptr, &ulen);
-	      if (!CEQ (uc, upat[--pp]))
-		goto fail;
-	      tptr -= ulen;
-	      --tbo;
-	    }
-	}
-      curwp->w_dot.p = tlp;
-      curwp->w_dot.o = tbo;
-      curwp->w_flag |= WFMOVE;
-      return (TRUE);
-    }
+  litcomp (pat);
+  pos = curwp->w_dot;
+  if (litback (curbp, &pos) == FALSE)
+    return (FALSE);
+  curwp->w_dot = pos;
+  curwp->w_flag |= WFMOVE;
+  return (TRUE);
 }
 
 #endif
@@ -545,6 +436,304 @@ searchagain (int f, int n, int k)
   return status;
 }
 
+/*
+ * The lines found by the last occur command.  Each
+ * entry points directly to a line in occurbp; the functions
+ * in line.c call occurmove when a line in the list is
+ * replaced or freed, so that the pointers stay valid as
+ * the buffer is edited.  Such lines have the LFOCCUR flag.
+ * Entry i is shown on line i + 1 of the list buffer.
+ */
+static BUFFER *occurbp;		/* Buffer searched, or NULL	*/
+static LINE **occurlp;		/* Matching lines		*/
+static int noccur;		/* Number of entries in occurlp	*/
+static int occursize;		/* Allocated size of occurlp	*/
+
+/*
+ * Hash chains of the entries in the occur list, by line,
+ * so that occurmove finds the entries for a line without
+ * looking at the whole list.  The chain for line lp starts
+ * at entry occurhead[occurchain (lp)], and goes on through
+ * occurnext; -1 ends a chain.  If the chains couldn't be
+ * allocated, occurhead is NULL and occurmove looks at
+ * every entry.
+ */
+static int *occurhead;		/* First entry of each chain	*/
+static int *occurnext;		/* Next entry in the same chain	*/
+static int occurbits;		/* Log2 of the number of chains	*/
+
+/*
+ * Return the number of the hash chain for line lp.
+ */
+static int
+occurchain (const LINE *lp)
+{
+  return ((unsigned int) ((size_t) lp >> 3) * 2654435761u)
+    >> (32 - occurbits);
+}
+
+/*
+ * Make the hash chains for the entries in the occur list.
+ */
+static void
+occurindex (void)
+{
+  int i, c, nhead;
+
+  for (occurbits = 4; (1 << occurbits) < 2 * noccur; occurbits++)
+    ;
+  nhead = 1 << occurbits;
+  occurhead = (int *) malloc (nhead * sizeof (int));
+  occurnext = (int *) malloc ((noccur + 1) * sizeof (int));
+  if (occurhead == NULL || occurnext == NULL)
+    {
+      free (occurhead);
+      free (occurnext);
+      occurhead = occurnext = NULL;
+      return;
+    }
+  for (c = 0; c < nhead; c++)
+    occurhead[c] = -1;
+  for (i = 0; i < noccur; i++)
+    {
+      c = occurchain (occurlp[i]);
+      occurnext[i] = occurhead[c];
+      occurhead[c] = i;
+    }
+}
+
+/*
+ * Forget the list of lines found by occur.
+ */
+static void
+occurfree (void)
+{
+  int i;
+
+  for (i = 0; i < noccur; i++)
+    if (occurlp[i] != NULL)
+      occurlp[i]->l_flag &= ~LFOCCUR;
+  noccur = 0;
+  occurbp = NULL;
+  free (occurhead);
+  free (occurnext);
+  occurhead = occurnext = NULL;
+}
+
+/*
+ * Line oldlp, which has the LFOCCUR flag, is being replaced
+ * by newlp, or is being freed if newlp is NULL.  Update
+ * the entries in the occur list that point to it.
+ */
+void
+occurmove (LINE *oldlp, LINE *newlp)
+{
+  int i, c, moved, *ip;
+
+  oldlp->l_flag &= ~LFOCCUR;
+  if (newlp != NULL)
+    newlp->l_flag |= LFOCCUR;
+  if (occurhead == NULL)
+    {
+      for (i = 0; i < noccur; i++)
+	if (occurlp[i] == oldlp)
+	  occurlp[i] = newlp;
+      return;
+    }
+
+  /* Take the entries for oldlp off its chain (there can be
+   * more than one after lines are joined), and put them
+   * on the chain for newlp.
+   */
+  moved = -1;
+  ip = &occurhead[occurchain (oldlp)];
+  while ((i = *ip) >= 0)
+    if (occurlp[i] == oldlp)
+      {
+	*ip = occurnext[i];
+	occurlp[i] = newlp;
+	occurnext[i] = moved;
+	moved = i;
+      }
+    else
+      ip = &occurnext[i];
+  if (newlp == NULL)
+    return;
+  c = occurchain (newlp);
+  while ((i = moved) >= 0)
+    {
+      moved = occurnext[i];
+      occurnext[i] = occurhead[c];
+      occurhead[c] = i;
+    }
+}
+
+/*
+ * The lines of buffer bp are all being freed.  If it's the
+ * buffer that occur searched, or the list buffer that shows
+ * what occur found, forget the list.
+ */
+void
+occurclear (BUFFER *bp)
+{
+  if (bp == occurbp || (bp == blistp && occurbp != NULL))
+    occurfree ();
+}
+
+/*
+ * Add line lp, whose zero-based line number is lineno, to
+ * the occur list, and add its text to the list buffer.
+ * Return FALSE if out of memory.
+ */
+static int
+occuradd (LINE *lp, int lineno)
+{
+  LINE **nlp;
+  static char line[512];
+
+  if (noccur == occursize)
+    {
+      occursize = occursize == 0 ? 64 : 2 * occursize;
+      nlp = (LINE **) realloc (occurlp, occursize * sizeof (LINE *));
+      if (nlp == NULL)
+	return (FALSE);
+      occurlp = nlp;
+    }
+  snprintf (line, sizeof (line), "%6d: %.*s", lineno + 1,
+	    llength (lp) < 400 ? llength (lp) : 400, (const char *) lgets (lp));
+  if (addline (line) == FALSE)
+    return (FALSE);
+  occurlp[noccur++] = lp;
+  lp->l_flag |= LFOCCUR;
+  return (TRUE);
+}
+
+/*
+ * Find all of the lines in the current buffer that contain
+ * a string, or a regular expression if there is an argument,
+ * and list them with their line numbers in a pop-up window.
+ * The buffer is searched once, from top to bottom.  Use
+ * goto-occurrence in the list to visit one of the lines.
+ */
+int
+occur (int f, int n, int k)
+{
+  BUFFER *bp = curbp;
+  LINE *lp, *prev;
+  POS pos;
+  int s, i, nl;
+  const uchar *cp;
+  static char line[NPAT + NBUFN + 32];
+
+  if (bp == blistp)
+    {
+      eprintf ("Can't search the list buffer");
+      return (FALSE);
+    }
+  if ((s = readpattern (f ? "Occur regexp" : "Occur")) != TRUE)
+    return (s);
+  if (f && (regpat = regcached ((const char *) pat)) == NULL)
+    return (FALSE);		/* regerror shows message */
+  blistp->b_flag &= ~BFCHG;	/* Blow away old.       */
+  if ((s = bclear (blistp)) != TRUE)
+    return (s);
+  strcpy (blistp->b_fname, "");
+  snprintf (line, sizeof (line), "Lines in %s containing %s:",
+	    bp->b_bname, (const char *) pat);
+  if (addline (line) == FALSE)
+    return (FALSE);
+  occurbp = bp;
+  prev = NULL;
+  if (f)
+    {
+      for (lp = firstline (bp), i = 0; lp != bp->b_linep; lp = lforw (lp), i++)
+	if (regnexec (regpat, (const char *) lgets (lp), llength (lp), 0)
+	    && occuradd (lp, i) == FALSE)
+	  return (FALSE);
+    }
+  else
+    {
+      /* Search with the literal matcher, and skip to the
+       * next line after each match.  A pattern containing
+       * newlines leaves pos at the last line of the match,
+       * so back up to the line where it started.
+       */
+      for (nl = 0, cp = pat; *cp != '\0'; cp++)
+	nl += *cp == '\n';
+      litcomp (pat);
+      pos.p = firstline (bp);
+      pos.o = 0;
+      while (litforw (bp, &pos))
+	{
+	  for (lp = pos.p, i = 0; i < nl; i++)
+	    lp = lback (lp);
+	  if (lp != prev && occuradd (lp, blineno (bp, lp)) == FALSE)
+	    return (FALSE);
+	  prev = lp;
+	  if ((pos.p = lforw (pos.p)) == bp->b_linep)
+	    break;
+	  pos.o = 0;
+	}
+    }
+  occurindex ();
+  eprintf ("[%d line%s]", noccur, noccur == 1 ? "" : "s");
+  return (popblist ());
+}
+
+/*
+ * In the list made by occur, visit the line
+ * that the dot is on.  The line is found through
+ * the pointer saved by occur, so it's the right line
+ * even if lines have been added or deleted since then.
+ */
+int
+occurgoto (int f, int n, int k)
+{
+  EWINDOW *wp;
+  LINE *lp;
+  int i;
+
+  if (curbp != blistp || occurbp == NULL)
+    {
+      eprintf ("Not in an occur list");
+      return (FALSE);
+    }
+  i = blineno (blistp, curwp->w_dot.p) - 1;
+  if (i < 0 || i >= noccur)
+    {
+      eprintf ("No line here");
+      return (FALSE);
+    }
+  if ((lp = occurlp[i]) == NULL)
+    {
+      eprintf ("That line has been deleted");
+      return (FALSE);
+    }
+
+  /* Use a window that's showing the buffer, if any.
+   * Otherwise, switch some other window to it.
+   */
+  ALLWIND (wp)
+  {
+    if (wp->w_bufp == occurbp)
+      break;
+  }
+  if (wp == NULL)
+    {
+      if ((wp = wpopup ()) == NULL)
+	return (FALSE);
+      curwp = wp;
+      if (usebuf (occurbp) == FALSE)
+	return (FALSE);
+    }
+  curwp = wp;
+  curbp = occurbp;
+  curwp->w_dot.p = lp;
+  curwp->w_dot.o = 0;
+  curwp->w_flag |= WFMOVE;
+  return (TRUE);
+}
+
 /*
  * Display regular expression error.
  * The regular expression compiler regcomp() calls this function when
@@ -657,7 +846,7 @@ is_find (int dir)
 {
   int plen;
 
-  plen = strlen ((const char *) pat);
+  plen = uslen (pat);		/* Characters, not bytes */
   if (plen != 0)
     {
       if (dir == SRCH_FORW || dir == SRCH_NEXT)
@@ -687,18 +876,234 @@ is_find (int dir)
   return (FALSE);
 }
 
+/*
+ * The match counter for incremental search.  While isearch is
+ * waiting for a key, is_count finds the matches of the pattern
+ * a batch of lines at a time, the way big files are read in the
+ * background, so that the count never holds up typing.  The buffer
+ * can't change during an incremental search, so the positions
+ * found stay valid for the whole search.  When a character is added
+ * to the end of the pattern, every new match must be at one of the
+ * old matches, so only those positions are checked, instead of
+ * the whole buffer.  Matches can overlap, just as successive
+ * C-S commands can find overlapping matches.
+ */
+#define ISBATCH	2000		/* Lines searched per step	*/
+#define ISCHECK	20000		/* Old matches checked per step	*/
+
+typedef struct
+{
+  LINE *m_lp;			/* Line containing match	*/
+  int m_line;			/* Zero-based line number	*/
+  int m_off;			/* Byte offset in line		*/
+}
+ISMATCH;
+
+static ISMATCH *is_match;	/* Matches found so far		*/
+static int is_nmatch;		/* Number of entries in is_match */
+static int is_msize;		/* Allocated size of is_match	*/
+static int is_check;		/* Next old match to check	*/
+static int is_checkend;		/* End of old matches to check	*/
+static int is_keep;		/* Old matches still matching	*/
+static LINE *is_lp;		/* Next line to search, or NULL	*/
+static int is_line;		/* Line number of is_lp		*/
+static int is_failed;		/* Out of memory, no count	*/
+static char is_cpat[NPAT];	/* Pattern being counted	*/
+
+/*
+ * Forget the matches found by is_count.
+ */
+static void
+is_countfree (void)
+{
+  free ((char *) is_match);
+  is_match = NULL;
+  is_nmatch = is_msize = 0;
+  is_check = is_checkend = is_keep = 0;
+  is_lp = NULL;
+  is_failed = FALSE;
+  is_cpat[0] = '\0';
+}
+
+/*
+ * Add a match at byte offset "off" of line "lp", whose
+ * line number is "line", to the list of matches.
+ */
+static void
+is_addmatch (LINE *lp, int line, int off)
+{
+  ISMATCH *mp;
+
+  if (is_nmatch == is_msize)
+    {
+      is_msize = is_msize == 0 ? 256 : 2 * is_msize;
+      mp = (ISMATCH *) realloc (is_match, is_msize * sizeof (ISMATCH));
+      if (mp == NULL)
+	{
+	  is_failed = TRUE;
+	  return;
+	}
+      is_match = mp;
+    }
+  mp = &is_match[is_nmatch++];
+  mp->m_lp = lp;
+  mp->m_line = line;
+  mp->m_off = off;
+}
+
+/*
+ * Do the next step of counting the matches of the pattern "pat".
+ * If the pattern has changed since the last step, start again,
+ * unless a character was just added to it.  Return TRUE if
+ * there is more work to do.
+ */
+static int
+is_count (void)
+{
+  int len, clen, n, off, multi;
+  LINE *lp;
+
+  len = strlen ((const char *) pat);
+  clen = strlen (is_cpat);
+  if (strcmp ((const char *) pat, is_cpat) != 0)
+    {
+      if (clen > 0 && len == clen + 1 && !is_failed
+	  && strncmp ((const char *) pat, is_cpat, clen) == 0)
+	{
+	  /* Drop the old matches already rejected by an
+	   * unfinished check, then check them all again.
+	   */
+	  memmove (&is_match[is_keep], &is_match[is_check],
+		   (is_nmatch - is_check) * sizeof (ISMATCH));
+	  is_nmatch -= is_check - is_keep;
+	  is_check = is_keep = 0;
+	  is_checkend = is_nmatch;
+	}
+      else
+	{
+	  is_nmatch = is_check = is_checkend = is_keep = 0;
+	  is_lp = firstline (curbp);
+	  is_line = 0;
+	  is_failed = FALSE;
+	}
+      strcpy (is_cpat, (const char *) pat);
+    }
+  if (len == 0 || is_failed)
+    return (FALSE);
+  litcomp (pat);
+
+  /* Check the old matches first.
+   */
+  if (is_check < is_checkend)
+    {
+      for (n = 0; n < ISCHECK && is_check < is_checkend; n++, is_check++)
+	if (litat (curbp, is_match[is_check].m_lp, is_match[is_check].m_off))
+	  is_match[is_keep++] = is_match[is_check];
+      if (is_check == is_checkend)
+	{
+	  is_nmatch = is_keep;
+	  is_check = is_checkend = is_keep = 0;
+	}
+      return (TRUE);
+    }
+
+  /* Then search the next batch of lines.
+   */
+  multi = strchr ((const char *) pat, '\n') != NULL;
+  for (n = 0; n < ISBATCH && is_lp != NULL; n++)
+    {
+      lp = is_lp;
+      for (off = 0; (off = litfind (curbp, lp, off)) >= 0;)
+	{
+	  is_addmatch (lp, is_line, off);
+	  if (multi || off >= llength (lp) || is_failed)
+	    break;
+	  off += uclen (lgets (lp) + off);
+	}
+      if ((is_lp = lforw (lp)) == curbp->b_linep || is_failed)
+	is_lp = NULL;
+      is_line++;
+    }
+  return (is_lp != NULL);
+}
+
+/*
+ * Make the match count part of the incremental search prompt,
+ * such as "37 of 1204", and store it in buf.  If the search
+ * is successful, the dot is just past the current match
+ * (searching forward) or at its start (searching backward).
+ * A "+" means the count isn't finished.  Store an empty string
+ * if there is no count yet.
+ */
+static void
+is_countstr (char *buf, int size, int dir, int success)
+{
+  POS pos;
+  int i, lo, hi, line, off;
+  const char *more = is_lp != NULL ? "+" : "";
+
+  buf[0] = '\0';
+  if (is_failed || is_cpat[0] == '\0' || is_check < is_checkend
+      || strcmp ((const char *) pat, is_cpat) != 0)
+    return;
+  if (!success)
+    {
+      snprintf (buf, size, " [%d%s]", is_nmatch, more);
+      return;
+    }
+
+  /* Find the start of the current match.  The offsets
+   * in a line count characters, not bytes.
+   */
+  pos = curwp->w_dot;
+  if (dir == SRCH_FORW)
+    for (i = uslen (pat); i > 0; i--)
+      {
+	if (pos.o > 0)
+	  pos.o--;
+	else
+	  {
+	    pos.p = lback (pos.p);
+	    pos.o = wllength (pos.p);
+	  }
+      }
+  line = blineno (curbp, pos.p);
+  off = wloffset (pos.p, pos.o);
+  if (is_lp != NULL && line >= is_line)
+    {
+      snprintf (buf, size, " [%d%s]", is_nmatch, more);
+      return;
+    }
+
+  /* Count the matches that start at or before it.
+   */
+  lo = 0;
+  hi = is_nmatch;
+  while (lo < hi)
+    {
+      i = (lo + hi) / 2;
+      if (is_match[i].m_line < line
+	  || (is_match[i].m_line == line && is_match[i].m_off <= off))
+	lo = i + 1;
+      else
+	hi = i;
+    }
+  snprintf (buf, size, " [%d of %d%s]", lo, is_nmatch, more);
+}
+
 /*
  * Prompt writing routine for the incremental search. 
  * The "prompt" is just a string. The "flag" determines
- * if a "[ ]" or ":" embelishment is used.
+ * if a "[ ]" or ":" embelishment is used.  The match
+ * count "count" goes between the prompt and the ":".
  */
 static void
-is_dspl (const char *prompt, int flag)
+is_dspl (const char *prompt, int flag, const char *count)
 {
   if (flag != FALSE)
     eprintf ("%s [%s]", prompt, pat);
   else
-    eprintf ("%s: %s", prompt, pat);
+    eprintf ("%s%s: %s", prompt, count, pat);
 }
 
 /*
@@ -712,19 +1117,22 @@ is_dspl (const char *prompt, int flag)
 static void
 is_prompt (int dir, int flag, int success)
 {
+  char count[40];
+
+  is_countstr (count, sizeof (count), dir, success);
   if (dir == SRCH_FORW)
     {
       if (success != FALSE)
-	is_dspl ("i-search forward", flag);
+	is_dspl ("i-search forward", flag, count);
       else
-	is_dspl ("failing i-search forward", flag);
+	is_dspl ("failing i-search forward", flag, count);
     }
   else if (dir == SRCH_BACK)
     {
       if (success != FALSE)
-	is_dspl ("i-search backward", flag);
+	is_dspl ("i-search backward", flag, count);
       else
-	is_dspl ("failing i-search backward", flag);
+	is_dspl ("failing i-search backward", flag, count);
     }
 }
 
@@ -740,13 +1148,14 @@ is_prompt (int dir, int flag, int success)
  *	else	accumulate into search string
  */
 static int
-isearch (int dir)
+isearch1 (int dir)
 {
   int c;
   LINE *clp;
   int cbo;
   int success;
   int pptr;
+  int more;
   int fkey, bkey;		/* keys bound to commands */
 
   /* Get the bindings for incremental search so user can use those
@@ -771,6 +1180,17 @@ isearch (int dir)
   for (;;)
     {
       update ();
+
+      /* Count the matches while no keys are waiting.
+       */
+      while (pptr > 0 && !inprof && kbdmop == NULL && ttwait (0) == FALSE)
+	{
+	  more = is_count ();
+	  is_prompt (dir, FALSE, success);
+	  update ();
+	  if (more == FALSE)
+	    break;
+	}
       c = getinp ();
       if (c == fkey)
 	c = CCHR ('S');
@@ -897,6 +1317,20 @@ isearch (int dir)
     }
 }
 
+/*
+ * Do an incremental search, then free the list of
+ * matches that was used to count them.
+ */
+static int
+isearch (int dir)
+{
+  int s;
+
+  s = isearch1 (dir);
+  is_countfree ();
+  return (s);
+}
+
 /*
  * Print the number of replacements performed by a query-replace
  * or a replace-string.
@@ -958,6 +1392,153 @@ getrepl (int dir, char *news, char *sub, int sublen, int *plen)
   return str;
 }
 
+/*
+ * Replace the text that replall has collected for line lp, which is
+ * everything from offset start to offset end, with the "len" bytes
+ * in the replacement buffer.  This takes one deletion and one
+ * insertion, instead of the per-character changes made by lreplace,
+ * so the line is rebuilt once, and undo gets three records for it.
+ * The dot is left where it was, unless it was on line lp.
+ * The saved line *clpp is updated if it was line lp and moved.
+ * Return TRUE if all is well, and FALSE on errors.
+ */
+static int
+replline (LINE *lp, int start, int end, uchar *buf, int len, LINE **clpp)
+{
+  POS dot;
+
+  dot = curwp->w_dot;
+  curwp->w_savep = *clpp;
+  curwp->w_dot.p = lp;
+  curwp->w_dot.o = start;
+  saveundo (UMOVE, &curwp->w_dot);
+  if (ldelete (end - start, FALSE) == FALSE
+      || (len > 0 && linsert (len, 0, (char *) buf) == FALSE))
+    return (FALSE);
+  *clpp = curwp->w_savep;
+  if (dot.p != lp)
+    curwp->w_dot = dot;
+  return (TRUE);
+}
+
+/*
+ * Replace the string just found at the dot, and all of the
+ * following ones, without asking; this is the '!' response
+ * to query-replace.  Instead of replacing each string with lreplace
+ * as it is found, collect the new text for each line, from its
+ * first found string to its last, and replace it all at once
+ * with replline.  The case of the replacement strings is
+ * adjusted in the same way as lreplace, and the patterns
+ * are found in the unchanged text, so the result is the same.
+ *
+ * If the pattern or replacement string contains a newline,
+ * the found strings can span lines, or the replacements can
+ * create new lines, so use lreplace for each one instead.
+ *
+ * The number of replacements is added to *rcntp.  The saved
+ * dot line *clpp is updated as in searchandreplace.
+ */
+static int
+replall (int dir, char *news, int f, LINE **clpp, int *rcntp)
+{
+  char sub[NPAT];		/* regsub-modified replacement	*/
+  char *repl;			/* replacement string		*/
+  int plen;			/* length of found string	*/
+  LINE *lp;			/* line being collected		*/
+  int start;			/* offset of first found string	*/
+  int done;			/* offset of end of collected text */
+  int len;			/* bytes in the replacement buffer */
+  int mstart, mend;		/* offsets of found string	*/
+  const uchar *from, *to;
+  static uchar *buf = NULL;	/* new text for line lp		*/
+  static int buflen = 0;
+
+  if (strchr (news, '\n') != NULL || strchr ((const char *) pat, '\n') != NULL)
+    {
+      do
+	{
+	  curwp->w_savep = *clpp;
+	  repl = getrepl (dir, news, sub, sizeof (sub), &plen);
+	  if (lreplace (plen, repl, f) == FALSE)
+	    return (FALSE);
+	  ++*rcntp;
+	  *clpp = curwp->w_savep;
+	}
+      while (dosearch (dir) == TRUE);
+      return (TRUE);
+    }
+
+  lp = NULL;
+  start = done = len = 0;
+  do
+    {
+      /* Get the replacement while regpat still points
+       * at the found string, and find where it starts.
+       */
+      repl = getrepl (dir, news, sub, sizeof (sub), &plen);
+      mend = curwp->w_dot.o;
+      mstart = mend - plen;
+      if (curwp->w_dot.p == lp && mstart == mend && mstart == done)
+	{
+	  /* Skip an empty string found right after the last one.
+	   */
+	  goto skip;
+	}
+      if (curwp->w_dot.p != lp)
+	{
+	  if (lp != NULL && replline (lp, start, done, buf, len, clpp) == FALSE)
+	    return (FALSE);
+	  lp = curwp->w_dot.p;
+	  start = done = mstart;
+	  len = 0;
+	}
+
+      /* Add the unchanged text before the found string, and the
+       * replacement for it, to the buffer.
+       */
+      from = wlgetcptr (lp, done);
+      to = wlgetcptr (lp, mstart);
+      if (len + (to - from) + 2 * (int) strlen (repl) > buflen)
+	{
+	  uchar *newbuf;
+	  int newlen;
+
+	  newlen = 2 * (len + (to - from) + 2 * strlen (repl));
+	  newbuf = (uchar *) realloc (buf, newlen);
+	  if (newbuf == NULL)
+	    {
+	      eprintf ("Can't allocate %d bytes for replacing", newlen);
+	      return (FALSE);
+	    }
+	  buf = newbuf;
+	  buflen = newlen;
+	}
+      memcpy (buf + len, from, to - from);
+      len += to - from;
+      len += lrepltext (buf + len, repl, lp, mstart, f);
+      done = mend;
+      ++*rcntp;
+
+      /* Don't find an empty string in the same place again.
+       */
+    skip:
+      if (mstart == mend)
+	{
+	  if (mend < wllength (lp))
+	    curwp->w_dot.o++;
+	  else if ((curwp->w_dot.p = lforw (lp)) == curbp->b_linep)
+	    break;
+	  else
+	    curwp->w_dot.o = 0;
+	}
+    }
+  while (dosearch (dir) == TRUE);
+  if (replline (lp, start, done, buf, len, clpp) == FALSE)
+    return (FALSE);
+  lchange (WFHARD);
+  return (TRUE);
+}
+
 /*
  * Helper function for all search and replace functions:
  *      If query is TRUE, prompt the user for each replacement:
@@ -973,13 +1554,6 @@ searchandreplace (int f, int query, int dir)
 {
   int s;
   char news[NPAT];		/* replacement string           */
-  char sub[NPAT];		/* regsub-modified replacement	*/
-  char *repl;			/* correct replacement string	*/
-  LINE *clp;		/* saved line pointer           */
-  int cbo;			/* offset into the saved line   */
-  int rcnt = 0;			/* Replacements made so far     */
-  int plen;			/* length of found string       */
-  int c;			/* input character		*/
   const char *oldprompt;	/* regexp or string?		*/
   const char *newprompt;	/* new string or replacement?	*/
 
@@ -1002,12 +1576,30 @@ searchandreplace (int f, int query, int dir)
    */
   if (dir == SRCH_REGFORW || dir == SRCH_REGBACK)
     {
-      if (regpat != NULL)
-	regfree (regpat);
-      if ((regpat = regcomp ((const char *) pat)) == NULL)	/* regerror shows message */
+      if ((regpat = regcached ((const char *) pat)) == NULL)	/* regerror shows message */
 	return (FALSE);
     }
 
+  return (doreplace (f, query, dir, news));
+}
+
+/*
+ * Replace the strings matching the current pattern after
+ * the dot with news, as described for searchandreplace.
+ * For a regular expression operation, the pattern must already
+ * have been compiled into regpat.  The dot is left where it was.
+ */
+int
+doreplace (int f, int query, int dir, char *news)
+{
+  char sub[NPAT];		/* regsub-modified replacement	*/
+  char *repl;			/* correct replacement string	*/
+  LINE *clp;		/* saved line pointer           */
+  int cbo;			/* offset into the saved line   */
+  int rcnt = 0;			/* Replacements made so far     */
+  int plen;			/* length of found string       */
+  int c;			/* input character		*/
+
   if (query)
     eprintf ("[Query Replace:  \"%s\" -> \"%s\"]", pat, news);
 
@@ -1069,16 +1661,8 @@ searchandreplace (int f, int query, int dir)
 	  goto stopsearch;
 
 	case '!':
-	  do
-	    {
-	      curwp->w_savep = clp;
-	      repl = getrepl (dir, news, sub, sizeof (sub), &plen);
-	      if (lreplace (plen, repl, f) == FALSE)
-		return (FALSE);
-	      rcnt++;
-	      clp = curwp->w_savep;
-	    }
-	  while (dosearch (dir) == TRUE);
+	  if (replall (dir, news, f, &clp, &rcnt) == FALSE)
+	    return (FALSE);
 	  goto stopsearch;
 
 	case 'n':
@@ -219,7 +219,22 @@ KEY key[] = {
   {-1,			createframe,	"create-frame"},
   {-1,			nextframe,	"forw-frame"},
   {-1,			prevframe,	"back-frame"},
-  {-1,			listframes,	"display-frames"}
+  {-1,			listframes,	"display-frames"},
+  {-1,			updatestats,	"display-update-stats"},
+  {-1,			listarenas,	"display-arenas"},
+  {-1,			setpiecetable,	"set-piece-table"},
+  {-1,			setbgread,	"set-background-read"},
+  {-1,			setatomicsave,	"set-atomic-save"},
+  {-1,			setjournal,	"set-journal"},
+  {-1,			benchbackends,	"bench-backends"},
+  {-1,			benchsearch,	"bench-search"},
+  {-1,			projgrep,	"project-grep"},
+  {-1,			setgrepinclude,	"set-grep-include"},
+  {-1,			setgrepexclude,	"set-grep-exclude"},
+  {-1,			setgreplimit,	"set-grep-limit"},
+  {-1,			makegrepindex,	"make-grep-index"},
+  {-1,			occur,		"occur"},
+  {-1,			occurgoto,	"goto-occurrence"}
 };
 
 #define	NKEY	(sizeof(key) / sizeof(key[0]))
@@ -196,6 +196,167 @@ fillbuf (void)
 }
 
 
+/*
+ * Read all of the file opened by ffropen into memory in
+ * one go, for the piece table method of reading files.
+ * Return the address of the image to *bufp and its size
+ * to *nbytes; the image ends at the first ctrl-Z if zflag
+ * is set.  The image must be freed with fffreeimage.
+ * Return FIOERR if the file can't be read into memory;
+ * the caller then falls back to ffgetline.
+ */
+int
+ffgetimage (uchar **bufp, long *nbytes)
+{
+  struct stat st;
+  uchar *image, *z;
+
+  if (fstat (ffp, &st) != 0 || (st.st_mode & S_IFREG) == 0)
+    return (FIOERR);
+  if ((image = (uchar *) malloc (st.st_size + 1)) == NULL)
+    return (FIOERR);
+  if (read (ffp, image, st.st_size) != st.st_size)
+    {
+      free (image);
+      lseek (ffp, 0L, SEEK_SET);
+      cindex = csize = 0;
+      return (FIOERR);
+    }
+  *bufp = image;
+  *nbytes = st.st_size;
+  if (zflag && (z = (uchar *) memchr (image, CTRLZ, st.st_size)) != NULL)
+    *nbytes = z - image;
+  return (FIOSUC);
+}
+
+/*
+ * Files aren't split into lines ahead of time
+ * on this system, so there are never any newline offsets
+ * for an image.
+ */
+long
+ffgetsplit (long **endsp)
+{
+  return (-1);
+}
+
+/*
+ * Preloading files in threads isn't supported
+ * on this system; they're read one at a time by readin.
+ */
+void
+ffpreload (const char **names, int n)
+{
+}
+
+/*
+ * Nothing to clean up after preloading.
+ */
+void
+ffpreloaddone (void)
+{
+}
+
+/*
+ * Read the file "path" into memory, and pass it to "scan".
+ * Return the scan function's result, which is FALSE if the
+ * walk should stop.
+ */
+static int
+walkfile (const char *path,
+	  int (*scan) (const char *path, const uchar *buf, long n, int w))
+{
+  struct stat st;
+  uchar *image;
+  int fd, s;
+
+  if ((fd = open (path, O_RDONLY | O_BINARY)) < 0)
+    return (TRUE);
+  if (fstat (fd, &st) != 0 || st.st_size == 0
+      || (image = (uchar *) malloc (st.st_size)) == NULL)
+    {
+      close (fd);
+      return (TRUE);
+    }
+  s = TRUE;
+  if (read (fd, image, st.st_size) == st.st_size)
+    s = scan (path, image, st.st_size, 0);
+  close (fd);
+  free (image);
+  return (s);
+}
+
+/*
+ * Visit the directory "dir" and everything under it.
+ * Return FALSE if the scan function asked to stop.
+ */
+static int
+walkdir (const char *dir,
+	 int (*want) (const char *path, int isdir),
+	 int (*scan) (const char *path, const uchar *buf, long n, int w))
+{
+  DIR *dirp;
+  struct dirent *dp;
+  struct stat st;
+  char path[NFILEN];
+  int isdir, s;
+
+  if ((dirp = opendir (dir)) == NULL)
+    return (TRUE);
+  s = TRUE;
+  while (s == TRUE && (dp = readdir (dirp)) != NULL)
+    {
+      if (strcmp (dp->d_name, ".") == 0 || strcmp (dp->d_name, "..") == 0)
+	continue;
+      if (strcmp (dir, ".") == 0)
+	snprintf (path, sizeof (path), "%s", dp->d_name);
+      else if (snprintf (path, sizeof (path), "%s/%s", dir, dp->d_name)
+	       >= (int) sizeof (path))
+	continue;
+      if (stat (path, &st) != 0)
+	continue;
+      if (S_ISDIR (st.st_mode))
+	isdir = TRUE;
+      else if (S_ISREG (st.st_mode))
+	isdir = FALSE;
+      else
+	continue;
+      if (!want (path, isdir))
+	continue;
+      if (isdir)
+	s = walkdir (path, want, scan);
+      else
+	s = walkfile (path, scan);
+    }
+  closedir (dirp);
+  return (s);
+}
+
+/*
+ * Walk the tree of files under directory "dir", calling "want"
+ * to ask if each directory and regular file should be visited,
+ * and "scan" with the contents of each file visited.  There are
+ * no threads on this system, so everything is done by "thread" 0.
+ */
+int
+ffwalk (const char *dir,
+	int (*want) (const char *path, int isdir),
+	int (*scan) (const char *path, const uchar *buf, long n, int w))
+{
+  walkdir (dir, want, scan);
+  scan (NULL, NULL, 0, 0);
+  return (TRUE);
+}
+
+/*
+ * Free a file image obtained from ffgetimage.
+ */
+void
+fffreeimage (uchar *buf, long nbytes)
+{
+  free (buf);
+}
+
 /*
  * Read a line from a file, and store the bytes
  * in a local buffer. Stop on end of file or end of
@@ -437,6 +598,54 @@ ffpclose (void)
 }
 
 
+/*
+ * Open the journal file "fn" for writing, creating it
+ * if necessary.  If "append" is FALSE, the file is emptied
+ * first.  Store the file descriptor in *fdp, and return FIOSUC,
+ * or FIOERR on error.
+ */
+int
+ffjopen (const char *fn, int append, int *fdp)
+{
+  int fd;
+
+  fd = open (fn, O_WRONLY | O_CREAT | O_BINARY
+	     | (append ? O_APPEND : O_TRUNC), S_IREAD | S_IWRITE);
+  if (fd < 0)
+    {
+      eprintf ("Cannot open journal file %s", fn);
+      return (FIOERR);
+    }
+  *fdp = fd;
+  return (FIOSUC);
+}
+
+/*
+ * Write "n" bytes from "buf" to the journal file
+ * whose descriptor is "fd".  Return the status.
+ */
+int
+ffjwrite (int fd, const char *buf, int n)
+{
+  if (write (fd, buf, n) != n)
+    {
+      eprintf ("Journal write error");
+      return (FIOERR);
+    }
+  return (FIOSUC);
+}
+
+/*
+ * Close the journal file whose descriptor is "fd".
+ */
+int
+ffjclose (int fd)
+{
+  if (close (fd) != 0)
+    return (FIOERR);
+  return (FIOSUC);
+}
+
 /*
  * Find the first or next file that matches the first 'cpos' characters
  * in the filename 'name'.  Returns a pointer to a static buffer
@@ -25,6 +25,10 @@
  * By:		Mark Alexander
  *		drivax!alexande
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* For file leases and mremap	*/
+#endif
+
 #include	"def.h"
 
 #ifdef __hpux
@@ -34,38 +38,336 @@
 
 #include	<sys/types.h>
 #include	<sys/stat.h>
+#include	<sys/mman.h>
+#include	<sys/uio.h>
+#include	<fcntl.h>
+#include	<errno.h>
 #include	<dirent.h>
 #include	<pwd.h>
 #include	<unistd.h>
 #include	<stdlib.h>
+#include	<signal.h>
+#include	<pthread.h>
 
-static FILE *ffp, *pfp, *jfp;	/* text, profile, and journal files     */
+static FILE *ffp, *pfp;		/* text and profile files		*/
 
 /* Buffer for ffgetline.  Dynamically allocated to handle any line length.
  */
 static char *buf;		/* dynamic line buffer */
 static int bufsize;		/* size of line buffer */
 
+/* Images of files obtained from ffgetimage.  An image is
+ * normally a copy of the file read into anonymous memory.  But on
+ * Linux, if MicroEMACS can get a read lease on the file, which
+ * makes the kernel tell it before anybody writes to or truncates
+ * the file, the file is mapped into memory instead.  When the
+ * lease is broken, or MicroEMACS is about to write the file
+ * itself, detach copies the mapped pages into anonymous memory
+ * at the same address, so the lines that point into the image
+ * never change.
+ */
+typedef struct MAPPING
+{
+  struct MAPPING *m_next;	/* Next mapping			*/
+  uchar *m_buf;			/* Address of mapping		*/
+  long m_size;			/* Size of mapping		*/
+  dev_t m_dev;			/* Device of mapped file	*/
+  ino_t m_ino;			/* Inode of mapped file		*/
+  int m_fd;			/* Leased file, or -1 if a copy	*/
+}
+MAPPING;
+
+static MAPPING *mappings;	/* List of mapped files		*/
+static char tmpname[NFILEN + 8]; /* New file being written	*/
+static char newname[NFILEN];	/* Name to give it when closed	*/
+
+/* Output buffer for ffputline.
+ */
+#define	OBUFSIZE	(256 * 1024)
+static int wfd = -1;		/* file being written, or -1	*/
+static char obuf[OBUFSIZE];	/* buffered lines		*/
+static int oused;		/* bytes used in obuf		*/
+static int werror;		/* TRUE after a write error	*/
+
+/* Files named on the command line, which are read into
+ * memory and split into lines by a pool of threads while
+ * the editor is starting up.  When readin opens one of them,
+ * ffgetimage and ffgetsplit hand over the results.
+ */
+#define	NPRELOAD	8		/* Max threads reading files	*/
+#define	PRELOADMAX	(64L * 1024 * 1024) /* Bigger files aren't preloaded */
+
+typedef struct PRELOAD
+{
+  const char *p_fname;		/* File name, NULL once opened	*/
+  int p_done;			/* TRUE when a thread is done	*/
+  uchar *p_buf;			/* Image of file, or NULL	*/
+  long p_size;			/* Size of image		*/
+  dev_t p_dev;			/* Device of file		*/
+  ino_t p_ino;			/* Inode of file		*/
+  long *p_ends;			/* Offsets of the newlines	*/
+  long p_nends;			/* Number of newlines		*/
+}
+PRELOAD;
+
+static PRELOAD *preloads;	/* Files being preloaded	*/
+static int npreload;		/* Number of them		*/
+static int nextpreload;		/* Next one for a thread	*/
+static pthread_t prethreads[NPRELOAD];
+static int nprethread;		/* Number of threads running	*/
+static pthread_mutex_t prelock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t predone = PTHREAD_COND_INITIALIZER;
+static PRELOAD *curpre;		/* Preload of file being read	*/
+
+/*
+ * Block SIGIO in the calling thread if "block" is TRUE,
+ * or unblock it.  The main thread blocks it while it changes
+ * the list of mappings, and the other threads block it
+ * all the time, so that leasebroken never sees the
+ * list half changed.
+ */
+static void
+blockio (int block)
+{
+  sigset_t set;
+
+  sigemptyset (&set);
+  sigaddset (&set, SIGIO);
+  pthread_sigmask (block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
+
+/*
+ * Detach the leased mapping "mp" from its file: copy it into
+ * anonymous memory, move that over the mapping, and give up
+ * the lease.  If there isn't enough memory for the copy, the
+ * lease is still given up, so that the program waiting for it
+ * isn't held up.  This is called from a signal handler,
+ * so it mustn't use stdio or malloc.
+ */
+static void
+detach (MAPPING *mp)
+{
+#ifdef F_SETLEASE
+  void *copy;
+
+  copy = mmap (NULL, mp->m_size, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (copy != MAP_FAILED)
+    {
+      memcpy (copy, mp->m_buf, mp->m_size);
+      if (mremap (copy, mp->m_size, mp->m_size, MREMAP_MAYMOVE | MREMAP_FIXED,
+		  mp->m_buf) == MAP_FAILED)
+	munmap (copy, mp->m_size);
+    }
+  fcntl (mp->m_fd, F_SETLEASE, F_UNLCK);
+  close (mp->m_fd);
+  mp->m_fd = -1;
+#endif
+}
+
+#ifdef F_SETLEASE
+/*
+ * Handler for SIGIO, which the kernel sends when another
+ * program wants to write to or truncate a file that
+ * MicroEMACS has a lease on.  The signal doesn't say which
+ * file, so detach every mapping whose lease is being broken.
+ */
+static void
+leasebroken (int sig)
+{
+  MAPPING *mp;
+  int olderrno = errno;
+
+  for (mp = mappings; mp != NULL; mp = mp->m_next)
+    if (mp->m_fd >= 0 && fcntl (mp->m_fd, F_GETLEASE) != F_RDLCK)
+      detach (mp);
+  errno = olderrno;
+}
+#endif
+
+/*
+ * Detach all of the mappings from their files.  This is
+ * done before MicroEMACS stops itself to return to the shell,
+ * because it couldn't answer a broken lease while stopped.
+ */
+void
+ffdetach (void)
+{
+  MAPPING *mp;
+
+  blockio (TRUE);
+  for (mp = mappings; mp != NULL; mp = mp->m_next)
+    if (mp->m_fd >= 0)
+      detach (mp);
+  blockio (FALSE);
+}
+
+/*
+ * Map the file open on "fd", which "stp" describes, into memory,
+ * if a read lease can be taken on it.  The file is stat'ed again
+ * once the lease is held, in case it changed before then.
+ * Return the address of the mapping, and the leased descriptor
+ * to *fdp, or MAP_FAILED if the file can't be leased or mapped.
+ */
+static void *
+leasemap (int fd, struct stat *stp, int *fdp)
+{
+#ifdef F_SETLEASE
+  static int handled;
+  struct sigaction sa;
+  void *image;
+  int lfd;
+
+  if (!handled)
+    {
+      memset (&sa, 0, sizeof (sa));
+      sa.sa_handler = leasebroken;
+      sa.sa_flags = SA_RESTART;
+      sigemptyset (&sa.sa_mask);
+      if (sigaction (SIGIO, &sa, NULL) != 0)
+	return (MAP_FAILED);
+      handled = TRUE;
+    }
+  if ((lfd = fcntl (fd, F_DUPFD_CLOEXEC, 0)) < 0)
+    return (MAP_FAILED);
+  if (fcntl (lfd, F_SETLEASE, F_RDLCK) == 0)
+    {
+      if (fstat (lfd, stp) == 0 && stp->st_size > 0
+	  && (size_t) stp->st_size == stp->st_size)
+	{
+	  image = mmap (NULL, stp->st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, lfd, 0);
+	  if (image != MAP_FAILED)
+	    {
+	      *fdp = lfd;
+	      return (image);
+	    }
+	}
+      fcntl (lfd, F_SETLEASE, F_UNLCK);
+    }
+  close (lfd);
+#endif
+  return (MAP_FAILED);
+}
+
+/*
+ * Read the "size" bytes of the file open on "fd" into anonymous
+ * memory.  If the file has got shorter, read what is there.
+ * Return the address of the copy and its size to *nbytes,
+ * or MAP_FAILED if the copy can't be made or is empty.
+ */
+static void *
+readimage (int fd, long size, long *nbytes)
+{
+  void *image;
+  ssize_t n;
+  long got;
+
+  image = mmap (NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (image == MAP_FAILED)
+    return (MAP_FAILED);
+  for (got = 0; got < size; got += n)
+    if ((n = pread (fd, (char *) image + got, size - got, got)) <= 0)
+      {
+	if (n < 0 && errno == EINTR)
+	  n = 0;
+	else
+	  break;
+      }
+  if (got == 0 || (got < size && n < 0))
+    {
+      munmap (image, size);
+      return (MAP_FAILED);
+    }
+  *nbytes = got;
+  return (image);
+}
+
 /*
- * Open a file for reading.
+ * Open a file for reading.  If the file was named
+ * on the command line, wait for a thread to finish
+ * preloading it.
  */
 int
 ffropen (const char *fn)
 {
+  struct stat st;
+  PRELOAD *pp;
+
+  curpre = NULL;
   if ((ffp = fopen (fn, "r")) == NULL)
     return (FIOFNF);
+  for (pp = preloads; pp < preloads + npreload; pp++)
+    if (pp->p_fname != NULL && strcmp (pp->p_fname, fn) == 0)
+      {
+	pthread_mutex_lock (&prelock);
+	while (!pp->p_done)
+	  pthread_cond_wait (&predone, &prelock);
+	pthread_mutex_unlock (&prelock);
+	pp->p_fname = NULL;	/* Use it only once	*/
+	if (pp->p_buf != NULL && fstat (fileno (ffp), &st) == 0
+	    && st.st_dev == pp->p_dev && st.st_ino == pp->p_ino
+	    && st.st_size == pp->p_size)
+	  curpre = pp;		/* Still the same file	*/
+	break;
+      }
   return (FIOSUC);
 }
 
 /*
- * Open a file for writing.
+ * Open a file for writing.  The file is written with write(2)
+ * rather than stdio, from a large buffer of whole lines.  If the
+ * file is mapped into memory, detach the mapping from it first.
+ * If the file exists and atomic saves are enabled, write a new
+ * file in the same directory with the same permissions; ffclose
+ * renames it over the old one.
  * Return TRUE if all is well, and
  * FALSE on error (cannot create).
  */
 int
 ffwopen (const char *fn)
 {
-  if ((ffp = fopen (fn, "w")) == NULL)
+  struct stat st;
+  MAPPING *mp;
+  char *rp;
+  int atomic = atomicsave;
+
+  tmpname[0] = '\0';
+  oused = 0;
+  werror = FALSE;
+  if (stat (fn, &st) == 0)
+    {
+      blockio (TRUE);
+      for (mp = mappings; mp != NULL; mp = mp->m_next)
+	if (mp->m_fd >= 0 && mp->m_dev == st.st_dev && mp->m_ino == st.st_ino)
+	  detach (mp);
+      blockio (FALSE);
+    }
+  else
+    atomic = FALSE;		/* New file		*/
+  if (atomic && strlen (fn) < NFILEN)
+    {
+      strcpy (newname, fn);	/* Replace symlink target */
+      if ((rp = realpath (fn, NULL)) != NULL)
+	{
+	  if (strlen (rp) < NFILEN)
+	    strcpy (newname, rp);
+	  free (rp);
+	}
+      snprintf (tmpname, sizeof (tmpname), "%s.XXXXXX", newname);
+      if ((wfd = mkstemp (tmpname)) < 0)
+	{
+	  tmpname[0] = '\0';
+	  eprintf ("Cannot create temporary file for writing");
+	  return (FIOERR);
+	}
+      fchmod (wfd, st.st_mode & 07777);
+      if (fchown (wfd, st.st_uid, st.st_gid) != 0)
+	fchmod (wfd, st.st_mode & 0777);	/* No setuid if not owner */
+      return (FIOSUC);
+    }
+  if ((wfd = open (fn, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
     {
       eprintf ("Cannot open file for writing");
       return (FIOERR);
@@ -74,13 +376,82 @@ ffwopen (const char *fn)
 }
 
 /*
- * Close a file.
- * Should look at the status.
+ * Write all of the data described by the "n" elements of "iov"
+ * to the file being written, retrying after partial writes.
+ * Return FALSE on error.
+ */
+static int
+writeiov (struct iovec *iov, int n)
+{
+  ssize_t w;
+
+  while (n > 0)
+    {
+      if ((w = writev (wfd, iov, n)) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return (FALSE);
+	}
+      while (n > 0 && (size_t) w >= iov->iov_len)
+	{
+	  w -= iov->iov_len;
+	  ++iov;
+	  --n;
+	}
+      if (n > 0)
+	{
+	  iov->iov_base = (char *) iov->iov_base + w;
+	  iov->iov_len -= w;
+	}
+    }
+  return (TRUE);
+}
+
+/*
+ * Close a file.  If it was being written, write out
+ * the buffered data.  If ffwopen wrote a new file,
+ * flush it to disk and rename it to the real name, unless
+ * there was a write error, in which case remove it.
+ * Should look at the status for files being read.
  */
 int
 ffclose (void)
 {
-  fclose (ffp);
+  struct iovec iov;
+  int ok;
+
+  if (wfd < 0)
+    {
+      curpre = NULL;
+      fclose (ffp);
+      return (FIOSUC);
+    }
+  iov.iov_base = obuf;
+  iov.iov_len = oused;
+  ok = !werror && writeiov (&iov, 1);
+  oused = 0;
+  if (tmpname[0] != '\0')
+    ok = ok && fsync (wfd) == 0;
+  ok = close (wfd) == 0 && ok;
+  wfd = -1;
+  if (tmpname[0] != '\0')
+    {
+      if (!ok || rename (tmpname, newname) != 0)
+	{
+	  unlink (tmpname);
+	  tmpname[0] = '\0';
+	  eprintf ("Cannot replace %s", newname);
+	  return (FIOERR);
+	}
+      tmpname[0] = '\0';
+    }
+  if (!ok)
+    {
+      if (!werror)
+	eprintf ("Write I/O error");
+      return (FIOERR);
+    }
   return (FIOSUC);
 }
 
@@ -88,23 +459,39 @@ ffclose (void)
  * Write a line to the already
  * opened file. The "buf" points to the
  * buffer, and the "nbuf" is its length, less
- * the free newline. Return the status.
- * Check only at the newline.
+ * the free newline.  Lines are collected in obuf;
+ * when one doesn't fit, the buffer and the
+ * line are written together with a single writev.
+ * Return the status.
  */
 int
 ffputline (const char *buf, int nbuf, int nl)
 {
-  int i;
+  struct iovec iov[3];
 
-  for (i = 0; i < nbuf; ++i)
-    putc (buf[i] & 0xFF, ffp);
-  if (ferror (ffp) == FALSE && nl)
-    putc ('\n', ffp);
-  if (ferror (ffp) != FALSE)
+  if (werror)
+    return (FIOERR);
+  if (oused + nbuf + 1 <= OBUFSIZE)
+    {
+      memcpy (&obuf[oused], buf, nbuf);
+      oused += nbuf;
+      if (nl)
+	obuf[oused++] = '\n';
+      return (FIOSUC);
+    }
+  iov[0].iov_base = obuf;
+  iov[0].iov_len = oused;
+  iov[1].iov_base = (char *) buf;
+  iov[1].iov_len = nbuf;
+  iov[2].iov_base = "\n";
+  iov[2].iov_len = nl ? 1 : 0;
+  if (writeiov (iov, 3) == FALSE)
     {
       eprintf ("Write I/O error");
+      werror = TRUE;
       return (FIOERR);
     }
+  oused = 0;
   return (FIOSUC);
 }
 
@@ -184,6 +571,499 @@ ffgetline (char **bufp, int *nbytes)
   return (FIOSUC);
 }
 
+/*
+ * Get an image of all of the file opened by ffropen in memory,
+ * for the piece table method of reading files.  If the file can
+ * be leased, the image is a private mapping, so pages are only read
+ * from the file when a line in them is looked at, and they can be
+ * dropped again by the kernel at any time until a line in them is
+ * edited or the lease is broken.  Otherwise the file is read into
+ * anonymous memory.  Either way the file itself is never changed,
+ * and the image doesn't change if somebody else changes the file.
+ * Return the address of the image to *bufp and its size
+ * to *nbytes.  The image must be freed with fffreeimage.
+ * Return FIOERR if the file isn't a non-empty regular file
+ * or it can't be read; the caller then falls back to ffgetline.
+ */
+int
+ffgetimage (uchar **bufp, long *nbytes)
+{
+  struct stat st;
+  MAPPING *mp;
+  void *image;
+  long size, len;
+  int fd;
+
+  if (fstat (fileno (ffp), &st) != 0 || !S_ISREG (st.st_mode)
+      || st.st_size == 0 || (size_t) st.st_size != st.st_size)
+    return (FIOERR);
+  if ((mp = (MAPPING *) malloc (sizeof (MAPPING))) == NULL)
+    return (FIOERR);
+  fd = -1;
+  if (curpre != NULL && curpre->p_buf != NULL)
+    {				/* Already read		*/
+      image = curpre->p_buf;
+      size = len = curpre->p_size;
+      curpre->p_buf = NULL;
+    }
+  else if ((image = leasemap (fileno (ffp), &st, &fd)) != MAP_FAILED)
+    size = len = st.st_size;
+  else
+    {
+      image = readimage (fileno (ffp), st.st_size, &size);
+      len = st.st_size;		/* Maybe more than was read */
+    }
+  if (image == MAP_FAILED)
+    {
+      free (mp);
+      return (FIOERR);
+    }
+  mp->m_buf = (uchar *) image;
+  mp->m_size = len;
+  mp->m_dev = st.st_dev;
+  mp->m_ino = st.st_ino;
+  mp->m_fd = fd;
+  blockio (TRUE);
+  mp->m_next = mappings;
+  mappings = mp;
+  blockio (FALSE);
+  *bufp = (uchar *) image;
+  *nbytes = size;
+  return (FIOSUC);
+}
+
+/*
+ * If the image just returned by ffgetimage was split
+ * into lines by a preload thread, return the offsets of
+ * the newlines in it to *endsp, and the number of newlines.
+ * The caller must free the offsets.  Otherwise return -1.
+ */
+long
+ffgetsplit (long **endsp)
+{
+  if (curpre == NULL || curpre->p_buf != NULL || curpre->p_ends == NULL)
+    return (-1);
+  *endsp = curpre->p_ends;
+  curpre->p_ends = NULL;
+  return (curpre->p_nends);
+}
+
+/*
+ * Read the file described by "pp" into memory, and
+ * find all of the newlines in it.  This runs in a preload
+ * thread, so it mustn't touch anything but "pp".  If anything
+ * goes wrong, pp->p_buf is left NULL, and the file is read
+ * in the usual way.
+ */
+static void
+preloadfile (PRELOAD *pp)
+{
+  struct stat st;
+  void *image;
+  uchar *p, *nl, *end;
+  long *ends, *newends;
+  long n, max;
+  int fd;
+
+  if ((fd = open (pp->p_fname, O_RDONLY)) < 0)
+    return;
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode)
+      || st.st_size == 0 || st.st_size > PRELOADMAX)
+    {
+      close (fd);
+      return;
+    }
+  image = readimage (fd, st.st_size, &n);
+  close (fd);
+  if (image == MAP_FAILED)
+    return;
+  if (n != st.st_size)
+    {				/* Shrank while reading	*/
+      munmap (image, st.st_size);
+      return;
+    }
+  n = 0;
+  max = st.st_size / 32 + 16;
+  if ((ends = (long *) malloc (max * sizeof (long))) == NULL)
+    {
+      munmap (image, st.st_size);
+      return;
+    }
+  p = (uchar *) image;
+  end = p + st.st_size;
+  while ((nl = (uchar *) memchr (p, '\n', end - p)) != NULL)
+    {
+      if (n == max)
+	{
+	  max *= 2;
+	  if ((newends = (long *) realloc (ends, max * sizeof (long))) == NULL)
+	    {
+	      free (ends);
+	      munmap (image, st.st_size);
+	      return;
+	    }
+	  ends = newends;
+	}
+      ends[n++] = nl - (uchar *) image;
+      p = nl + 1;
+    }
+  pp->p_buf = (uchar *) image;
+  pp->p_size = st.st_size;
+  pp->p_dev = st.st_dev;
+  pp->p_ino = st.st_ino;
+  pp->p_ends = ends;
+  pp->p_nends = n;
+}
+
+/*
+ * Body of a preload thread: preload files until
+ * there are none left.
+ */
+static void *
+preloader (void *arg)
+{
+  PRELOAD *pp;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&prelock);
+      if (nextpreload >= npreload)
+	{
+	  pthread_mutex_unlock (&prelock);
+	  return (NULL);
+	}
+      pp = &preloads[nextpreload++];
+      pthread_mutex_unlock (&prelock);
+      preloadfile (pp);
+      pthread_mutex_lock (&prelock);
+      pp->p_done = TRUE;
+      pthread_cond_broadcast (&predone);
+      pthread_mutex_unlock (&prelock);
+    }
+}
+
+/*
+ * Start preloading the "n" files in "names", which are
+ * about to be read by readin, on a pool of threads.  The names
+ * must stay valid until ffpreloaddone is called.  If there is
+ * only one file, or the threads can't be started, do nothing.
+ */
+void
+ffpreload (const char **names, int n)
+{
+  long ncpu;
+  int i;
+
+  if (n < 2 || (preloads = (PRELOAD *) calloc (n, sizeof (PRELOAD))) == NULL)
+    return;
+  for (i = 0; i < n; i++)
+    preloads[i].p_fname = names[i];
+  npreload = n;
+  nextpreload = 0;
+  if ((ncpu = sysconf (_SC_NPROCESSORS_ONLN)) < 1)
+    ncpu = 1;
+  blockio (TRUE);		/* Threads inherit this	*/
+  for (nprethread = 0; nprethread < ncpu && nprethread < n
+       && nprethread < NPRELOAD; nprethread++)
+    if (pthread_create (&prethreads[nprethread], NULL, preloader, NULL) != 0)
+      break;
+  blockio (FALSE);
+  if (nprethread == 0)
+    {
+      free ((char *) preloads);
+      preloads = NULL;
+      npreload = 0;
+    }
+}
+
+/*
+ * Wait for the preload threads to finish, and free
+ * the images of any preloaded files that weren't read.
+ */
+void
+ffpreloaddone (void)
+{
+  PRELOAD *pp;
+  int i;
+
+  for (i = 0; i < nprethread; i++)
+    pthread_join (prethreads[i], NULL);
+  nprethread = 0;
+  for (pp = preloads; pp < preloads + npreload; pp++)
+    {
+      if (pp->p_buf != NULL)
+	munmap (pp->p_buf, pp->p_size);
+      free ((char *) pp->p_ends);
+    }
+  free ((char *) preloads);
+  preloads = NULL;
+  npreload = 0;
+}
+
+/*
+ * Walking a directory tree.  A pool of threads shares a stack
+ * of directories and files waiting to be visited.  A thread
+ * visiting a directory pushes the entries that the caller wants
+ * onto the stack, where any idle thread can take them; a thread
+ * visiting a file reads it into a buffer of its own and passes it
+ * to the caller's scan function.  The files aren't mapped into memory,
+ * because a file that got shorter during the walk would then
+ * crash MicroEMACS with a SIGBUS.
+ */
+typedef struct WALKITEM
+{
+  struct WALKITEM *w_next;	/* Next item on the stack	*/
+  int w_isdir;			/* Is this a directory?		*/
+  char w_path[1];		/* Path name, NUL-terminated	*/
+}
+WALKITEM;
+
+static pthread_mutex_t walklock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t walkcond = PTHREAD_COND_INITIALIZER;
+static WALKITEM *walkstack;	/* Items waiting to be visited	*/
+static int walkbusy;		/* Threads visiting an item	*/
+static int walkstop;		/* A scan asked to stop		*/
+static int (*walkwant) (const char *path, int isdir);
+static int (*walkscan) (const char *path, const uchar *buf, long n, int w);
+static char *walkbuf[NWALK];	/* Buffer for each thread	*/
+static long walksize[NWALK];	/* Size of each buffer		*/
+
+/*
+ * Push a path onto the stack of items to visit,
+ * and wake up a thread to visit it.
+ */
+static void
+walkpush (const char *path, int isdir)
+{
+  WALKITEM *wp;
+
+  if ((wp = (WALKITEM *) malloc (sizeof (WALKITEM) + strlen (path))) == NULL)
+    return;
+  wp->w_isdir = isdir;
+  strcpy (wp->w_path, path);
+  pthread_mutex_lock (&walklock);
+  wp->w_next = walkstack;
+  walkstack = wp;
+  pthread_cond_signal (&walkcond);
+  pthread_mutex_unlock (&walklock);
+}
+
+/*
+ * Visit a directory: push the subdirectories and regular files
+ * in it that the caller wants.  Symbolic links are skipped,
+ * so that a link can't make the walk go around in circles.
+ * The paths of the entries in "." don't start with "./".
+ */
+static void
+walkdir (const char *dir)
+{
+  DIR *dirp;
+  struct dirent *dp;
+  struct stat st;
+  char path[NFILEN];
+  int isdir;
+
+  if ((dirp = opendir (dir)) == NULL)
+    return;
+  while ((dp = readdir (dirp)) != NULL)
+    {
+      if (strcmp (dp->d_name, ".") == 0 || strcmp (dp->d_name, "..") == 0)
+	continue;
+      if (strcmp (dir, ".") == 0)
+	snprintf (path, sizeof (path), "%s", dp->d_name);
+      else if (snprintf (path, sizeof (path), "%s/%s", dir, dp->d_name)
+	       >= (int) sizeof (path))
+	continue;
+      if (lstat (path, &st) != 0)
+	continue;
+      if (S_ISDIR (st.st_mode))
+	isdir = TRUE;
+      else if (S_ISREG (st.st_mode))
+	isdir = FALSE;
+      else
+	continue;
+      if (walkwant (path, isdir))
+	walkpush (path, isdir);
+    }
+  closedir (dirp);
+}
+
+/*
+ * Visit a file: read it into the buffer for thread "w", and pass it
+ * to the scan function.  Return the scan function's result,
+ * which is FALSE if the walk should stop.
+ */
+static int
+walkfile (const char *path, int w)
+{
+  struct stat st;
+  char *newbuf;
+  ssize_t r;
+  long n;
+  int fd;
+
+  if ((fd = open (path, O_RDONLY)) < 0)
+    return (TRUE);
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) || st.st_size == 0
+      || (size_t) st.st_size != st.st_size)
+    {
+      close (fd);
+      return (TRUE);
+    }
+  if (st.st_size > walksize[w])
+    {
+      if ((newbuf = (char *) realloc (walkbuf[w], st.st_size)) == NULL)
+	{
+	  close (fd);
+	  return (TRUE);
+	}
+      walkbuf[w] = newbuf;
+      walksize[w] = st.st_size;
+    }
+  for (n = 0; n < st.st_size; n += r)
+    if ((r = read (fd, walkbuf[w] + n, st.st_size - n)) <= 0)
+      {
+	if (r < 0 && errno == EINTR)
+	  r = 0;
+	else
+	  break;
+      }
+  close (fd);
+  if (n == 0)
+    return (TRUE);
+  return (walkscan (path, (const uchar *) walkbuf[w], n, w));
+}
+
+/*
+ * Body of a walking thread "w": visit items until the stack is
+ * empty and no other thread is busy adding to it, or until
+ * a scan asks to stop.  Then tell the scan function that this
+ * thread is finished by passing it a NULL path.
+ */
+static void *
+walker (void *arg)
+{
+  WALKITEM *wp;
+  int w = (int) (long) arg;
+
+  pthread_mutex_lock (&walklock);
+  for (;;)
+    {
+      while (walkstack == NULL && walkbusy > 0 && !walkstop)
+	pthread_cond_wait (&walkcond, &walklock);
+      if (walkstack == NULL || walkstop)
+	break;
+      wp = walkstack;
+      walkstack = wp->w_next;
+      walkbusy++;
+      pthread_mutex_unlock (&walklock);
+      if (wp->w_isdir)
+	walkdir (wp->w_path);
+      else if (walkfile (wp->w_path, w) == FALSE)
+	{
+	  pthread_mutex_lock (&walklock);
+	  walkstop = TRUE;
+	  pthread_mutex_unlock (&walklock);
+	}
+      free ((char *) wp);
+      pthread_mutex_lock (&walklock);
+      walkbusy--;
+    }
+  pthread_cond_broadcast (&walkcond);
+  pthread_mutex_unlock (&walklock);
+  walkscan (NULL, NULL, 0, w);
+  return (NULL);
+}
+
+/*
+ * Walk the tree of files under directory "dir", calling "want"
+ * for each directory and regular file found to ask if it should be
+ * visited, and "scan" with the contents of each file visited.  Up to
+ * NWALK threads do the walking, so "want" and "scan" must be safe
+ * to call from several threads at once; "scan" is also told the
+ * number of the thread (from 0 to NWALK-1) calling it.  If "scan"
+ * returns FALSE, the walk stops early.  Return FALSE if the
+ * walk couldn't be started.
+ */
+int
+ffwalk (const char *dir,
+	int (*want) (const char *path, int isdir),
+	int (*scan) (const char *path, const uchar *buf, long n, int w))
+{
+  pthread_t threads[NWALK];
+  WALKITEM *wp;
+  long ncpu;
+  int i, n;
+
+  walkwant = want;
+  walkscan = scan;
+  walkstack = NULL;
+  walkbusy = 0;
+  walkstop = FALSE;
+  walkpush (dir, TRUE);
+  if (walkstack == NULL)
+    return (FALSE);
+  if ((ncpu = sysconf (_SC_NPROCESSORS_ONLN)) < 1)
+    ncpu = 1;
+  blockio (TRUE);		/* Threads inherit this	*/
+  for (n = 0; n < ncpu && n < NWALK; n++)
+    if (pthread_create (&threads[n], NULL, walker, (void *) (long) n) != 0)
+      break;
+  blockio (FALSE);
+  if (n == 0)
+    walker ((void *) 0L);
+  for (i = 0; i < n; i++)
+    pthread_join (threads[i], NULL);
+
+  /* Free anything left over after a scan stopped the walk.
+   */
+  while ((wp = walkstack) != NULL)
+    {
+      walkstack = wp->w_next;
+      free ((char *) wp);
+    }
+  for (i = 0; i < NWALK; i++)
+    {
+      free (walkbuf[i]);
+      walkbuf[i] = NULL;
+      walksize[i] = 0;
+    }
+  return (TRUE);
+}
+
+/*
+ * Free a file image obtained from ffgetimage, and
+ * give up the lease on the file if there is one.
+ */
+void
+fffreeimage (uchar *buf, long nbytes)
+{
+  MAPPING *mp, **mpp;
+
+  blockio (TRUE);
+  for (mpp = &mappings; (mp = *mpp) != NULL; mpp = &mp->m_next)
+    if (mp->m_buf == buf)
+      {
+	*mpp = mp->m_next;
+	break;
+      }
+  blockio (FALSE);
+  if (mp == NULL)
+    {
+      munmap (buf, nbytes);
+      return;
+    }
+#ifdef F_SETLEASE
+  if (mp->m_fd >= 0)
+    {
+      fcntl (mp->m_fd, F_SETLEASE, F_UNLCK);
+      close (mp->m_fd);
+    }
+#endif
+  munmap (buf, mp->m_size);
+  free (mp);
+}
+
 #if BACKUP
 
 /*
@@ -194,7 +1074,9 @@ ffgetline (char **bufp, int *nbytes)
  * directory name, and try to rename the original file into that
  * directory.  The error handling is all in "file.c". The "unlink" is
  * perhaps not the right thing here; I don't care that much as I don't
- * enable backups myself.
+ * enable backups myself.  If atomic saves are enabled, the backup
+ * is made as a link if possible, so that the file doesn't disappear
+ * before the new version is renamed over it.
  */
 int
 fbackupfile (const char *fname)
@@ -219,6 +1101,12 @@ fbackupfile (const char *fname)
       strcat (nname, fname);
     }
   unlink (nname);		/* delete old backup    */
+
+  /* For an atomic save, leave the file where it is until
+   * the new one is renamed over it.
+   */
+  if (atomicsave && link (fname, nname) == 0)
+    return (TRUE);
   return (rename (fname, nname) == 0);
 }
 
@@ -308,39 +1196,62 @@ ffpclose (void)
 }
 
 /*
- * Open a journal file for writing.
- * Return TRUE if all is well, and
- * FALSE on error (cannot create).
+ * Open the journal file "fn" for writing, creating it
+ * if necessary.  If "append" is FALSE, the file is emptied
+ * first.  The file is readable only by its owner, because
+ * it contains text from the file being edited.  Store the file
+ * descriptor in *fdp, and return FIOSUC, or FIOERR on error.
  */
 int
-ffjopen (void)
+ffjopen (const char *fn, int append, int *fdp)
 {
-  if ((jfp = fopen (".pejou", "w")) == NULL)
+  int fd;
+
+  fd = open (fn, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0600);
+  if (fd < 0)
     {
-      eprintf ("Cannot open journal file for writing");
+      eprintf ("Cannot open journal file %s", fn);
       return (FIOERR);
     }
+  *fdp = fd;
   return (FIOSUC);
 }
 
 /*
- * Write a byte to the already opened
- * journal file. The "c" contains the byte to write.
- * Return the status.
+ * Write "n" bytes from "buf" to the journal file
+ * whose descriptor is "fd".  Return the status.
  */
 int
-ffputjou (char c)
+ffjwrite (int fd, const char *buf, int n)
 {
-  putc (c, jfp);
-  fflush (jfp);
-  if (ferror (jfp) != FALSE)
+  ssize_t len;
+
+  while (n > 0)
     {
-      eprintf ("Journal write error");
-      return (FIOERR);
+      if ((len = write (fd, buf, n)) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  eprintf ("Journal write error");
+	  return (FIOERR);
+	}
+      buf += len;
+      n -= len;
     }
   return (FIOSUC);
 }
 
+/*
+ * Close the journal file whose descriptor is "fd".
+ */
+int
+ffjclose (int fd)
+{
+  if (close (fd) != 0)
+    return (FIOERR);
+  return (FIOSUC);
+}
+
 /*
  * Find the first or next file that matches the first 'cpos' characters
  * in the filename 'name'.  Returns a pointer to a static buffer
@@ -189,7 +189,10 @@ spawn (char *program, const char *args[])
       return (FALSE);
     }
   if (jobcontrol)			/* C shell or bash */
-    kill (0, SIGTSTP);
+    {
+      ffdetach ();
+      kill (0, SIGTSTP);
+    }
   else
     {				/* Bourne shell.        */
       oqsig = signal (SIGQUIT, SIG_IGN);
@@ -0,0 +1,990 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Name:	MicroEMACS
+ *		Trigram index for project grep
+ * By:		Mark Alexander
+ *		marka@pobox.com
+ *
+ * The functions in this file maintain an index of the files
+ * under the current directory, so that project-grep doesn't have
+ * to read every file to find the few that contain a pattern.
+ * For each trigram (sequence of three bytes) that appears in any
+ * file, the index holds the list of files that contain it.  A
+ * pattern can only match in a file that contains all of the
+ * trigrams in the literal strings that every match must contain,
+ * so the other files need not be read.
+ *
+ * The index is kept in the file .peindex in the current
+ * directory.  It starts with the time the index was built,
+ * and the list of files, with the modification and change times
+ * (in nanoseconds), inode number, and size of each one, followed
+ * by the trigrams in increasing order, each with its sorted list of
+ * file numbers.  All of the numbers are stored as variable-length
+ * integers, seven bits per byte, and file numbers are stored as
+ * the differences between successive numbers.  When the index
+ * is rebuilt, only the files whose times, inodes or sizes have
+ * changed are read again; the trigrams of the others come from
+ * the old index.  A file that has changed since the index was built
+ * is always searched, so a stale index can make a search slower,
+ * but it can't make it miss anything.
+ *
+ * File times are only as fine as the kernel's clock tick, so
+ * a file changed twice within one tick, while the index was being
+ * built, could look unchanged afterwards.  As in git, a file whose
+ * modification time isn't older than the time the index build
+ * started is "racy": it is treated as changed until the index
+ * is built again.
+ */
+#include	"def.h"
+#include	<ctype.h>
+#include	<sys/stat.h>
+
+#define TGNAME	".peindex"		/* Index file in current dir	*/
+#define TGTEMP	".peindex.tmp"	/* New index being written	*/
+#define TGMAGIC	"PEIX2\n"		/* Start of index file		*/
+#define TGMAGLEN 6			/* Length of TGMAGIC		*/
+#define TGGRAMS	(1 << 24)		/* Number of possible trigrams	*/
+
+/*
+ * The state of a file that shows whether it has changed.
+ */
+typedef struct
+{
+  long long mtime;		/* Modification time, ns	*/
+  long long ctime;		/* Change time, ns		*/
+  long long ino;		/* Inode number			*/
+  long long size;		/* Size in bytes		*/
+}
+TGSTAT;
+
+/*
+ * A file in the index.
+ */
+typedef struct
+{
+  char *path;			/* File name			*/
+  TGSTAT st;			/* Times, inode and size	*/
+  int keep;			/* Unchanged, keep in new index	*/
+  int newid;			/* Number in new index		*/
+}
+TGFILE;
+
+/*
+ * The list of files that contain a trigram.
+ */
+typedef struct
+{
+  unsigned int gram;		/* The three bytes		*/
+  int count;			/* Number of files		*/
+  const uchar *data;		/* Encoded file numbers		*/
+  long len;			/* Length of data		*/
+}
+TGGRAM;
+
+/*
+ * A file read while building a new index.
+ */
+typedef struct
+{
+  char *path;			/* File name			*/
+  TGSTAT st;			/* Times, inode and size	*/
+  unsigned int *grams;		/* Trigrams in the file		*/
+  int ngrams;			/* Number of entries in grams	*/
+}
+TGNEW;
+
+/*
+ * The files read by one walking thread while building an index.
+ */
+typedef struct
+{
+  TGNEW *files;			/* Files read			*/
+  int nfiles;			/* Number of entries in files	*/
+  int size;			/* Allocated size of files	*/
+  uchar *seen;			/* Bit for each trigram seen	*/
+  unsigned int *grams;		/* Trigrams in current file	*/
+  long ngsize;			/* Allocated size of grams	*/
+}
+TGWORK;
+
+/*
+ * A file in a new index, pointing to either an unchanged
+ * file in the old index, or a file that was just read.
+ */
+typedef struct
+{
+  const char *path;		/* File name			*/
+  TGFILE *old;			/* Entry in old index, or NULL	*/
+  TGNEW *new;			/* Entry for new file, or NULL	*/
+}
+TGENTRY;
+
+/*
+ * A buffer for building the new index file.
+ */
+typedef struct
+{
+  uchar *buf;			/* Contents			*/
+  long len;			/* Number of bytes used		*/
+  long size;			/* Allocated size		*/
+  int error;			/* Out of memory		*/
+}
+TGBUF;
+
+static uchar *tgimage;		/* Contents of index file	*/
+static long long tgimtime;	/* Modification time of index	*/
+static long long tgisize;	/* Size of index		*/
+static long long tgbuilt;	/* Time index build started, ns	*/
+static long long tgstarted;	/* Time new build started, ns	*/
+static TGFILE *tgfiles;		/* Files in index		*/
+static int ntgfiles;		/* Number of entries in tgfiles	*/
+static int *tghead;		/* Hash table of file names	*/
+static int *tgnext;		/* Hash chains			*/
+static int tghsize;		/* Size of tghead		*/
+static TGGRAM *tggrams;		/* Trigrams in index		*/
+static int ntggrams;		/* Number of entries in tggrams	*/
+static uchar *tgcand;		/* Candidates for current query	*/
+static int tgactive;		/* tgcand is valid		*/
+
+static TGWORK tgwork[NWALK];
+
+/*
+ * Decode a variable-length number from *pp, which must not
+ * go past end.  Return FALSE if the number is damaged.
+ */
+static int
+getvar (const uchar **pp, const uchar *end, unsigned long long *vp)
+{
+  const uchar *p = *pp;
+  unsigned long long v = 0;
+  int shift = 0;
+
+  do
+    {
+      if (p == end || shift > 63)
+	return (FALSE);
+      v |= (unsigned long long) (*p & 0x7f) << shift;
+      shift += 7;
+    }
+  while (*p++ & 0x80);
+  *pp = p;
+  *vp = v;
+  return (TRUE);
+}
+
+/*
+ * Append a variable-length number to a buffer.
+ */
+static void
+putvar (TGBUF *bp, unsigned long long v)
+{
+  uchar *nbuf;
+  long nsize;
+
+  if (bp->len + 10 > bp->size)
+    {
+      nsize = bp->size == 0 ? 65536 : 2 * bp->size;
+      if ((nbuf = (uchar *) realloc (bp->buf, nsize)) == NULL)
+	{
+	  bp->error = TRUE;
+	  return;
+	}
+      bp->buf = nbuf;
+      bp->size = nsize;
+    }
+  while (v >= 0x80)
+    {
+      bp->buf[bp->len++] = (uchar) (v | 0x80);
+      v >>= 7;
+    }
+  bp->buf[bp->len++] = (uchar) v;
+}
+
+/*
+ * Append n bytes to a buffer.
+ */
+static void
+putbytes (TGBUF *bp, const void *p, long n)
+{
+  uchar *nbuf;
+  long nsize;
+
+  if (bp->len + n > bp->size)
+    {
+      for (nsize = bp->size == 0 ? 65536 : bp->size; bp->len + n > nsize;)
+	nsize *= 2;
+      if ((nbuf = (uchar *) realloc (bp->buf, nsize)) == NULL)
+	{
+	  bp->error = TRUE;
+	  return;
+	}
+      bp->buf = nbuf;
+      bp->size = nsize;
+    }
+  memcpy (bp->buf + bp->len, p, n);
+  bp->len += n;
+}
+
+/*
+ * Hash a file name.
+ */
+static unsigned int
+tghash (const char *s)
+{
+  unsigned int h = 2166136261u;
+
+  while (*s != '\0')
+    h = (h ^ (uchar) * s++) * 16777619u;
+  return (h);
+}
+
+/*
+ * Return the number of the file "path" in the index, or -1
+ * if it's not there.
+ */
+static int
+tglookup (const char *path)
+{
+  int i;
+
+  if (tghsize == 0)
+    return (-1);
+  for (i = tghead[tghash (path) & (tghsize - 1)]; i >= 0; i = tgnext[i])
+    if (strcmp (tgfiles[i].path, path) == 0)
+      return (i);
+  return (-1);
+}
+
+/*
+ * Get the times, inode number and size of a file.
+ * Return FALSE if it doesn't exist.
+ */
+static int
+tgstat (const char *path, TGSTAT *tp)
+{
+  struct stat st;
+
+  if (stat (path, &st) != 0)
+    return (FALSE);
+  tp->mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  tp->ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+  tp->ino = (long long) st.st_ino;
+  tp->size = (long long) st.st_size;
+  return (TRUE);
+}
+
+/*
+ * Is the file "path" unchanged since index entry i was made?
+ * A racy entry never is.
+ */
+static int
+tgsame (const char *path, int i)
+{
+  TGSTAT st;
+  TGFILE *tf = &tgfiles[i];
+
+  return (tgstat (path, &st)
+	  && tf->st.mtime < tgbuilt
+	  && st.mtime == tf->st.mtime && st.ctime == tf->st.ctime
+	  && st.ino == tf->st.ino && st.size == tf->st.size);
+}
+
+/*
+ * Free the index that was read by tgload.
+ */
+void
+tgfree (void)
+{
+  int i;
+
+  for (i = 0; i < ntgfiles; i++)
+    free (tgfiles[i].path);
+  free ((char *) tgfiles);
+  free ((char *) tghead);
+  free ((char *) tgnext);
+  free ((char *) tggrams);
+  free ((char *) tgcand);
+  free ((char *) tgimage);
+  tgfiles = NULL;
+  tghead = tgnext = NULL;
+  tggrams = NULL;
+  tgcand = tgimage = NULL;
+  ntgfiles = ntggrams = tghsize = 0;
+  tgactive = FALSE;
+}
+
+/*
+ * Parse the index file image in tgimage, which is n bytes long.
+ * Return FALSE if it's damaged.
+ */
+static int
+tgparse (long n)
+{
+  const uchar *p = tgimage + TGMAGLEN;
+  const uchar *end = tgimage + n;
+  unsigned long long v, count, mtime, ctime, ino, size, len;
+  unsigned int prev;
+  int i;
+
+  if (n < TGMAGLEN || memcmp (tgimage, TGMAGIC, TGMAGLEN) != 0)
+    return (FALSE);
+
+  /* Read the build time and the list of files, and make
+   * a hash table of their names.
+   */
+  if (!getvar (&p, end, &v))
+    return (FALSE);
+  tgbuilt = (long long) v;
+  if (!getvar (&p, end, &count) || count > (unsigned long long) (end - p))
+    return (FALSE);
+  ntgfiles = 0;
+  if ((tgfiles = (TGFILE *) malloc ((count + 1) * sizeof (TGFILE))) == NULL)
+    return (FALSE);
+  for (tghsize = 16; tghsize < 2 * count; tghsize *= 2)
+    ;
+  tghead = (int *) malloc (tghsize * sizeof (int));
+  tgnext = (int *) malloc ((count + 1) * sizeof (int));
+  if (tghead == NULL || tgnext == NULL)
+    return (FALSE);
+  for (i = 0; i < tghsize; i++)
+    tghead[i] = -1;
+  while (ntgfiles < count)
+    {
+      if (!getvar (&p, end, &mtime) || !getvar (&p, end, &ctime)
+	  || !getvar (&p, end, &ino) || !getvar (&p, end, &size)
+	  || !getvar (&p, end, &len) || len > (unsigned long long) (end - p)
+	  || (tgfiles[ntgfiles].path = (char *) malloc (len + 1)) == NULL)
+	return (FALSE);
+      memcpy (tgfiles[ntgfiles].path, p, len);
+      tgfiles[ntgfiles].path[len] = '\0';
+      p += len;
+      tgfiles[ntgfiles].st.mtime = (long long) mtime;
+      tgfiles[ntgfiles].st.ctime = (long long) ctime;
+      tgfiles[ntgfiles].st.ino = (long long) ino;
+      tgfiles[ntgfiles].st.size = (long long) size;
+      tgfiles[ntgfiles].keep = FALSE;
+      i = tghash (tgfiles[ntgfiles].path) & (tghsize - 1);
+      tgnext[ntgfiles] = tghead[i];
+      tghead[i] = ntgfiles++;
+    }
+
+  /* Read the trigram headers, and remember where each
+   * list of file numbers starts.
+   */
+  if (!getvar (&p, end, &count) || count > (unsigned long long) (end - p))
+    return (FALSE);
+  if ((tggrams = (TGGRAM *) malloc ((count + 1) * sizeof (TGGRAM))) == NULL)
+    return (FALSE);
+  prev = 0;
+  for (ntggrams = 0; ntggrams < count; ntggrams++)
+    {
+      if (!getvar (&p, end, &v) || v >= TGGRAMS
+	  || (ntggrams > 0 && v <= prev)
+	  || !getvar (&p, end, &size) || size > ntgfiles
+	  || !getvar (&p, end, &len) || len > (unsigned long long) (end - p))
+	return (FALSE);
+      tggrams[ntggrams].gram = prev = (unsigned int) v;
+      tggrams[ntggrams].count = (int) size;
+      tggrams[ntggrams].data = p;
+      tggrams[ntggrams].len = (long) len;
+      p += len;
+    }
+  return (p == end);
+}
+
+/*
+ * Read the index file into memory, unless it has already
+ * been read and hasn't changed since then.  Return TRUE if
+ * there is an index.
+ */
+int
+tgload (void)
+{
+  FILE *fp;
+  TGSTAT st;
+  long long size;
+  long n;
+
+  if (!tgstat (TGNAME, &st))
+    {
+      tgfree ();
+      return (FALSE);
+    }
+  size = st.size;
+  if (tgimage != NULL && st.mtime == tgimtime && size == tgisize)
+    return (TRUE);
+  tgfree ();
+  if ((fp = fopen (TGNAME, "rb")) == NULL)
+    return (FALSE);
+  if ((tgimage = (uchar *) malloc (size + 1)) == NULL)
+    {
+      fclose (fp);
+      eprintf ("Out of memory reading %s", TGNAME);
+      return (FALSE);
+    }
+  n = (long) fread (tgimage, 1, size, fp);
+  fclose (fp);
+  if (n != size || !tgparse (n))
+    {
+      tgfree ();
+      eprintf ("%s is damaged; use make-grep-index", TGNAME);
+      return (FALSE);
+    }
+  tgimtime = st.mtime;
+  tgisize = size;
+  return (TRUE);
+}
+
+/*
+ * Add the trigrams in the n bytes at s to the list of
+ * trigrams that every match of a pattern must contain.
+ */
+static int
+addrun (unsigned int *grams, int ngrams, const uchar *s, int n)
+{
+  int i;
+
+  for (i = 0; i + 3 <= n && ngrams < NPAT; i++)
+    grams[ngrams++] = (s[i] << 16) | (s[i + 1] << 8) | s[i + 2];
+  return (ngrams);
+}
+
+/*
+ * Find the trigrams that must appear in any text that matches
+ * the pattern pat, and store them in grams.  If literal is TRUE,
+ * pat is a plain string.  Otherwise it's a regular expression,
+ * and the trigrams come from the runs of ordinary characters in it
+ * that aren't made optional by a following *, ?, or {, or
+ * by being inside an optional group.  A pattern with | in it
+ * isn't looked at, because no single string must appear in every match,
+ * and neither is a PCRE pattern with an escaped letter or digit.
+ * Return the number of trigrams found.
+ */
+static int
+needgrams (const char *pat, int literal, unsigned int *grams)
+{
+  uchar run[NPAT];
+  const uchar *p = (const uchar *) pat;
+  int nrun, ngrams, depth, c;
+
+  if (literal)
+    return (addrun (grams, 0, p, strlen (pat)));
+  nrun = ngrams = 0;
+  while (*p != '\0')
+    {
+      c = -1;			/* Not an ordinary character */
+      switch (*p)
+	{
+	case '|':
+	  return (0);
+	case '[':
+	  if (*++p == '^')
+	    p++;
+	  if (*p == ']')
+	    p++;
+	  while (*p != '\0' && *p != ']')
+	    if (*p++ == '\\')
+	      return (0);	/* PCRE and Spencer differ */
+	  if (*p != '\0')
+	    p++;
+	  break;
+	case '(':
+	  /* Skip the whole group if it's optional.  Give up
+	   * on PCRE's (?...) groups, which can change the meaning
+	   * of the rest of the pattern.
+	   */
+	  if (p[1] == '?')
+	    return (0);
+	  {
+	    const uchar *q = p + 1;
+
+	    for (depth = 1; *q != '\0' && depth > 0; q++)
+	      if (*q == '\\' && q[1] != '\0')
+		q++;
+	      else if (*q == '(')
+		depth++;
+	      else if (*q == ')')
+		depth--;
+	      else if (*q == '|')
+		return (0);
+	    if (*q == '*' || *q == '?' || *q == '{')
+	      p = q;
+	    else
+	      p++;
+	  }
+	  break;
+	case '\\':
+#if USE_PCRE2
+	  /* In PCRE an escape like \x41, \101, \cA or \k<name>
+	   * goes on past the letter or digit, so give up on it.
+	   */
+	  if (isalnum (p[1]))
+	    return (0);
+#endif
+	  if (p[1] != '\0' && !isalnum (p[1]))
+	    c = p[1];
+	  p += p[1] != '\0' ? 2 : 1;
+	  break;
+	case '.':
+	case '^':
+	case '$':
+	case ')':
+	case '*':
+	case '+':
+	case '?':
+	  p++;
+	  break;
+	case '{':
+	  while (*p != '\0' && *p != '}')
+	    p++;
+	  if (*p != '\0')
+	    p++;
+	  break;
+	default:
+	  c = *p++;
+	  break;
+	}
+
+      /* An ordinary character followed by *, ?, or { might
+       * not appear in the text, and one followed by + ends
+       * a run because it might be repeated.
+       */
+      if (c >= 0 && *p != '*' && *p != '?' && *p != '{' && nrun < NPAT)
+	run[nrun++] = c;
+      if (c < 0 || *p == '*' || *p == '?' || *p == '{' || *p == '+')
+	{
+	  ngrams = addrun (grams, ngrams, run, nrun);
+	  nrun = 0;
+	}
+    }
+  return (addrun (grams, ngrams, run, nrun));
+}
+
+/*
+ * Compare two trigrams for bsearch.
+ */
+static int
+gramcmp (const void *a, const void *b)
+{
+  unsigned int ga = *(const unsigned int *) a;
+  unsigned int gb = ((const TGGRAM *) b)->gram;
+
+  return (ga < gb ? -1 : ga > gb);
+}
+
+/*
+ * Use the index to find the files that might contain a match
+ * for the pattern pat, which is a plain string if literal is TRUE.
+ * After this, tgskip says which files can be skipped.  Return
+ * FALSE if the index can't narrow the search.
+ */
+int
+tgquery (const char *pat, int literal)
+{
+  unsigned int grams[NPAT];
+  unsigned long long v;
+  const uchar *p, *end;
+  TGGRAM *gp;
+  int ngrams, i, j, id;
+
+  tgactive = FALSE;
+  if (tgimage == NULL || (ngrams = needgrams (pat, literal, grams)) == 0)
+    return (FALSE);
+  if (tgcand == NULL
+      && (tgcand = (uchar *) malloc (ntgfiles + 1)) == NULL)
+    return (FALSE);
+
+  /* tgcand[i] counts how many of the trigrams so far are in
+   * file i.  There are fewer than NPAT trigrams, so it can't overflow.
+   */
+  memset (tgcand, 0, ntgfiles);
+  for (i = 0; i < ngrams; i++)
+    {
+      gp = (TGGRAM *) bsearch (&grams[i], tggrams, ntggrams, sizeof (TGGRAM),
+			       gramcmp);
+      if (gp == NULL)
+	{
+	  memset (tgcand, 0, ntgfiles);
+	  break;
+	}
+      p = gp->data;
+      end = p + gp->len;
+      for (j = 0, id = 0; j < gp->count && getvar (&p, end, &v); j++)
+	{
+	  id += (int) v;
+	  if (id < ntgfiles && tgcand[id] == i)
+	    tgcand[id] = i + 1;
+	}
+    }
+  for (j = 0; j < ntgfiles; j++)
+    tgcand[j] = tgcand[j] == ngrams;
+  tgactive = TRUE;
+  return (TRUE);
+}
+
+/*
+ * Return TRUE if the index shows that the file "path" can't
+ * contain a match for the last pattern given to tgquery.  This
+ * is called by the walking threads.
+ */
+int
+tgskip (const char *path)
+{
+  int i;
+
+  if (!tgactive || (i = tglookup (path)) < 0 || tgcand[i])
+    return (FALSE);
+  return (tgsame (path, i));
+}
+
+/*
+ * Return TRUE if the file "path" is in the index and hasn't
+ * changed, so that a new index can use its old trigrams
+ * without reading it.  This is called by the walking threads.
+ */
+int
+tgkeep (const char *path)
+{
+  int i;
+
+  if ((i = tglookup (path)) < 0 || !tgsame (path, i))
+    return (FALSE);
+  tgfiles[i].keep = TRUE;
+  return (TRUE);
+}
+
+/*
+ * Note the time that a new index build is starting, before
+ * any files are read, by creating the temporary index file and
+ * getting its modification time, so that the time comes from the
+ * same clock as the times of the files.  Return FALSE if the
+ * file can't be created.
+ */
+int
+tgstart (void)
+{
+  FILE *fp;
+  TGSTAT st;
+
+  if ((fp = fopen (TGTEMP, "wb")) == NULL)
+    {
+      eprintf ("Unable to create %s", TGTEMP);
+      return (FALSE);
+    }
+  fclose (fp);
+  if (!tgstat (TGTEMP, &st))
+    {
+      eprintf ("Unable to create %s", TGTEMP);
+      return (FALSE);
+    }
+  tgstarted = st.mtime;
+  return (TRUE);
+}
+
+/*
+ * Called by walking thread "w" with the n bytes of the file "path"
+ * while building an index.  Make a list of the distinct trigrams
+ * in the file.  A file that looks like a binary gets an empty
+ * list, so that it's never searched.  Return FALSE if out
+ * of memory.  A NULL path means the thread is finished.
+ */
+int
+tgscan (const char *path, const uchar *buf, long n, int w)
+{
+  TGWORK *tw = &tgwork[w];
+  TGNEW *np;
+  unsigned int g, *ngrams;
+  long i, ng;
+
+  if (path == NULL)
+    return (TRUE);
+  if (tw->nfiles == tw->size)
+    {
+      tw->size = tw->size == 0 ? 64 : 2 * tw->size;
+      np = (TGNEW *) realloc (tw->files, tw->size * sizeof (TGNEW));
+      if (np == NULL)
+	return (FALSE);
+      tw->files = np;
+    }
+  if (tw->seen == NULL && (tw->seen = (uchar *) calloc (TGGRAMS / 8, 1)) == NULL)
+    return (FALSE);
+  np = &tw->files[tw->nfiles];
+  if (!tgstat (path, &np->st)
+      || (np->path = strdup (path)) == NULL)
+    return (TRUE);
+  np->grams = NULL;
+  np->ngrams = 0;
+  tw->nfiles++;
+  if (memchr (buf, '\0', n < 4096 ? n : 4096) != NULL)
+    return (TRUE);
+
+  /* Collect each trigram the first time it's seen, then
+   * clear the bits for the next file.
+   */
+  ng = 0;
+  for (i = 0; i + 2 < n; i++)
+    {
+      g = (buf[i] << 16) | (buf[i + 1] << 8) | buf[i + 2];
+      if (tw->seen[g >> 3] & (1 << (g & 7)))
+	continue;
+      tw->seen[g >> 3] |= 1 << (g & 7);
+      if (ng == tw->ngsize)
+	{
+	  tw->ngsize = tw->ngsize == 0 ? 4096 : 2 * tw->ngsize;
+	  ngrams = (unsigned int *) realloc (tw->grams,
+					     tw->ngsize * sizeof (int));
+	  if (ngrams == NULL)
+	    return (FALSE);
+	  tw->grams = ngrams;
+	}
+      tw->grams[ng++] = g;
+    }
+  for (i = 0; i < ng; i++)
+    tw->seen[tw->grams[i] >> 3] = 0;
+  if (ng > 0)
+    {
+      if ((np->grams = (unsigned int *) malloc (ng * sizeof (int))) == NULL)
+	return (FALSE);
+      memcpy (np->grams, tw->grams, ng * sizeof (int));
+      np->ngrams = (int) ng;
+    }
+  return (TRUE);
+}
+
+/*
+ * Compare two index entries for qsort, by file name.
+ */
+static int
+entrycmp (const void *a, const void *b)
+{
+  return (strcmp (((const TGENTRY *) a)->path, ((const TGENTRY *) b)->path));
+}
+
+/*
+ * Compare two (trigram, file number) pairs for qsort.
+ */
+static int
+paircmp (const void *a, const void *b)
+{
+  unsigned long long pa = *(const unsigned long long *) a;
+  unsigned long long pb = *(const unsigned long long *) b;
+
+  return (pa < pb ? -1 : pa > pb);
+}
+
+/*
+ * Free the files read by the walking threads.
+ */
+static void
+tgworkfree (void)
+{
+  TGWORK *tw;
+  int i;
+
+  for (tw = tgwork; tw < tgwork + NWALK; tw++)
+    {
+      for (i = 0; i < tw->nfiles; i++)
+	{
+	  free (tw->files[i].path);
+	  free ((char *) tw->files[i].grams);
+	}
+      free ((char *) tw->files);
+      free ((char *) tw->seen);
+      free ((char *) tw->grams);
+      memset (tw, 0, sizeof (TGWORK));
+    }
+}
+
+/*
+ * Write a new index file, using the files read by tgscan
+ * and the unchanged files in the old index (marked by tgkeep).
+ * Free the lists of files read.  Return TRUE if successful.
+ */
+int
+tgsave (void)
+{
+  TGENTRY *entries;
+  TGWORK *tw;
+  TGFILE *tf;
+  TGSTAT *sp;
+  TGBUF out, list;
+  unsigned long long *pairs, v;
+  const uchar *p, *end;
+  unsigned int gram;
+  long npairs, i, j, ngrams;
+  int nentries, nnew, id, prev, s;
+  FILE *fp;
+
+  /* Make a list of all of the files in the new index,
+   * and sort it by name.
+   */
+  s = FALSE;
+  pairs = NULL;
+  memset (&out, 0, sizeof (out));
+  memset (&list, 0, sizeof (list));
+  nentries = nnew = 0;
+  npairs = 0;
+  for (tw = tgwork; tw < tgwork + NWALK; tw++)
+    {
+      nnew += tw->nfiles;
+      for (i = 0; i < tw->nfiles; i++)
+	npairs += tw->files[i].ngrams;
+    }
+  entries = (TGENTRY *) malloc ((ntgfiles + nnew + 1) * sizeof (TGENTRY));
+  if (entries == NULL)
+    goto nomem;
+  for (tf = tgfiles; tf < tgfiles + ntgfiles; tf++)
+    if (tf->keep)
+      {
+	entries[nentries].path = tf->path;
+	entries[nentries].old = tf;
+	entries[nentries++].new = NULL;
+      }
+  for (tw = tgwork; tw < tgwork + NWALK; tw++)
+    for (i = 0; i < tw->nfiles; i++)
+      {
+	entries[nentries].path = tw->files[i].path;
+	entries[nentries].old = NULL;
+	entries[nentries++].new = &tw->files[i];
+      }
+  qsort (entries, nentries, sizeof (TGENTRY), entrycmp);
+  for (i = 0; i < nentries; i++)
+    if (entries[i].old != NULL)
+      entries[i].old->newid = (int) i;
+
+  /* Make a list of (trigram, file number) pairs from the
+   * unchanged files in the old index and the files just read,
+   * and sort it by trigram.
+   */
+  for (i = 0; i < ntggrams; i++)
+    npairs += tggrams[i].count;
+  pairs = (unsigned long long *) malloc ((npairs + 1)
+					 * sizeof (unsigned long long));
+  if (pairs == NULL)
+    goto nomem;
+  npairs = 0;
+  for (i = 0; i < ntggrams; i++)
+    {
+      p = tggrams[i].data;
+      end = p + tggrams[i].len;
+      for (j = 0, id = 0; j < tggrams[i].count && getvar (&p, end, &v); j++)
+	{
+	  id += (int) v;
+	  if (id < ntgfiles && tgfiles[id].keep)
+	    pairs[npairs++] = ((unsigned long long) tggrams[i].gram << 32)
+	      | tgfiles[id].newid;
+	}
+    }
+  for (i = 0; i < nentries; i++)
+    if (entries[i].new != NULL)
+      for (j = 0; j < entries[i].new->ngrams; j++)
+	pairs[npairs++] = ((unsigned long long) entries[i].new->grams[j] << 32)
+	  | i;
+  qsort (pairs, npairs, sizeof (unsigned long long), paircmp);
+
+  /* Encode the file list, then each trigram with its list of files.
+   */
+  putbytes (&out, TGMAGIC, TGMAGLEN);
+  putvar (&out, tgstarted);
+  putvar (&out, nentries);
+  for (i = 0; i < nentries; i++)
+    {
+      if (entries[i].old != NULL)
+	sp = &entries[i].old->st;
+      else
+	sp = &entries[i].new->st;
+      putvar (&out, sp->mtime);
+      putvar (&out, sp->ctime);
+      putvar (&out, sp->ino);
+      putvar (&out, sp->size);
+      putvar (&out, strlen (entries[i].path));
+      putbytes (&out, entries[i].path, strlen (entries[i].path));
+    }
+  ngrams = 0;
+  for (i = 0; i < npairs; i++)
+    if (i == 0 || (pairs[i] >> 32) != (pairs[i - 1] >> 32))
+      ngrams++;
+  putvar (&out, ngrams);
+  for (i = 0; i < npairs; i = j)
+    {
+      gram = (unsigned int) (pairs[i] >> 32);
+      list.len = 0;
+      prev = 0;
+      for (j = i; j < npairs && (pairs[j] >> 32) == gram; j++)
+	{
+	  id = (int) (pairs[j] & 0xffffffff);
+	  putvar (&list, id - prev);
+	  prev = id;
+	}
+      putvar (&out, gram);
+      putvar (&out, j - i);
+      putvar (&out, list.len);
+      putbytes (&out, list.buf, list.len);
+    }
+  if (out.error || list.error)
+    goto nomem;
+
+  /* Write the index to a temporary file, then rename it.
+   */
+  if ((fp = fopen (TGTEMP, "wb")) == NULL)
+    {
+      eprintf ("Unable to create %s", TGTEMP);
+      goto out;
+    }
+  if (fwrite (out.buf, 1, out.len, fp) != (size_t) out.len)
+    {
+      fclose (fp);
+      remove (TGTEMP);
+      eprintf ("Unable to write %s", TGTEMP);
+      goto out;
+    }
+  fclose (fp);
+  if (rename (TGTEMP, TGNAME) != 0
+      && (remove (TGNAME) != 0 || rename (TGTEMP, TGNAME) != 0))
+    {
+      remove (TGTEMP);
+      eprintf ("Unable to replace %s", TGNAME);
+      goto out;
+    }
+  eprintf ("[Indexed %d files, %d read, %l trigrams]", nentries, nnew,
+	   ngrams);
+  s = TRUE;
+  goto out;
+
+nomem:
+  eprintf ("Out of memory building %s", TGNAME);
+out:
+  free ((char *) entries);
+  free ((char *) pairs);
+  free ((char *) out.buf);
+  free ((char *) list.buf);
+  tgworkfree ();
+  return (s);
+}
+
+/*
+ * Return TRUE if "name" is the name of the index file.
+ */
+int
+tgisindex (const char *name)
+{
+  return (strcmp (name, TGNAME) == 0 || strcmp (name, TGTEMP) == 0);
+}
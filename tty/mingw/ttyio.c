@@ -147,6 +147,25 @@ ttstat (void)
 #endif
 }
 
+/*
+ * Wait up to "ms" milliseconds for a key to be typed.
+ * Return TRUE if there is a key waiting to be read
+ * by ttgetc.
+ */
+int
+ttwait (int ms)
+{
+  for (;;)
+    {
+      if (_kbhit ())
+	return TRUE;
+      if (ms <= 0)
+	return FALSE;
+      Sleep (10);
+      ms -= 10;
+    }
+}
+
 /*
  * Insert character in the display.  Characters to the right
  * of the insertion point are moved one space to the right.
@@ -46,20 +46,93 @@ extern  int     tttop;
 extern  int     ttbot;
 extern  int     tthue;
 
+/*
+ * Costs, in bytes sent to the terminal, of erasing to
+ * the end of a line, and of inserting or deleting n lines
+ * in a scrolling region.  The display code uses these to decide
+ * whether to scroll part of the screen or to repaint it.
+ */
+int tceeol;
+int tcinsl[NROW + 1];
+int tcdell[NROW + 1];
+
 /*
  * Local variables.
  */
 
+/*
+ * Return the length of the terminfo string capability
+ * "name", with the parameters p1 and p2 filled in, or -1 if
+ * the terminal doesn't have the capability.
+ */
+static int
+capcost (const char *name, int p1, int p2)
+{
+  char *s;
+
+  s = tigetstr (name);
+  if (s == NULL || s == (char *) -1)
+    return (-1);
+  if ((s = tiparm (s, p1, p2)) == NULL)
+    return (-1);
+  return (strlen (s));
+}
+
+/*
+ * Fill in the cost tables for the terminal.  Scrolling
+ * n lines with a scrolling region takes two region changes
+ * and n reverse or forward line feeds; otherwise it takes a
+ * pair of parameterized or repeated insert and delete line
+ * sequences.  Each method also takes two cursor motions.
+ */
+static void
+setcosts (void)
+{
+  int cup, csr, ri, il, dl, il1, dl1, i;
+
+  cup = capcost ("cup", curfp->f_nrow / 2, curfp->f_ncol / 2);
+  csr = capcost ("csr", 0, curfp->f_nrow - 1);
+  ri = capcost ("ri", 0, 0);
+  il = capcost ("il", 2, 0);
+  dl = capcost ("dl", 2, 0);
+  il1 = capcost ("il1", 0, 0);
+  dl1 = capcost ("dl1", 0, 0);
+  if ((tceeol = capcost ("el", 0, 0)) < 0)
+    tceeol = curfp->f_ncol;
+  tcinsl[0] = tcdell[0] = 0;
+  for (i = 1; i <= NROW; i++)
+    {
+      if (csr >= 0 && ri >= 0)
+	tcinsl[i] = 2 * (csr + cup) + i * ri;
+      else if (il >= 0 && dl >= 0)
+	tcinsl[i] = 2 * cup + il + dl;
+      else if (il1 >= 0 && dl1 >= 0)
+	tcinsl[i] = 2 * cup + i * (il1 + dl1);
+      else
+	tcinsl[i] = NROW * NCOL;	/* Too high to be used	*/
+      if (csr >= 0)
+	tcdell[i] = 2 * (csr + cup) + i;
+      else if (il >= 0 && dl >= 0)
+	tcdell[i] = 2 * cup + il + dl;
+      else if (il1 >= 0 && dl1 >= 0)
+	tcdell[i] = 2 * cup + i * (il1 + dl1);
+      else
+	tcdell[i] = NROW * NCOL;
+    }
+}
+
 /*
  * Initialize the terminal.  On other terminal types, we would
  * get the handles for console input and output, and peek at the video
  * buffer to see what video attributes were being used.  With Curses,
- * we only need to get the current terminal size.
+ * we only need to get the current terminal size, and the costs
+ * of the operations that the display code chooses between.
  */
 void
 ttinit (void)
 {
   ttgetsize ();
+  setcosts ();
 }
 
 /*
@@ -114,6 +187,37 @@ ttbeep (void)
     {}	/* suppress warning about "ignoring return value of write" */
 }
 
+/*
+ * Insert nchunk blank lines at "row", scrolling the lines
+ * from there to "bot" down, and losing the ones that move
+ * past "bot".  Curses does this with a scrolling region, and
+ * works out how to do the same thing on the terminal.
+ */
+void
+ttinsl (int row, int bot, int nchunk)
+{
+  scrollok (stdscr, TRUE);
+  setscrreg (row, bot);
+  scrl (-nchunk);
+  setscrreg (0, LINES - 1);
+  scrollok (stdscr, FALSE);
+}
+
+/*
+ * Delete nchunk lines at "row", scrolling the lines
+ * below them up to "row", and putting blank lines
+ * at the bottom of the region, which ends at "bot".
+ */
+void
+ttdell (int row, int bot, int nchunk)
+{
+  scrollok (stdscr, TRUE);
+  setscrreg (row, bot);
+  scrl (nchunk);
+  setscrreg (0, LINES - 1);
+  scrollok (stdscr, FALSE);
+}
+
 /*
  * No-op.
  */
@@ -158,13 +262,14 @@ ttresize (void)
 }
 
 /*
- * High speed screen update.  row and col are 0-based.
+ * High speed screen update.  Write the n characters
+ * at buf starting at row and col, which are 0-based.
  */
 void
-ttputline (int row, int col, const wchar_t *buf)
+ttputline (int row, int col, const wchar_t *buf, int n)
 {
   /* Write line text to screen.
    */
   move (row, col);
-  ttputs (buf, curfp->f_ncol - col);
+  ttputs (buf, n);
 }
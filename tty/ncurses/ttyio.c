@@ -64,6 +64,31 @@ int ncol;			/* Terminal size, columns.      */
 int waiting;
 int interrupted;
 
+/*
+ * Counts of the UTF-8 bytes of text given to curses, and of the
+ * flushes that sent some text.  Curses adds its own escape sequences,
+ * which aren't counted, and sends the changes with one write
+ * at each flush, unless there are more than fit in its buffer.
+ */
+long ttbytes;
+long ttwrites;
+static long flushbytes;		/* ttbytes at the last flush	*/
+
+/*
+ * Return the number of bytes in the UTF-8 encoding of c.
+ */
+static int
+utf8len (wchar_t c)
+{
+  if (c < 0x80)
+    return 1;
+  if (c < 0x800)
+    return 2;
+  if (c < 0x10000)
+    return 3;
+  return 4;
+}
+
 /*
  * Get the tty size and save it in the current frame.
  */
@@ -95,6 +120,7 @@ ttopen (void)
   initscr ();			/* initialize the curses library */
   keypad (stdscr, TRUE);	/* enable keyboard mapping */
   nonl ();			/* tell curses not to do NL->CR/NL on output */
+  idlok (stdscr, TRUE);		/* let curses use insert/delete line */
   cbreak ();			/* take input chars one at a time, no wait for \n */
   noecho ();
   raw ();
@@ -189,6 +215,29 @@ ttstat (void)
   return FALSE;
 }
 
+/*
+ * Wait up to "ms" milliseconds for a key to be typed.
+ * Return TRUE if there is a key waiting to be read
+ * by ttgetc.  The key is pushed back into curses.
+ */
+int
+ttwait (int ms)
+{
+  wint_t c;
+  int r;
+
+  timeout (ms);
+  r = get_wch (&c);
+  timeout (-1);
+  if (r == ERR)
+    return FALSE;
+  if (r == KEY_CODE_YES)
+    ungetch (c);
+  else
+    unget_wch (c);
+  return TRUE;
+}
+
 /*
  * Write character to the display.
  * Characters are buffered up, to make things
@@ -204,6 +253,7 @@ ttputc (int c)
   wch[1] = 0;
   setcchar (&wcval, wch, 0, 0, NULL);
   add_wch (&wcval);
+  ttbytes += utf8len (c);
   return c;
 }
 
@@ -221,6 +271,7 @@ ttinsertc (int c)
   wch[1] = 0;
   setcchar (&wcval, wch, 0, 0, NULL);
   ins_wch (&wcval);
+  ttbytes += utf8len (c);
   return c;
 }
 
@@ -252,6 +303,7 @@ ttputs (const wchar_t *buf, int size)
   for (i = 0; i < size; i++)
     {
       wch[0] = buf[i];
+      ttbytes += utf8len (wch[0]);
       if (modifier != 0)
 	{
 	  wch[1] = modifier;
@@ -279,7 +331,12 @@ ttputs (const wchar_t *buf, int size)
 void
 ttflush (void)
 {
-   refresh ();
+  refresh ();
+  if (ttbytes != flushbytes)
+    {
+      ++ttwrites;
+      flushbytes = ttbytes;
+    }
 }
 
 /*
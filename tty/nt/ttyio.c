@@ -220,3 +220,31 @@ int ttstat()
     return 0;
 #endif
 }
+
+/*
+ * Wait up to "ms" milliseconds for a key to be typed.
+ * Return TRUE if there is a key waiting to be read
+ * by ttgetc.  Other console events (mouse, focus, key
+ * releases) are thrown away, because ttgetc ignores them.
+ */
+int ttwait(int ms)
+{
+    INPUT_RECORD ir;
+    DWORD nread;
+
+    for (;;)
+    {
+	if (!PeekConsoleInput(hin, &ir, 1, &nread))
+	    return FALSE;
+	if (nread != 0)
+	{
+	    if (ir.EventType == KEY_EVENT && ir.Event.KeyEvent.bKeyDown)
+		return TRUE;
+	    ReadConsoleInput(hin, &ir, 1, &nread);
+	    continue;
+	}
+	if (WaitForSingleObject(hin, ms) != WAIT_OBJECT_0)
+	    return FALSE;
+	ms = 0;
+    }
+}
@@ -0,0 +1,289 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Name:	MicroEMACS
+ *		Null terminal display
+ * By:		Mark Alexander
+ *		marka@pobox.com
+ *
+ * The functions in this file draw on the in-memory screen
+ * in "ttyio.c", and count the bytes of the ANSI escape
+ * sequences that would have done the same thing on a
+ * terminal.
+ */
+
+#include	"def.h"
+
+extern  int     nrow;
+extern  int     ncol;
+
+/*
+ * Costs, in bytes sent to the terminal, of erasing to
+ * the end of a line, and of inserting or deleting n lines
+ * in a scrolling region.  The display code uses these to decide
+ * whether to scroll part of the screen or to repaint it.
+ */
+int tceeol;
+int tcinsl[NROW + 1];
+int tcdell[NROW + 1];
+
+/*
+ * Return the number of digits in n.
+ */
+static int
+ndigits (int n)
+{
+  int i;
+
+  for (i = 1; n >= 10; i++)
+    n /= 10;
+  return (i);
+}
+
+/*
+ * Return the length of ESC [ row ; col H, which
+ * moves the cursor to the origin 0 row and col.
+ */
+static int
+cupcost (int row, int col)
+{
+  return (4 + ndigits (row + 1) + ndigits (col + 1));
+}
+
+/*
+ * Return the length of ESC [ top ; bot r, which sets
+ * the scrolling region to the origin 0 rows top to bot.
+ */
+static int
+csrcost (int top, int bot)
+{
+  return (4 + ndigits (top + 1) + ndigits (bot + 1));
+}
+
+/*
+ * Fill in the cost tables.  Scrolling n lines takes
+ * two scrolling region changes, two cursor motions,
+ * and n reverse (ESC M) or forward (newline) line feeds.
+ */
+static void
+setcosts (void)
+{
+  int cup, csr, i;
+
+  cup = cupcost (curfp->f_nrow / 2, curfp->f_ncol / 2);
+  csr = csrcost (0, curfp->f_nrow - 1);
+  tceeol = 3;
+  tcinsl[0] = tcdell[0] = 0;
+  for (i = 1; i <= NROW; i++)
+    {
+      tcinsl[i] = 2 * (csr + cup) + i * 2;
+      tcdell[i] = 2 * (csr + cup) + i;
+    }
+}
+
+/*
+ * Initialize the terminal.  Get the screen size,
+ * and the costs of the operations that the display
+ * code chooses between.
+ */
+void
+ttinit (void)
+{
+  ttgetsize ();
+  setcosts ();
+}
+
+/*
+ * No tidy up.
+ */
+void
+tttidy (void)
+{
+}
+
+/*
+ * Move the cursor to the specified
+ * origin 0 row and column position.  This
+ * costs nothing if the cursor is already there.
+ */
+void
+ttmove (int row, int col)
+{
+  if (row != ttrow || col != ttcol)
+    ttemit (cupcost (row, col), 1);
+  ttrow = row;
+  ttcol = col;
+  curfp->f_ttrow = row;
+  curfp->f_ttcol = col;
+}
+
+/*
+ * Blank the cells of row from col to the end
+ * of the screen, in the current color.
+ */
+static void
+blank (int row, int col)
+{
+  CELL *cp;
+
+  if (col > 0 && col < ncol && ttscreen[row][col].c_char == 0)
+    ttscreen[row][col - 1].c_char = ' ';
+  for (; col < ncol; col++)
+    {
+      cp = &ttscreen[row][col];
+      cp->c_char = ' ';
+      cp->c_mark = 0;
+      cp->c_color = tthue;
+    }
+}
+
+/*
+ * Erase to end of line.
+ */
+void
+tteeol (void)
+{
+  if (ttrow >= 0)
+    blank (ttrow, ttcol);
+  ttemit (3, 1);		/* ESC [ K		*/
+}
+
+/*
+ * Erase to end of page.
+ */
+void
+tteeop (void)
+{
+  int row;
+
+  if (ttrow >= 0)
+    {
+      blank (ttrow, ttcol);
+      for (row = ttrow + 1; row < nrow; row++)
+	blank (row, 0);
+    }
+  ttemit (3, 1);		/* ESC [ J		*/
+}
+
+/*
+ * Make a noise.
+ */
+void
+ttbeep (void)
+{
+  ttemit (1, 0);
+}
+
+/*
+ * Move rows "from" through "from + n - 1" to "to",
+ * and blank the "nchunk" rows starting at "gap".
+ */
+static void
+moverows (int to, int from, int n, int gap, int nchunk)
+{
+  memmove (ttscreen[to], ttscreen[from], n * sizeof (ttscreen[0]));
+  while (nchunk-- > 0)
+    blank (gap++, 0);
+}
+
+/*
+ * Insert nchunk blank lines at "row", scrolling the lines
+ * from there to "bot" down, and losing the ones that move
+ * past "bot".  This is done by setting a scrolling region
+ * and sending reverse line feeds at its top.
+ */
+void
+ttinsl (int row, int bot, int nchunk)
+{
+  if (nchunk > bot - row + 1)
+    nchunk = bot - row + 1;
+  moverows (row + nchunk, row, bot - row + 1 - nchunk, row, nchunk);
+  ttemit (csrcost (row, bot) + 3, 2);	/* Region, then reset	*/
+  ttemit (cupcost (row, 0) + 2 * nchunk, 1 + nchunk);
+  ttrow = -1;			/* Where the cursor is */
+}				/* depends on terminal */
+
+/*
+ * Delete nchunk lines at "row", scrolling the lines
+ * below them up to "row", and putting blank lines
+ * at the bottom of the region, which ends at "bot".
+ * This sends line feeds at the bottom of the region.
+ */
+void
+ttdell (int row, int bot, int nchunk)
+{
+  if (nchunk > bot - row + 1)
+    nchunk = bot - row + 1;
+  moverows (row, row + nchunk, bot - row + 1 - nchunk,
+	    bot - nchunk + 1, nchunk);
+  ttemit (csrcost (row, bot) + 3, 2);
+  ttemit (cupcost (bot, 0) + nchunk, 1);
+  ttrow = -1;
+}
+
+/*
+ * No-op.
+ */
+void
+ttwindow (int top, int bot)
+{
+}
+
+/*
+ * No-op.
+ */
+void
+ttnowindow (void)
+{
+}
+
+/*
+ * Set display color.  This costs an ESC [ 7 m
+ * or an ESC [ m if the color changes.
+ */
+void
+ttcolor (int color)
+{
+  if (color != tthue)
+    ttemit (color == CMODE ? 4 : 3, 1);
+  tthue = color;
+}
+
+/*
+ * The screen size can only change when
+ * the editor starts, so just get it again.
+ */
+void
+ttresize (void)
+{
+  ttinit ();
+}
+
+/*
+ * High speed screen update.  Write the n characters
+ * at buf starting at row and col, which are 0-based.
+ */
+void
+ttputline (int row, int col, const wchar_t *buf, int n)
+{
+  ttmove (row, col);
+  ttputs (buf, n);
+}
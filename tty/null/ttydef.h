@@ -0,0 +1,76 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ *	Null terminal file.
+ */
+
+#define	NROW	256		/* Rows.                        */
+#define	NCOL	256		/* Columns.                     */
+
+/*
+ * Function keys.  The script file sends these
+ * as the escape sequences of an xterm.
+ */
+#define	KUP	K01
+#define	KDOWN	K02
+#define	KLEFT	K03
+#define	KRIGHT	K04
+#define	KPGUP	K05
+#define	KPGDN	K06
+#define	KHOME	K07
+#define	KEND	K08
+#define	KINS	K09
+#define	KDEL	K0A
+#define	KF1	K0B
+#define	KF2	K0C
+#define	KF3	K0D
+#define	KF4	K0E
+#define	KF5	K0F
+#define	KF6	K10
+#define	KF7	K11
+#define	KF8	K12
+#define	KF9	K13
+#define	KF10	K14
+#define	KF11	K15
+#define	KF12	K16
+
+#define	NFKEYS	12		/* # of function keys		*/
+
+/*
+ * One character cell of the in-memory screen.  A wide
+ * character fills two cells, and the second one holds
+ * a zero.  A combining character is kept in the cell of
+ * the character it is drawn on.
+ */
+typedef struct
+{
+  wchar_t c_char;		/* Character, or 0 if covered	*/
+  wchar_t c_mark;		/* Combining character, or 0	*/
+  int c_color;			/* CTEXT or CMODE		*/
+} CELL;
+
+extern CELL ttscreen[NROW][NCOL];	/* The screen			*/
+extern int ttrow;		/* Cursor row, or -1 if unknown	*/
+extern int ttcol;		/* Cursor column		*/
+extern int tthue;		/* Current color		*/
+
+void ttemit (int nbytes, int nesc);	/* Count terminal output	*/
+int ttmatch (const char *s);		/* Read s if it is next		*/
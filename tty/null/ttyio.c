@@ -0,0 +1,397 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Name:	MicroEMACS
+ *		Null terminal I/O.
+ *
+ * By:		Mark Alexander
+ *		marka@pobox.com
+ *
+ * The functions in this file stand in for a terminal, so
+ * that the editor can run without one: under a test script,
+ * or to time the display code.  The keys come from a script
+ * file, named by the environment variable PEKEYS, or from
+ * the standard input.  The characters go into an in-memory
+ * screen, and the bytes and escape sequences that an ANSI
+ * terminal would have been sent are counted.  When the script
+ * runs out, the editor quits, writing the final screen to the
+ * standard output and the counts to the standard error.
+ * The screen size comes from the environment variables
+ * LINES and COLUMNS, and is 24 by 80 if they are not set.
+ */
+
+#include	"def.h"
+
+#include	<locale.h>
+#include	<langinfo.h>
+
+CELL ttscreen[NROW][NCOL];	/* The screen			*/
+int ttrow = -1;			/* Cursor row, or -1 if unknown	*/
+int ttcol;			/* Cursor column		*/
+int tthue = CTEXT;		/* Current color		*/
+
+int nrow;			/* Terminal size, rows.         */
+int ncol;			/* Terminal size, columns.      */
+int waiting;
+int interrupted;
+
+static uchar *keys;		/* The script			*/
+static int nkeys;		/* Its length			*/
+static int keyoff;		/* Offset of the next key	*/
+
+long ttbytes;			/* Bytes sent to terminal	*/
+long ttwrites;			/* Flushes that sent anything	*/
+static long nescs;		/* Escape sequences sent	*/
+static long nframe;		/* Bytes not yet flushed	*/
+
+/*
+ * Count n bytes, of which nesc escape sequences
+ * are a part, as sent to the terminal.
+ */
+void
+ttemit (int n, int nesc)
+{
+  ttbytes += n;
+  nescs += nesc;
+  nframe += n;
+}
+
+/*
+ * Get an integer from the environment variable "name",
+ * or return "def" if it is not set or is out of range.
+ */
+static int
+getsize (const char *name, int def, int max)
+{
+  const char *s;
+  int n;
+
+  if ((s = getenv (name)) == NULL || (n = atoi (s)) <= 0)
+    return (def);
+  return (n > max ? max : n);
+}
+
+/*
+ * Get the screen size and save it in the current frame.
+ */
+void
+ttgetsize (void)
+{
+  curfp->f_nrow = nrow = getsize ("LINES", 24, NROW);
+  curfp->f_ncol = ncol = getsize ("COLUMNS", 80, NCOL);
+}
+
+/*
+ * This function gets called once, to set up
+ * the terminal channel.  Clear the screen,
+ * and read in the whole script.  The character
+ * widths come from the locale, so use a UTF-8 one
+ * even if the environment doesn't ask for it.
+ */
+void
+ttopen (void)
+{
+  const char *name;
+  FILE *fp;
+  int size, n, row, col;
+
+  if (setlocale (LC_CTYPE, "") == NULL
+      || strcmp (nl_langinfo (CODESET), "UTF-8") != 0)
+    setlocale (LC_CTYPE, "C.UTF-8");
+  for (row = 0; row < NROW; row++)
+    for (col = 0; col < NCOL; col++)
+      {
+	ttscreen[row][col].c_char = ' ';
+	ttscreen[row][col].c_mark = 0;
+	ttscreen[row][col].c_color = CTEXT;
+      }
+  if ((name = getenv ("PEKEYS")) == NULL)
+    fp = stdin;
+  else if ((fp = fopen (name, "rb")) == NULL)
+    {
+      fprintf (stderr, "Cannot open key script %s\n", name);
+      exit (1);
+    }
+  size = 1024;
+  keys = (uchar *) malloc (size + 8);
+  while (keys != NULL && (n = fread (keys + nkeys, 1, size - nkeys, fp)) > 0)
+    if ((nkeys += n) == size)
+      keys = (uchar *) realloc (keys, (size *= 2) + 8);
+  if (keys == NULL)
+    panic ("Out of memory reading key script");
+  memset (&keys[nkeys], 0, 8);	/* Stop ugetc at the end	*/
+  if (fp != stdin)
+    fclose (fp);
+}
+
+/*
+ * There is no tty state to save or restore.
+ */
+int
+ttold (void)
+{
+  return TRUE;
+}
+
+int
+ttnew (void)
+{
+  return TRUE;
+}
+
+int
+ttshell (void)
+{
+  return TRUE;
+}
+
+/*
+ * This function gets called just before we go back
+ * home to the shell.  Write out the screen, with the
+ * trailing blanks of each row removed, and the counts.
+ */
+void
+ttclose (void)
+{
+  uchar buf[NCOL * 12 + 1];
+  CELL *cp;
+  int row, col, n, end;
+
+  for (row = 0; row < nrow; row++)
+    {
+      n = end = 0;
+      for (col = 0; col < ncol; col++)
+	{
+	  cp = &ttscreen[row][col];
+	  if (cp->c_char == 0)
+	    continue;
+	  n += uputc (cp->c_char, &buf[n]);
+	  if (cp->c_mark != 0)
+	    n += uputc (cp->c_mark, &buf[n]);
+	  if (cp->c_char != ' ' || cp->c_mark != 0)
+	    end = n;
+	}
+      buf[end] = '\n';
+      fwrite (buf, 1, end + 1, stdout);
+    }
+  fflush (stdout);
+  fprintf (stderr, "bytes %ld escapes %ld writes %ld\n",
+	   ttbytes, nescs, ttwrites);
+}
+
+/*
+ * Check for keyboard typeahead.  Return FALSE, as
+ * with curses, so that the screen is updated after
+ * every key of the script, as if it had been typed.
+ */
+int
+ttstat (void)
+{
+  return FALSE;
+}
+
+/*
+ * Return TRUE if there is a key waiting to be read by
+ * ttgetc.  Return FALSE, as if the keys of the script were
+ * typed slowly, so that work done between keys, such as
+ * reading big files in the background, is always finished
+ * before the next key is read.
+ */
+int
+ttwait (int ms)
+{
+  return FALSE;
+}
+
+/*
+ * Write character to the display.
+ */
+int
+ttputc (int c)
+{
+  wchar_t wc = c;
+
+  ttputs (&wc, 1);
+  return c;
+}
+
+/*
+ * Insert character in the display.  Characters to the right
+ * of the insertion point are moved one space to the right.
+ */
+int
+ttinsertc (int c)
+{
+  CELL *cp;
+
+  if (ttrow >= 0 && ttcol < ncol)
+    {
+      cp = &ttscreen[ttrow][ttcol];
+      memmove (cp + 1, cp, (ncol - ttcol - 1) * sizeof (CELL));
+      ttemit (3, 1);		/* ESC [ @		*/
+    }
+  return ttputc (c);
+}
+
+/*
+ * Delete character in the display.  Characters to the right
+ * of the deletion point are moved one space to the left.
+ */
+void
+ttdelc (void)
+{
+  CELL *cp;
+
+  if (ttrow < 0 || ttcol >= ncol)
+    return;
+  cp = &ttscreen[ttrow][ttcol];
+  memmove (cp, cp + 1, (ncol - ttcol - 1) * sizeof (CELL));
+  cp = &ttscreen[ttrow][ncol - 1];
+  cp->c_char = ' ';
+  cp->c_mark = 0;
+  cp->c_color = tthue;
+  ttemit (3, 1);		/* ESC [ P		*/
+}
+
+/*
+ * Clear the cell at row, col, and the other half
+ * of the wide character it is part of, if any.
+ */
+static void
+clearcell (int row, int col)
+{
+  CELL *cp = &ttscreen[row][col];
+
+  if (cp->c_char == 0 && col > 0)
+    cp[-1].c_char = ' ';
+  else if (col + 1 < ncol && cp[1].c_char == 0)
+    cp[1].c_char = ' ';
+  cp->c_mark = 0;
+}
+
+/*
+ * Write multiple characters to the display.  As with
+ * the other terminals, a combining character is drawn
+ * on the character that follows it in buf.  Characters
+ * that don't fit in the row are dropped.
+ */
+void
+ttputs (const wchar_t *buf, int size)
+{
+  static uchar utf8[6 * NCOL];
+  wchar_t c, mark = 0;
+  CELL *cp;
+  int i, w;
+
+  for (i = 0; i < size; i += NCOL)
+    ttemit (uputs (buf + i, size - i < NCOL ? size - i : NCOL, utf8), 0);
+  for (i = 0; i < size; i++)
+    {
+      c = buf[i];
+      if (ucombining (c))
+	{
+	  mark = c;
+	  continue;
+	}
+      if ((w = uwidth (c)) < 1)
+	w = 1;
+      if (ttrow < 0 || ttcol + w > ncol)
+	{
+	  mark = 0;
+	  continue;
+	}
+      clearcell (ttrow, ttcol);
+      cp = &ttscreen[ttrow][ttcol];
+      cp->c_char = c;
+      cp->c_mark = mark;
+      cp->c_color = tthue;
+      if (w == 2)
+	{
+	  clearcell (ttrow, ttcol + 1);
+	  cp[1].c_char = 0;
+	  cp[1].c_color = tthue;
+	}
+      ttcol += w;
+      mark = 0;
+    }
+}
+
+/*
+ * Flush output.  A real terminal would get
+ * everything since the last flush in one write.
+ */
+void
+ttflush (void)
+{
+  if (nframe != 0)
+    {
+      ++ttwrites;
+      nframe = 0;
+    }
+}
+
+/*
+ * If the script continues with the string s,
+ * read past it and return TRUE.
+ */
+int
+ttmatch (const char *s)
+{
+  int n = strlen (s);
+
+  if (n > nkeys - keyoff || memcmp (&keys[keyoff], s, n) != 0)
+    return FALSE;
+  keyoff += n;
+  return TRUE;
+}
+
+/*
+ * Read the next UTF-8 character from the script.
+ * When the script runs out, quit the editor.
+ */
+int
+ttgetc (void)
+{
+  int len;
+  wchar_t c;
+
+  if (keyoff >= nkeys)
+    {
+      jouexit ();
+      vttidy ();
+      exit (GOOD);
+    }
+  c = ugetc (&keys[keyoff], 0, &len);
+  if (len > nkeys - keyoff)
+    len = nkeys - keyoff;
+  keyoff += len;
+  return (int) c;
+}
+
+/*
+ * panic - just exit, as quickly as we can.
+ */
+void
+panic (char *s)
+{
+  fprintf (stderr, "panic: %s\n", s);
+  abort ();			/* To leave a core image. */
+}
@@ -0,0 +1,126 @@
+/*
+    Copyright (C) 2026 Mark Alexander
+
+    This file is part of MicroEMACS, a small text editor.
+
+    MicroEMACS is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Name:	MicroEMACS
+ * 		Null terminal keyboard
+ *
+ * By:		Mark Alexander
+ *		marka@pobox.com
+ */
+
+#include	"def.h"
+
+/*
+ * Names for the keys with basic keycode
+ * between KFIRST and KLAST (inclusive). This is used by
+ * the key name routine in "kbd.c".
+ */
+const char *keystrings[32] = {
+	NULL,		"Up",		"Down",		"Left",
+	"Right",	"PgUp",		"PgDn",		"Home",
+	"End",		"Insert",	"Delete",	"F1",
+	"F2",		"F3",		"F4",		"F5",
+	"F6",		"F7",		"F8",		"F9",
+	"F10",		"S-F1",		"S-F2",		"S-F3",
+	"S-F4",		"S-F5",		"S-F6",		"S-F7",
+	"S-F8",		"S-F9",		"S-F10",	NULL
+};
+
+/*
+ * The sequences, following an ESC, that an xterm
+ * sends for the keys named in the keystrings table
+ * above.  These map into the MicroEMACS internal key
+ * values K01 to K1F.
+ */
+static const char *specmap[32] = {
+	NULL,		"[A",		"[B",		"[D",
+	"[C",		"[5~",		"[6~",		"[H",
+	"[F",		"[2~",		"[3~",		"OP",
+	"OQ",		"OR",		"OS",		"[15~",
+	"[17~",		"[18~",		"[19~",		"[20~",
+	"[21~",		"[23~",		"[24~",		NULL,
+	NULL,		NULL,		NULL,		NULL,
+	NULL,		NULL,		NULL,		NULL
+};
+
+/*
+ * Read in a key from the script.  If an ESC is followed
+ * by the sequence for one of the special keys, return
+ * the internal code for that key.  Everything else goes
+ * right through, and gets remapped by "getkey".
+ */
+int
+getkbd (void)
+{
+  int c;
+  int i;
+
+  c = ttgetc ();
+  if (c != 0x1B)
+    return (c);
+  for (i = 0; i < 32; i++)
+    if (specmap[i] != NULL && ttmatch (specmap[i]))
+      return (KFIRST + i);
+  return (c);
+}
+
+/*
+ * Terminal specific keymap initialization.
+ * Attach the special keys to the appropriate built
+ * in functions.  As is the case of all the keymap
+ * routines, errors are very fatal.
+ */
+void
+ttykeymapinit (void)
+{
+  keydup (KUP,		"back-line");
+  keydup (KDOWN,	"forw-line");
+  keydup (KLEFT,	"back-char");
+  keydup (KRIGHT,	"forw-char");
+  keydup (KCTRL|KLEFT,	"back-word");
+  keydup (KCTRL|KRIGHT,	"forw-word");
+  keydup (KPGUP,	"back-page");
+  keydup (KPGDN,	"forw-page");
+  keydup (KCTRL|KPGUP,	"up-window");
+  keydup (KCTRL|KPGDN,	"down-window");
+  keydup (KHOME,	"goto-bol");
+  keydup (KEND,		"goto-eol");
+  keydup (KCTRL|KHOME,	"goto-bob");
+  keydup (KCTRL|KEND,	"goto-eob");
+  keydup (KINS,		"set-overstrike");
+  keydup (KDEL,		"forw-del-char");
+  keydup (KF1,		"help");
+  keydup (KF2,		"file-save");
+  keydup (KF3,		"file-visit");
+  keydup (KF4,		"quit");
+  keydup (KF5,		"undo");
+#if USE_RUBY
+  keydup (KF6,		"ruby-string");
+#else
+  keydup (KF6,		"display-buffers");
+#endif
+  keydup (KF7,		"redo");
+  keydup (KF8,		"forw-buffer");
+  keydup (KF9,		"search-again");
+  keydup (KF10,		"forw-frame");
+  keydup (KF11,		"find-cscope");
+  keydup (KF12,		"next-cscope");
+}
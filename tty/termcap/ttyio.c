@@ -49,6 +49,7 @@
 #include        <unistd.h>
 #endif
 #include	<termios.h>
+#include	<poll.h>
 #include	<termcap.h>
 
 /* The following kludge is for SunOS */
@@ -56,10 +57,11 @@
 #define _POSIX_VDISABLE 0
 #endif
 
-#define	NOBUF	512		/* Output buffer size.          */
+#define	NOBUF	4096		/* First output buffer size.    */
 
-static char obuf[NOBUF];	/* Output buffer.               */
-static int nobuf;
+static uchar *obuf;		/* Output buffer.               */
+static int nobuf;		/* Bytes in it.                 */
+static int sobuf;		/* Its size.                    */
 static struct termios oldtty;	/* Old tty state		*/
 static struct termios newtty;	/* New tty state		*/
 
@@ -228,6 +230,50 @@ ttstat (void)
   return (n > 0);
 }
 
+/*
+ * Wait up to "ms" milliseconds for a key to be typed.
+ * Return TRUE if there is a key waiting to be read
+ * by ttgetc.
+ */
+int
+ttwait (int ms)
+{
+  struct pollfd pfd;
+
+  pfd.fd = 0;
+  pfd.events = POLLIN;
+  return (poll (&pfd, 1, ms) > 0);
+}
+
+/*
+ * Make room for n more bytes in the output buffer.
+ * The buffer grows as needed, so that everything
+ * between two flushes, which is usually a whole screen
+ * update, goes to the terminal in a single write.
+ */
+static void
+ttroom (int n)
+{
+  uchar *p;
+  int size;
+
+  if (nobuf + n <= sobuf)
+    return;
+  for (size = sobuf == 0 ? NOBUF : sobuf; size < nobuf + n; size *= 2)
+    ;
+  if ((p = (uchar *) realloc (obuf, size)) != NULL)
+    {
+      obuf = p;
+      sobuf = size;
+    }
+  else
+    {
+      ttflush ();
+      if (n > sobuf)
+	panic ("Out of memory for terminal output");
+    }
+}
+
 /*
  * Write character to the display.
  * Characters are buffered up, to make things
@@ -236,31 +282,21 @@ ttstat (void)
 int
 ttputc (int c)
 {
-  static uchar buf[6];
-  int i, len;
-
-  /* Convert Unicode to UTF-8 and output each byte.
-   */
-  len = uputc (c, buf);
-  for (i = 0; i < len; i++)
-    {
-      if (nobuf >= NOBUF)
-	ttflush ();
-      obuf[nobuf++] = buf[i];
-    }
+  ttroom (6);
+  nobuf += uputc (c, &obuf[nobuf]);
   return c;
 }
 
 /*
  * Write multiple characters to the display.
- * Use this entry point to optimization on some systems.
- * Here we just call ttputc.
+ * Convert them to UTF-8 all at once, straight
+ * into the output buffer.
  */
 void
 ttputs (const wchar_t *buf, int size)
 {
-  while (size--)
-    ttputc (*buf++);
+  ttroom (6 * size);
+  nobuf += uputs (buf, size, &obuf[nobuf]);
 }
 
 /*
@@ -166,38 +166,6 @@ freeundo (UNDO *up)
 }
 
 
-/*
- * Calculate the zero-based line number for a given line pointer
- * and buffer.
- */
-int
-blineno (const BUFFER *bp, const LINE *lp)
-{
-  LINE *clp;
-  int nline;
-
-  clp = firstline (bp);
-  nline = 0;
-  for (;;)
-    {
-      if (clp == lastline (curbp) || clp == lp)
-	break;
-      clp = lforw (clp);
-      ++nline;
-    }
-  return nline;
-}
-
-/*
- * Calculate the zero-based line number for a given line pointer
- * in the current buffer.
- */
-int
-lineno (const LINE *lp)
-{
-  return blineno (curbp, lp);
-}
-
 /*
  * Allocate a new undo stack structure, but don't
  * add any undo groups to it yet.
@@ -866,6 +834,8 @@ killundo (BUFFER *bp)
 {
   UNDOSTACK *st = bp->b_undo;
 
+  if (st == NULL)		/* Never had an undo record	*/
+    return;
   freegrouplist (st, &st->undolist);
   freegrouplist (st, &st->redolist);
   free (st);
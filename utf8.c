@@ -131,6 +131,23 @@ unblen (const uchar *s, int n)
   return s - start;
 }
 
+/*
+ * Return TRUE if the n bytes in s are all 7-bit ASCII,
+ * i.e. if each byte is a complete UTF-8 character.
+ * The bytes are or'ed together without an early exit,
+ * which lets the compiler vectorize the loop.
+ */
+int
+uisascii (const uchar *s, int n)
+{
+  uchar bits = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    bits |= s[i];
+  return (bits & 0x80) == 0;
+}
+
 /*
  * Get the nth UTF-8 character in s, return it
  * as a 32-bit unicode character.  If len is not NULL,
@@ -271,6 +288,50 @@ uputc (wchar_t c, uchar *s)
   return 1;
 }
 
+/*
+ * Convert the n Unicode characters at s to UTF-8, writing
+ * them to buf, which must be at least 6 * n bytes long.
+ * Return the number of bytes written.  Runs of ASCII are
+ * copied eight characters at a time, and checked afterwards,
+ * in a loop simple enough for the compiler to turn into vector
+ * instructions.
+ */
+int
+uputs (const wchar_t *s, int n, uchar *buf)
+{
+  uchar *p;
+  const wchar_t *end;
+  unsigned int bits;
+  int i;
+
+  p = buf;
+  end = s + n;
+  while (s < end)
+    {
+      if (end - s >= 8)
+	{
+	  bits = 0;
+	  for (i = 0; i < 8; i++)
+	    {
+	      p[i] = s[i];
+	      bits |= s[i];
+	    }
+	  if (bits < 0x80)
+	    {
+	      p += 8;
+	      s += 8;
+	      continue;
+	    }
+	}
+      if ((unsigned int) *s < 0x80)
+	*p++ = *s;
+      else
+	p += uputc (*s, p);
+      s++;
+    }
+  return p - buf;
+}
+
 /*
  * Return the display width of a Unicode character.
  * This is just a wrapper for wcwidth.